@@ -0,0 +1,136 @@
+/**
+  This file contains the bump-pointer arena used for a loaded program.
+  @file arena.c
+  @author David Lovato, dalovato
+*/
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/**
+  This function will round a size or an address up to the arena's
+  alignment.
+  @param size the size or address to round
+  @return the rounded size
+*/
+static uintptr_t alignSize( uintptr_t size )
+{
+  return ( size + ARENA_ALIGN - 1 ) & ~( (uintptr_t) ARENA_ALIGN - 1 );
+}
+
+/**
+  This function will compute a hash code for a string (FNV-1a).
+  @param str the string to hash
+  @param len the length of the string
+  @return the hash code for str
+*/
+static unsigned int hashString( char const *str, int len )
+{
+  unsigned int h = 2166136261u;
+  for ( int i = 0; i < len; i++ ) {
+    h ^= (unsigned char) str[ i ];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/**
+  This function will find the bucket holding the given string, or the
+  empty bucket where it would go.
+  @param strings the hash table to search
+  @param cap number of buckets in the table
+  @param str the string to look for
+  @param len the length of the string
+  @return the index of the bucket
+*/
+static int findString( char const **strings, int cap, char const *str, int len )
+{
+  int mask = cap - 1;
+  int i = hashString( str, len ) & mask;
+  while ( strings[ i ] &&
+          ( strncmp( strings[ i ], str, len ) != 0 || strings[ i ][ len ] != '\0' ) )
+    i = ( i + 1 ) & mask;
+  return i;
+}
+
+void initArena( Arena *arena )
+{
+  arena->block = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+
+  arena->stringCap = ARENA_STRING_BUCKETS;
+  arena->stringCount = 0;
+  arena->strings = (char const **) calloc( arena->stringCap, sizeof( char const * ) );
+}
+
+void *arenaAlloc( Arena *arena, size_t size )
+{
+  // Interned strings are packed in without padding, so the next free
+  // byte may need to be rounded up first.
+  char *mem = arena->next + ( alignSize( (uintptr_t) arena->next ) - (uintptr_t) arena->next );
+
+  if ( arena->block == NULL || size > (size_t) ( arena->end - mem ) ) {
+    // Start a new block.  Anything left in the old one is wasted, but
+    // that's at most one object's worth.
+    size_t blockSize = size > ARENA_BLOCK_SIZE ? alignSize( size ) : ARENA_BLOCK_SIZE;
+    ArenaBlock *block = (ArenaBlock *) malloc( sizeof( ArenaBlock ) + blockSize );
+    block->prev = arena->block;
+    arena->block = block;
+    mem = (char *) ( block + 1 );
+    arena->end = mem + blockSize;
+  }
+
+  arena->next = mem + size;
+  return mem;
+}
+
+char const *internString( Arena *arena, char const *str, int len )
+{
+  int b = findString( arena->strings, arena->stringCap, str, len );
+  if ( arena->strings[ b ] )
+    return arena->strings[ b ];
+
+  // Keep the table at most half full, so probe sequences stay short.
+  if ( ( arena->stringCount + 1 ) * 2 > arena->stringCap ) {
+    int newCap = arena->stringCap * 2;
+    char const **table = (char const **) calloc( newCap, sizeof( char const * ) );
+    for ( int i = 0; i < arena->stringCap; i++ )
+      if ( arena->strings[ i ] ) {
+        char const *old = arena->strings[ i ];
+        table[ findString( table, newCap, old, strlen( old ) ) ] = old;
+      }
+    free( arena->strings );
+    arena->strings = table;
+    arena->stringCap = newCap;
+    b = findString( arena->strings, arena->stringCap, str, len );
+  }
+
+  // Strings don't need to be aligned, so pack them in without calling
+  // arenaAlloc() unless the current block is full.
+  char *copy;
+  if ( len + 1 <= arena->end - arena->next ) {
+    copy = arena->next;
+    arena->next += len + 1;
+  } else {
+    copy = (char *) arenaAlloc( arena, len + 1 );
+  }
+  memcpy( copy, str, len );
+  copy[ len ] = '\0';
+
+  arena->strings[ b ] = copy;
+  arena->stringCount++;
+  return copy;
+}
+
+void freeArena( Arena *arena )
+{
+  while ( arena->block ) {
+    ArenaBlock *prev = arena->block->prev;
+    free( arena->block );
+    arena->block = prev;
+  }
+  free( arena->strings );
+}
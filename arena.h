@@ -0,0 +1,89 @@
+/**
+  @file arena.h
+  @author David Lovato, dalovato
+
+  Bump-pointer allocator for everything a program needs once it's
+  loaded.  Memory comes from a list of large blocks, objects are
+  allocated one after another in each block, and it's all released at
+  once when the arena is freed.  The arena can also intern strings, so
+  identical text is only stored once.
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/** Size of a normal block of arena memory.  Requests bigger than this
+    get a block of their own. */
+#define ARENA_BLOCK_SIZE 65536
+
+/** Alignment for everything allocated from an arena. */
+#define ARENA_ALIGN 16
+
+/** Number of buckets in a new arena's string table.  This needs to be
+    a power of two. */
+#define ARENA_STRING_BUCKETS 64
+
+/** Header for one block of arena memory.  The usable space follows
+    right after it. */
+typedef struct ArenaBlockStruct {
+  /** Block that was allocated before this one. */
+  struct ArenaBlockStruct *prev;
+
+  /** Padding, so the space after the header is aligned. */
+  char pad[ ARENA_ALIGN - sizeof( void * ) ];
+} ArenaBlock;
+
+/** An arena, with the block it's currently allocating from and the
+    strings it has interned. */
+typedef struct {
+  /** Most recently allocated block, the head of the list of blocks. */
+  ArenaBlock *block;
+
+  /** Next free byte in the current block. */
+  char *next;
+
+  /** End of the current block. */
+  char *end;
+
+  /** Hash table of interned strings, with linear probing.  Empty
+      buckets are NULL. */
+  char const **strings;
+
+  /** Number of buckets in the string table, always a power of two. */
+  int stringCap;
+
+  /** Number of strings in the table. */
+  int stringCount;
+} Arena;
+
+/** Initialize an empty arena.
+    @param arena Address of the structure to initialize.
+*/
+void initArena( Arena *arena );
+
+/** Allocate memory from an arena.  It stays valid until the arena is
+    freed.
+    @param arena Arena to allocate from.
+    @param size Number of bytes needed.
+    @return Aligned, uninitialized memory of the given size.
+*/
+void *arenaAlloc( Arena *arena, size_t size );
+
+/** Return a copy of a string that's stored in the arena.  Copies of the
+    same text all share the same storage, so they must not be modified.
+    @param arena Arena to store the string in.
+    @param str String to copy.  It doesn't need to be null terminated.
+    @param len Length of the string.
+    @return The arena's copy of the string, with a null terminator.
+*/
+char const *internString( Arena *arena, char const *str, int len );
+
+/** Free all the memory used by an arena, including everything that was
+    allocated from it.
+    @param arena Arena to free.
+*/
+void freeArena( Arena *arena );
+
+#endif
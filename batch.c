@@ -0,0 +1,385 @@
+/**
+  This file contains batch mode, for running many scripts at once.
+  @file batch.c
+  @author David Lovato, dalovato
+*/
+
+#include "batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "program.h"
+#include "vm.h"
+#include "output.h"
+
+/** Size of a cache line, so each worker's share of the work can sit on
+    its own. */
+#define CACHE_LINE 64
+
+/** Make the range of jobs from lo up to hi, packed in one word so it
+    can be changed with a single compare-and-swap. */
+#define RANGE( lo, hi ) ( (uint64_t) ( lo ) << 32 | (uint32_t) ( hi ) )
+
+/** First job in a range. */
+#define RANGE_LO( r ) ( (int) ( ( r ) >> 32 ) )
+
+/** One past the last job in a range. */
+#define RANGE_HI( r ) ( (int) (uint32_t) ( r ) )
+
+#define LOAD( x ) __atomic_load_n( &( x ), __ATOMIC_SEQ_CST )
+#define STORE( x, v ) __atomic_store_n( &( x ), ( v ), __ATOMIC_SEQ_CST )
+#define CAS( x, old, new ) \
+  __atomic_compare_exchange_n( &( x ), &( old ), ( new ), false, \
+                               __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST )
+
+/** One script from the manifest, and what happened when it ran. */
+typedef struct {
+  /** Name of the script file. */
+  char const *path;
+
+  /** Everything the script printed. */
+  TextBuffer out;
+
+  /** Error text, as it would have gone to standard error. */
+  TextBuffer err;
+
+  /** Exit status the script would have had on its own. */
+  int status;
+
+  /** Milliseconds it took to load and run the script. */
+  double ms;
+
+  /** True once the run is finished, guarded by the batch lock. */
+  bool done;
+} Job;
+
+/** The jobs a worker hasn't started yet.  The worker takes jobs from
+    the bottom of its range, and other workers steal from the top. */
+typedef struct {
+  /** Range of jobs, packed by RANGE(). */
+  uint64_t range;
+
+  /** Keep every worker's range on its own cache line. */
+  char pad[ CACHE_LINE - sizeof( uint64_t ) ];
+} Deque;
+
+/** Everything shared by the workers in a batch. */
+typedef struct {
+  /** Every script in the manifest, in order. */
+  Job *jobs;
+
+  /** Number of jobs. */
+  int count;
+
+  /** Work left for each worker. */
+  Deque *deques;
+
+  /** Number of workers. */
+  int workers;
+
+  /** Lock for the done flags. */
+  pthread_mutex_t lock;
+
+  /** Signaled when a job is done. */
+  pthread_cond_t finished;
+} Batch;
+
+/** What a worker thread needs to know. */
+typedef struct {
+  /** The batch it's working on. */
+  Batch *batch;
+
+  /** Index of the worker's own deque. */
+  int id;
+} Worker;
+
+/**
+  This function will return the time in milliseconds, for timing runs.
+  @return milliseconds since some fixed point
+*/
+static double now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/**
+  This function will add a line of text to a buffer.
+  @param buf the buffer to add to
+  @param str the text, which gets a newline after it
+*/
+static void appendLine( TextBuffer *buf, char const *str )
+{
+  appendText( buf, str, strlen( str ) );
+  appendText( buf, "\n", 1 );
+}
+
+/**
+  This function will load and run one script, capturing everything it
+  would have written.
+  @param job the script to run
+  @param out the worker's output buffer
+*/
+static void runJob( Job *job, Output *out )
+{
+  double start = now();
+  job->status = EXIT_FAILURE;
+
+  ParserContext ctx;
+  if ( !openParser( &ctx, job->path ) ) {
+    appendText( &job->err, "Can't open file: ", strlen( "Can't open file: " ) );
+    appendLine( &job->err, job->path );
+    job->ms = now() - start;
+    return;
+  }
+
+  Program prog;
+  initProgram( &prog );
+  bool loaded = loadProgram( &prog, &ctx ) && linkProgram( &prog, &ctx );
+  closeParser( &ctx );
+  if ( !loaded ) {
+    appendLine( ctx.status == PARSE_DUPLICATE_LABEL ? &job->out : &job->err,
+                ctx.message );
+  } else {
+    Code code;
+    compileOptimized( &prog, &code, true );
+
+    // Every run gets its own variables and output.
+    initOutput( out, appendText, &job->out );
+    VarStore vars;
+    initVars( &vars, &prog.symbols, out );
+    importEnvironment( &vars );
+
+    bool ok = catchThreaded( &code, &vars );
+    flushOutput( out );
+    if ( ok )
+      job->status = EXIT_SUCCESS;
+    else
+      appendLine( &job->err, out->error );
+
+    freeVars( &vars );
+    freeCode( &code );
+  }
+
+  freeProgram( &prog );
+  job->ms = now() - start;
+}
+
+/**
+  This function will take the next job from a worker's own range.
+  @param deque the worker's deque
+  @return index of the job, or -1 if the range is empty
+*/
+static int takeJob( Deque *deque )
+{
+  uint64_t r = LOAD( deque->range );
+  while ( RANGE_LO( r ) < RANGE_HI( r ) ) {
+    if ( CAS( deque->range, r, RANGE( RANGE_LO( r ) + 1, RANGE_HI( r ) ) ) )
+      return RANGE_LO( r );
+  }
+  return -1;
+}
+
+/**
+  This function will steal half the work another worker has left, for a
+  worker that has run out.  The thief runs the first stolen job right
+  away and keeps the rest in its own deque, where others can steal them
+  in turn.
+  @param batch the batch being run
+  @param id index of the worker doing the stealing
+  @return index of a job to run, or -1 if there's nothing left to steal
+*/
+static int stealJob( Batch *batch, int id )
+{
+  for ( int i = 1; i < batch->workers; i++ ) {
+    Deque *victim = &batch->deques[ ( id + i ) % batch->workers ];
+    uint64_t r = LOAD( victim->range );
+    while ( RANGE_LO( r ) < RANGE_HI( r ) ) {
+      int lo = RANGE_LO( r );
+      int hi = RANGE_HI( r );
+      int take = ( hi - lo + 1 ) / 2;
+      if ( CAS( victim->range, r, RANGE( lo, hi - take ) ) ) {
+        // Nobody else changes an empty range, so a plain store is enough.
+        STORE( batch->deques[ id ].range, RANGE( hi - take + 1, hi ) );
+        return hi - take;
+      }
+    }
+  }
+
+  // Every job has been taken.  Some may still be running, but no more
+  // will show up.
+  return -1;
+}
+
+/**
+  This function is a worker thread.  It runs jobs until there's nothing
+  left in its own range or anyone else's.
+  @param arg the Worker
+  @return NULL
+*/
+static void *worker( void *arg )
+{
+  Worker *self = (Worker *) arg;
+  Batch *batch = self->batch;
+
+  Output *out = (Output *) malloc( sizeof( Output ) );
+
+  while ( true ) {
+    int j = takeJob( &batch->deques[ self->id ] );
+    if ( j < 0 )
+      j = stealJob( batch, self->id );
+    if ( j < 0 )
+      break;
+
+    runJob( &batch->jobs[ j ], out );
+
+    pthread_mutex_lock( &batch->lock );
+    batch->jobs[ j ].done = true;
+    pthread_cond_broadcast( &batch->finished );
+    pthread_mutex_unlock( &batch->lock );
+  }
+
+  free( out );
+  return NULL;
+}
+
+/**
+  This function will read a manifest, making a job for each script it
+  lists.
+  @param manifest the name of the manifest file
+  @param text set to the text of the manifest, which the jobs' paths
+  point into.  The caller should free it.
+  @param count set to the number of jobs
+  @return the jobs, or NULL if the manifest couldn't be read
+*/
+static Job *readManifest( char const *manifest, char **text, int *count )
+{
+  FILE *fp = fopen( manifest, "r" );
+  if ( fp == NULL )
+    return NULL;
+
+  size_t cap = INITIAL_CAPACITY;
+  size_t len = 0;
+  *text = (char *) malloc( cap );
+  size_t n;
+  while ( ( n = fread( *text + len, 1, cap - len - 1, fp ) ) > 0 ) {
+    len += n;
+    if ( len + 1 == cap ) {
+      cap *= GROWTH_RATE;
+      *text = (char *) realloc( *text, cap );
+    }
+  }
+  fclose( fp );
+  ( *text )[ len ] = '\0';
+
+  int jobCap = INITIAL_CAPACITY;
+  Job *jobs = (Job *) malloc( jobCap * sizeof( Job ) );
+  *count = 0;
+  for ( char *line = *text; *line; ) {
+    char *end = strchr( line, '\n' );
+    char *next = end ? end + 1 : line + strlen( line );
+
+    // Trim the line, including a carriage return from a DOS file.
+    while ( *line == ' ' || *line == '\t' )
+      line++;
+    if ( end == NULL )
+      end = next;
+    while ( end > line && ( end[ -1 ] == ' ' || end[ -1 ] == '\t' || end[ -1 ] == '\r' ) )
+      end--;
+    *end = '\0';
+
+    if ( *line && *line != '#' ) {
+      if ( *count >= jobCap ) {
+        jobCap *= GROWTH_RATE;
+        jobs = (Job *) realloc( jobs, jobCap * sizeof( Job ) );
+      }
+      Job *job = &jobs[ ( *count )++ ];
+      memset( job, 0, sizeof( Job ) );
+      job->path = line;
+    }
+    line = next;
+  }
+
+  return jobs;
+}
+
+int runBatch( char const *manifest, int workers )
+{
+  Batch batch;
+  char *text;
+  batch.jobs = readManifest( manifest, &text, &batch.count );
+  if ( batch.jobs == NULL ) {
+    fprintf( stderr, "Can't open file: %s\n", manifest );
+    return EXIT_FAILURE;
+  }
+
+  double start = now();
+
+  // Give each worker an even share of the list to start with.  There's
+  // no point in more workers than scripts.
+  batch.workers = workers < batch.count ? workers : batch.count;
+  if ( batch.workers < 1 )
+    batch.workers = 1;
+  batch.deques = (Deque *) calloc( batch.workers, sizeof( Deque ) );
+  for ( int i = 0; i < batch.workers; i++ )
+    batch.deques[ i ].range = RANGE( (int64_t) batch.count * i / batch.workers,
+                                     (int64_t) batch.count * ( i + 1 ) / batch.workers );
+  pthread_mutex_init( &batch.lock, NULL );
+  pthread_cond_init( &batch.finished, NULL );
+
+  Worker *self = (Worker *) malloc( batch.workers * sizeof( Worker ) );
+  pthread_t *threads = (pthread_t *) malloc( batch.workers * sizeof( pthread_t ) );
+  bool *started = (bool *) calloc( batch.workers, sizeof( bool ) );
+  int running = 0;
+  for ( int i = 0; i < batch.workers; i++ ) {
+    self[ i ].batch = &batch;
+    self[ i ].id = i;
+    started[ i ] = pthread_create( &threads[ i ], NULL, worker, &self[ i ] ) == 0;
+    running += started[ i ];
+  }
+  // A worker that didn't start just has its share stolen by the
+  // others.  If none of them started, do all the work here.
+  if ( running == 0 )
+    worker( &self[ 0 ] );
+
+  // Write each result as soon as it and everything before it is done.
+  int failed = 0;
+  for ( int i = 0; i < batch.count; i++ ) {
+    Job *job = &batch.jobs[ i ];
+    pthread_mutex_lock( &batch.lock );
+    while ( !job->done )
+      pthread_cond_wait( &batch.finished, &batch.lock );
+    pthread_mutex_unlock( &batch.lock );
+
+    printf( "== %s: status %d, %.3f ms, %zu bytes out, %zu bytes err\n",
+            job->path, job->status, job->ms, job->out.len, job->err.len );
+    fwrite( job->out.text, 1, job->out.len, stdout );
+    fwrite( job->err.text, 1, job->err.len, stdout );
+    failed += job->status != EXIT_SUCCESS;
+
+    free( job->out.text );
+    free( job->err.text );
+  }
+
+  for ( int i = 0; i < batch.workers; i++ )
+    if ( started[ i ] )
+      pthread_join( threads[ i ], NULL );
+
+  printf( "== %d scripts, %d failed, %.3f ms\n", batch.count, failed, now() - start );
+
+  pthread_cond_destroy( &batch.finished );
+  pthread_mutex_destroy( &batch.lock );
+  free( started );
+  free( threads );
+  free( self );
+  free( batch.deques );
+  free( batch.jobs );
+  free( text );
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,33 @@
+/**
+  @file batch.h
+  @author David Lovato, dalovato
+
+  Batch mode, for running a long list of scripts in one process.  The
+  scripts are listed in a manifest file, one path per line, and run on
+  a fixed pool of worker threads.  Each worker starts with its own
+  share of the list, and takes work from the others once it runs out.
+
+  Every run gets its own variables, and its output and error text are
+  captured instead of going to standard output.  Results are written in
+  the order the manifest lists the scripts, each one starting with a
+  header line:
+
+      == <path>: status <status>, <time> ms, <n> bytes out, <m> bytes err
+
+  followed by exactly n bytes the script printed, then m bytes of error
+  text.  The last line is a summary of the whole batch.
+*/
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+/** Run every script listed in a manifest, writing the results to
+    standard output.
+    @param manifest Name of the file listing the scripts.  Blank lines
+    and lines starting with # are skipped.
+    @param workers Number of worker threads.
+    @return EXIT_SUCCESS if every script ran without an error.
+*/
+int runBatch( char const *manifest, int workers );
+
+#endif
@@ -0,0 +1,218 @@
+/**
+  This file contains the bytecode representation and its disassembler.
+  @file bytecode.c
+  @author David Lovato, dalovato
+*/
+
+#include "bytecode.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/** Mnemonic for each opcode, for the disassembler. */
+static char const *opNames[ OP_COUNT ] = {
+  "print", "set", "add", "sub", "mult", "div", "mod", "eq", "less",
+  "goto", "if", "spawn", "join", "go", "yield", "atomic_add", "atomic_max", "cas",
+  "inc", "less.if", "eq.if"
+};
+
+void initCode( Code *code )
+{
+  code->count = 0;
+  code->cap = INITIAL_CAPACITY;
+  code->instr = (Instr *) malloc( code->cap * sizeof( Instr ) );
+  code->lines = (int *) malloc( code->cap * sizeof( int ) );
+
+  code->litCount = 0;
+  code->litCap = INITIAL_CAPACITY;
+  code->lits = (Value *) malloc( code->litCap * sizeof( Value ) );
+}
+
+int emit( Code *code, int op, int a, int b, int c, int line )
+{
+  // Enlarge the instruction list if needed.
+  if ( code->count >= code->cap ) {
+    code->cap *= GROWTH_RATE;
+    code->instr = (Instr *) realloc( code->instr, code->cap * sizeof( Instr ) );
+    code->lines = (int *) realloc( code->lines, code->cap * sizeof( int ) );
+  }
+
+  Instr *in = &code->instr[ code->count ];
+  in->op = op;
+  in->a = a;
+  in->b = b;
+  in->c = c;
+  code->lines[ code->count ] = line;
+
+  return code->count++;
+}
+
+/**
+  This function will make room for one more literal in the code's pool.
+  @param code the code to add a literal to
+  @return the new, uninitialized literal
+*/
+static Value *newLiteral( Code *code )
+{
+  if ( code->litCount >= code->litCap ) {
+    code->litCap *= GROWTH_RATE;
+    code->lits = (Value *) realloc( code->lits, code->litCap * sizeof( Value ) );
+  }
+
+  return &code->lits[ code->litCount++ ];
+}
+
+int addLiteral( Code *code, char const *str )
+{
+  initText( newLiteral( code ), str );
+  return LITERAL( code->litCount - 1 );
+}
+
+int addConstant( Code *code, ValueType type, int64_t num )
+{
+  Value *val = newLiteral( code );
+  val->type = type;
+  val->num = num;
+  val->str = NULL;
+  val->cap = 0;
+  return LITERAL( code->litCount - 1 );
+}
+
+int *jumpTarget( Instr *in )
+{
+  switch ( in->op ) {
+  case OP_GOTO:
+  case OP_SPAWN:
+  case OP_GO:
+    return &in->a;
+  case OP_IF:
+    return &in->b;
+  default:
+    return NULL;
+  }
+}
+
+void removeInstructions( Code *code, bool const *dead )
+{
+  // New index for each instruction.  A removed instruction maps to the
+  // next one that's kept, so jumps to it land in the right place.
+  int *newIndex = (int *) malloc( ( code->count + 1 ) * sizeof( int ) );
+  int kept = 0;
+  for ( int i = 0; i < code->count; i++ ) {
+    newIndex[ i ] = kept;
+    if ( !dead[ i ] )
+      kept++;
+  }
+  newIndex[ code->count ] = kept;
+
+  // Slide the survivors down, fixing up their branch targets.
+  kept = 0;
+  for ( int i = 0; i < code->count; i++ ) {
+    if ( dead[ i ] )
+      continue;
+
+    code->instr[ kept ] = code->instr[ i ];
+    code->lines[ kept ] = code->lines[ i ];
+
+    int *target = jumpTarget( &code->instr[ kept ] );
+    if ( target )
+      *target = newIndex[ *target ];
+    kept++;
+  }
+
+  code->count = kept;
+  free( newIndex );
+}
+
+/**
+  This function will print one value operand, either a variable name or a
+  quoted literal with its special characters escaped.
+  @param code the code the operand belongs to
+  @param symbols the symbol table, for variable names
+  @param x the operand to print
+  @param fp the stream to print to
+*/
+static void dumpOperand( Code const *code, SymbolTable const *symbols, int x, FILE *fp )
+{
+  if ( !IS_LITERAL( x ) ) {
+    fprintf( fp, "%s", symbols->names[ x ] );
+    return;
+  }
+
+  // Numbers and booleans worked out by the optimizer don't have quotes.
+  Value const *val = &code->lits[ LITERAL_INDEX( x ) ];
+  if ( val->type == VAL_INT ) {
+    fprintf( fp, "%" PRId64, val->num );
+    return;
+  } else if ( val->type == VAL_BOOL ) {
+    fputs( val->num ? "true" : "false", fp );
+    return;
+  }
+
+  fputc( '"', fp );
+  for ( char const *p = val->str; *p; p++ ) {
+    if ( *p == '\n' )
+      fputs( "\\n", fp );
+    else if ( *p == '\t' )
+      fputs( "\\t", fp );
+    else if ( *p == '"' || *p == '\\' )
+      fprintf( fp, "\\%c", *p );
+    else
+      fputc( *p, fp );
+  }
+  fputc( '"', fp );
+}
+
+void dumpCode( Code const *code, SymbolTable const *symbols, FILE *fp )
+{
+  for ( int pc = 0; pc < code->count; pc++ ) {
+    Instr const *in = &code->instr[ pc ];
+    fprintf( fp, "%04d  line %-4d  %-6s ", pc, code->lines[ pc ], opNames[ in->op ] );
+
+    switch ( in->op ) {
+    case OP_PRINT:
+      dumpOperand( code, symbols, in->a, fp );
+      break;
+    case OP_SET:
+      fprintf( fp, "%s ", symbols->names[ in->a ] );
+      dumpOperand( code, symbols, in->b, fp );
+      break;
+    case OP_GOTO:
+    case OP_SPAWN:
+    case OP_GO:
+      fprintf( fp, "-> %04d", in->a );
+      break;
+    case OP_JOIN:
+    case OP_YIELD:
+      break;
+    case OP_IF:
+      dumpOperand( code, symbols, in->a, fp );
+      fprintf( fp, " -> %04d", in->b );
+      break;
+    case OP_INC:
+      fprintf( fp, "%s %d", symbols->names[ in->a ], in->c );
+      break;
+    default:
+      // Everything else is a destination and two values.
+      fprintf( fp, "%s ", symbols->names[ in->a ] );
+      dumpOperand( code, symbols, in->b, fp );
+      fputc( ' ', fp );
+      dumpOperand( code, symbols, in->c, fp );
+      break;
+    }
+
+    fputc( '\n', fp );
+  }
+
+  fprintf( fp, "; %d instructions, %d literals, %d variables\n",
+           code->count, code->litCount, symbols->count );
+}
+
+void freeCode( Code *code )
+{
+  for ( int i = 0; i < code->litCount; i++ )
+    freeValue( &code->lits[ i ] );
+  free( code->lits );
+  free( code->instr );
+  free( code->lines );
+}
@@ -0,0 +1,213 @@
+/**
+  @file bytecode.h
+  @author David Lovato, dalovato
+
+  Flat bytecode representation for a program.  Commands are lowered
+  into one contiguous array of fixed-size instructions, with literal
+  values collected in a pool, so the interpreter can run them in a
+  single dispatch loop.
+*/
+
+#ifndef _BYTECODE_H_
+#define _BYTECODE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "var.h"
+
+/** Operations in the instruction set.  Operand fields are described
+    for each one; a "value" operand is either a variable slot or a
+    literal, encoded with LITERAL(). */
+typedef enum {
+  /** Print value a. */
+  OP_PRINT,
+
+  /** Set variable a to value b. */
+  OP_SET,
+
+  /** Store value b + value c in variable a. */
+  OP_ADD,
+
+  /** Store value b - value c in variable a. */
+  OP_SUB,
+
+  /** Store value b * value c in variable a. */
+  OP_MULT,
+
+  /** Store value b / value c in variable a. */
+  OP_DIV,
+
+  /** Store value b % value c in variable a. */
+  OP_MOD,
+
+  /** Store whether value b == value c in variable a. */
+  OP_EQ,
+
+  /** Store whether value b < value c in variable a. */
+  OP_LESS,
+
+  /** Jump to instruction a. */
+  OP_GOTO,
+
+  /** Jump to instruction b if value a is true. */
+  OP_IF,
+
+  /** Start a task running from instruction a, and go on to the next
+      instruction. */
+  OP_SPAWN,
+
+  /** Wait for the tasks started since the last join, and merge them. */
+  OP_JOIN,
+
+  /** Start a coroutine running from instruction a, and go on to the
+      next instruction. */
+  OP_GO,
+
+  /** Let the other coroutines take a turn before the next instruction. */
+  OP_YIELD,
+
+  /** Add value c to shared counter b, and store the counter's new value
+      in variable a.  Operand b is a slot, but it names a counter, not a
+      variable. */
+  OP_ATOMIC_ADD,
+
+  /** Raise shared counter b to value c if it's lower, and store the
+      counter's new value in variable a. */
+  OP_ATOMIC_MAX,
+
+  /** Set shared counter b to value c if it holds the value in variable
+      a, and store the counter's old value in variable a either way. */
+  OP_CAS,
+
+  /** Add the integer c (not an operand) to variable a.  This is a fused
+      form of add or sub with the same variable as destination and first
+      source, and a literal number for the second. */
+  OP_INC,
+
+  /** Store whether value b < value c in variable a, then branch the
+      way the OP_IF right after it would.  That OP_IF must test
+      variable a, and it stays in place in case anything jumps to it. */
+  OP_LESS_IF,
+
+  /** Store whether value b == value c in variable a, then branch the
+      way the OP_IF right after it would, just like OP_LESS_IF. */
+  OP_EQ_IF,
+
+  /** Number of opcodes, not a real instruction. */
+  OP_COUNT
+} Opcode;
+
+/** Encode index i in the literal pool as an operand.  Variable slots
+    are never negative, so literals are stored as negative numbers. */
+#define LITERAL( i ) ( -1 - ( i ) )
+
+/** True if operand x refers to the literal pool. */
+#define IS_LITERAL( x ) ( ( x ) < 0 )
+
+/** Index in the literal pool for literal operand x. */
+#define LITERAL_INDEX( x ) ( -1 - ( x ) )
+
+/** One instruction, an opcode plus up to three operands. */
+typedef struct {
+  /** Operation to perform, one of the Opcode values. */
+  int op;
+
+  /** First operand. */
+  int a;
+
+  /** Second operand. */
+  int b;
+
+  /** Third operand. */
+  int c;
+} Instr;
+
+/** Compiled form of a whole program. */
+typedef struct {
+  /** Sequence of instructions. */
+  Instr *instr;
+
+  /** Source line for each instruction, for error messages. */
+  int *lines;
+
+  /** Number of instructions. */
+  int count;
+
+  /** Capacity of the instruction and line arrays. */
+  int cap;
+
+  /** Pool of literal values used by the instructions. */
+  Value *lits;
+
+  /** Number of literals in the pool. */
+  int litCount;
+
+  /** Capacity of the literal pool. */
+  int litCap;
+} Code;
+
+/** Initialize an empty block of code.
+    @param code Address of the structure to initialize.
+*/
+void initCode( Code *code );
+
+/** Add an instruction to the end of the code.
+    @param code Code to add the instruction to.
+    @param op Opcode for the instruction.
+    @param a First operand.
+    @param b Second operand.
+    @param c Third operand.
+    @param line Source line the instruction came from.
+    @return Index of the new instruction.
+*/
+int emit( Code *code, int op, int a, int b, int c, int line );
+
+/** Add a literal value to the code's pool.
+    @param code Code that will use the literal.
+    @param str Text of the literal.
+    @return Operand that refers to the literal.
+*/
+int addLiteral( Code *code, char const *str );
+
+/** Add a number or a boolean to the code's pool, for the result of
+    an operation that was worked out ahead of time.  It behaves exactly
+    like a variable that the operation stored its result in.
+    @param code Code that will use the literal.
+    @param type Either VAL_INT or VAL_BOOL.
+    @param num Value of the literal.
+    @return Operand that refers to the literal.
+*/
+int addConstant( Code *code, ValueType type, int64_t num );
+
+/** Return the field of an instruction that holds its branch target.
+    A spawn or go counts as a branch that goes both ways, since the new
+    task or coroutine starts at the target while the code that started
+    it goes on.
+    @param in Instruction to check.
+    @return Address of the target field, or NULL if the instruction
+    doesn't branch.
+*/
+int *jumpTarget( Instr *in );
+
+/** Remove instructions from the code, renumbering branch targets to
+    match.  A branch to a removed instruction goes to the next one that
+    was kept instead.
+    @param code Code to modify.
+    @param dead Array with an entry for each instruction, true for the
+    ones to remove.
+*/
+void removeInstructions( Code *code, bool const *dead );
+
+/** Print a readable listing of the code.
+    @param code Code to print.
+    @param symbols Symbol table, for the names of variables.
+    @param fp Stream to print to.
+*/
+void dumpCode( Code const *code, SymbolTable const *symbols, FILE *fp );
+
+/** Free the memory used by a block of code.
+    @param code Code to free.
+*/
+void freeCode( Code *code );
+
+#endif
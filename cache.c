@@ -0,0 +1,429 @@
+/**
+  This file contains the compiled script cache.
+  @file cache.c
+  @author David Lovato, dalovato
+*/
+
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Magic number at the start of every cache file. */
+#define CACHE_MAGIC "NDC\n"
+
+/** Sections of the file start on a multiple of this. */
+#define CACHE_ALIGN 8
+
+/** Start of a cache file.  Everything is in the machine's own byte
+    order, since a cache is only ever read where it was written. */
+typedef struct {
+  /** Always CACHE_MAGIC. */
+  char magic[ 4 ];
+
+  /** Always CACHE_VERSION. */
+  uint32_t version;
+
+  /** Hash of the script the code came from. */
+  uint64_t hash;
+
+  /** Size of an instruction, in case the build changed it. */
+  int32_t instrSize;
+
+  /** Number of opcodes, in case the build changed them. */
+  int32_t opCount;
+
+  /** 1 if the code was optimized, 0 if it was saved with --no-optimize. */
+  int32_t optimized;
+
+  /** Number of instructions. */
+  int32_t count;
+
+  /** Number of literals. */
+  int32_t litCount;
+
+  /** Number of variables. */
+  int32_t symbolCount;
+
+  /** Bytes of text, for string literals and variable names. */
+  uint32_t textSize;
+} CacheHeader;
+
+/** One entry in the literal pool. */
+typedef struct {
+  /** Type of the literal, a ValueType. */
+  int32_t type;
+
+  /** Where the text of a VAL_STR starts, in the text section. */
+  uint32_t text;
+
+  /** Value of a VAL_INT or VAL_BOOL. */
+  int64_t num;
+} CacheLiteral;
+
+/** Where each section of a cache file starts, worked out from the
+    counts in the header.  After the header, the file has the
+    instructions, the line for each instruction, the literals, the
+    offset of each variable name, then all the text. */
+typedef struct {
+  size_t instr, lines, lits, names, text, end;
+} CacheLayout;
+
+/**
+  This function will round a file offset up to the section alignment.
+  @param off the offset to round
+  @return the rounded offset
+*/
+static size_t alignOffset( size_t off )
+{
+  return ( off + CACHE_ALIGN - 1 ) & ~( (size_t) CACHE_ALIGN - 1 );
+}
+
+/**
+  This function will work out where each section goes for the counts in
+  a header.
+  @param head the header for the file
+  @param layout the layout to fill in
+*/
+static void findLayout( CacheHeader const *head, CacheLayout *layout )
+{
+  layout->instr = alignOffset( sizeof( CacheHeader ) );
+  layout->lines = alignOffset( layout->instr + (size_t) head->count * sizeof( Instr ) );
+  layout->lits = alignOffset( layout->lines + (size_t) head->count * sizeof( int ) );
+  layout->names = alignOffset( layout->lits + (size_t) head->litCount * sizeof( CacheLiteral ) );
+  layout->text = alignOffset( layout->names + (size_t) head->symbolCount * sizeof( uint32_t ) );
+  layout->end = layout->text + head->textSize;
+}
+
+uint64_t hashSource( char const *buf, size_t size )
+{
+  // 64-bit FNV-1a.
+  uint64_t h = 14695981039346656037ull;
+  for ( size_t i = 0; i < size; i++ ) {
+    h ^= (unsigned char) buf[ i ];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+/**
+  This function will write zeros to pad a file out to the next section.
+  @param fp the file to write to
+  @param off the current offset in the file, updated on return
+*/
+static void padSection( FILE *fp, size_t *off )
+{
+  static char const zeros[ CACHE_ALIGN ] = { 0 };
+  size_t next = alignOffset( *off );
+  fwrite( zeros, 1, next - *off, fp );
+  *off = next;
+}
+
+bool writeCache( char const *path, uint64_t hash, bool optimized, Code const *code,
+                 SymbolTable const *symbols )
+{
+  // Work out where every string goes in the text section.
+  uint32_t *litText = (uint32_t *) malloc( ( code->litCount + 1 ) * sizeof( uint32_t ) );
+  uint32_t *nameText = (uint32_t *) malloc( ( symbols->count + 1 ) * sizeof( uint32_t ) );
+  size_t textSize = 0;
+  for ( int i = 0; i < code->litCount; i++ ) {
+    litText[ i ] = textSize;
+    if ( code->lits[ i ].type == VAL_STR )
+      textSize += strlen( code->lits[ i ].str ) + 1;
+  }
+  for ( int i = 0; i < symbols->count; i++ ) {
+    nameText[ i ] = textSize;
+    textSize += strlen( symbols->names[ i ] ) + 1;
+  }
+
+  CacheHeader head;
+  memset( &head, 0, sizeof( head ) );
+  memcpy( head.magic, CACHE_MAGIC, sizeof( head.magic ) );
+  head.version = CACHE_VERSION;
+  head.hash = hash;
+  head.instrSize = sizeof( Instr );
+  head.opCount = OP_COUNT;
+  head.optimized = optimized;
+  head.count = code->count;
+  head.litCount = code->litCount;
+  head.symbolCount = symbols->count;
+  head.textSize = textSize;
+
+  // Write to a temporary file next to the real one, so we can rename it
+  // into place when it's done.  The process ID keeps two runs from
+  // writing the same temporary file.
+  char *temp = (char *) malloc( strlen( path ) + NUMBER_LEN + 2 );
+  sprintf( temp, "%s.%ld", path, (long) getpid() );
+  int fd = open( temp, O_WRONLY | O_CREAT | O_EXCL, 0666 );
+  FILE *fp = fd < 0 ? NULL : fdopen( fd, "wb" );
+  if ( fp == NULL ) {
+    if ( fd >= 0 ) {
+      close( fd );
+      unlink( temp );
+    }
+    free( temp );
+    free( nameText );
+    free( litText );
+    return false;
+  }
+
+  size_t off = 0;
+  fwrite( &head, sizeof( head ), 1, fp );
+  off += sizeof( head );
+  padSection( fp, &off );
+
+  fwrite( code->instr, sizeof( Instr ), code->count, fp );
+  off += code->count * sizeof( Instr );
+  padSection( fp, &off );
+
+  fwrite( code->lines, sizeof( int ), code->count, fp );
+  off += code->count * sizeof( int );
+  padSection( fp, &off );
+
+  for ( int i = 0; i < code->litCount; i++ ) {
+    CacheLiteral lit = { code->lits[ i ].type, litText[ i ], code->lits[ i ].num };
+    fwrite( &lit, sizeof( lit ), 1, fp );
+  }
+  off += code->litCount * sizeof( CacheLiteral );
+  padSection( fp, &off );
+
+  fwrite( nameText, sizeof( uint32_t ), symbols->count, fp );
+  off += symbols->count * sizeof( uint32_t );
+  padSection( fp, &off );
+
+  for ( int i = 0; i < code->litCount; i++ )
+    if ( code->lits[ i ].type == VAL_STR )
+      fwrite( code->lits[ i ].str, 1, strlen( code->lits[ i ].str ) + 1, fp );
+  for ( int i = 0; i < symbols->count; i++ )
+    fwrite( symbols->names[ i ], 1, strlen( symbols->names[ i ] ) + 1, fp );
+
+  bool ok = !ferror( fp );
+  ok = fclose( fp ) == 0 && ok;
+  ok = ok && rename( temp, path ) == 0;
+  if ( !ok )
+    unlink( temp );
+
+  free( temp );
+  free( nameText );
+  free( litText );
+  return ok;
+}
+
+/**
+  This function will check a value operand from a cache file.
+  @param x the operand to check
+  @param head the header for the file
+  @return true if x is a variable or literal that exists
+*/
+static bool validValue( int x, CacheHeader const *head )
+{
+  if ( IS_LITERAL( x ) )
+    return LITERAL_INDEX( x ) < head->litCount;
+  return x < head->symbolCount;
+}
+
+/**
+  This function will check a variable operand from a cache file.
+  @param x the operand to check
+  @param head the header for the file
+  @return true if x is a variable that exists
+*/
+static bool validVar( int x, CacheHeader const *head )
+{
+  return x >= 0 && x < head->symbolCount;
+}
+
+/**
+  This function will check that every instruction in a cache file only
+  refers to variables, literals and instructions that exist, so a
+  damaged file can't make the interpreter read outside its arrays.
+  @param instr the instructions to check
+  @param head the header for the file
+  @return true if the instructions are all valid
+*/
+static bool validCode( Instr const *instr, CacheHeader const *head )
+{
+  for ( int pc = 0; pc < head->count; pc++ ) {
+    Instr const *in = &instr[ pc ];
+    switch ( in->op ) {
+    case OP_PRINT:
+      if ( !validValue( in->a, head ) )
+        return false;
+      break;
+    case OP_SET:
+      if ( !validVar( in->a, head ) || !validValue( in->b, head ) )
+        return false;
+      break;
+    case OP_GOTO:
+    case OP_SPAWN:
+    case OP_GO:
+      if ( in->a < 0 || in->a > head->count )
+        return false;
+      break;
+    case OP_JOIN:
+    case OP_YIELD:
+      break;
+    case OP_ATOMIC_ADD:
+    case OP_ATOMIC_MAX:
+    case OP_CAS:
+      if ( !validVar( in->a, head ) || !validVar( in->b, head ) || !validValue( in->c, head ) )
+        return false;
+      break;
+    case OP_IF:
+      if ( !validValue( in->a, head ) || in->b < 0 || in->b > head->count )
+        return false;
+      break;
+    case OP_INC:
+      if ( !validVar( in->a, head ) )
+        return false;
+      break;
+    case OP_LESS_IF:
+    case OP_EQ_IF:
+      // These run the if after them, so there has to be one.
+      if ( pc + 1 >= head->count || instr[ pc + 1 ].op != OP_IF )
+        return false;
+      // Fall through.
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MULT:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_EQ:
+    case OP_LESS:
+      if ( !validVar( in->a, head ) || !validValue( in->b, head ) ||
+           !validValue( in->c, head ) )
+        return false;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+  This function will check the header and the tables in a mapped cache
+  file, before anything is loaded from it.
+  @param map the start of the file
+  @param size the size of the file
+  @param hash the hash of the script we want code for
+  @param optimized whether we want optimized code
+  @return true if the file can be loaded
+*/
+static bool validCache( char const *map, size_t size, uint64_t hash, bool optimized )
+{
+  CacheHeader const *head = (CacheHeader const *) map;
+  if ( size < sizeof( CacheHeader ) ||
+       memcmp( head->magic, CACHE_MAGIC, sizeof( head->magic ) ) != 0 ||
+       head->version != CACHE_VERSION || head->hash != hash ||
+       head->optimized != optimized ||
+       head->instrSize != sizeof( Instr ) || head->opCount != OP_COUNT ||
+       head->count < 0 || head->litCount < 0 || head->symbolCount < 0 )
+    return false;
+
+  CacheLayout layout;
+  findLayout( head, &layout );
+  if ( layout.end != size )
+    return false;
+
+  // Every string has to start inside the text and end with a null.
+  char const *text = map + layout.text;
+  if ( head->textSize > 0 && text[ head->textSize - 1 ] != '\0' )
+    return false;
+
+  CacheLiteral const *lits = (CacheLiteral const *) ( map + layout.lits );
+  for ( int i = 0; i < head->litCount; i++ ) {
+    if ( lits[ i ].type == VAL_STR ) {
+      if ( lits[ i ].text >= head->textSize )
+        return false;
+    } else if ( lits[ i ].type != VAL_INT && lits[ i ].type != VAL_BOOL )
+      return false;
+  }
+
+  uint32_t const *names = (uint32_t const *) ( map + layout.names );
+  for ( int i = 0; i < head->symbolCount; i++ )
+    if ( names[ i ] >= head->textSize )
+      return false;
+
+  return validCode( (Instr const *) ( map + layout.instr ), head );
+}
+
+bool openCache( CacheFile *cache, char const *path, uint64_t hash, bool optimized,
+                Code *code, SymbolTable *symbols )
+{
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return false;
+
+  struct stat st;
+  if ( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) ||
+       st.st_size < sizeof( CacheHeader ) ) {
+    close( fd );
+    return false;
+  }
+
+  void *map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if ( map == MAP_FAILED )
+    return false;
+
+  if ( !validCache( (char const *) map, st.st_size, hash, optimized ) ) {
+    munmap( map, st.st_size );
+    return false;
+  }
+
+  cache->map = map;
+  cache->size = st.st_size;
+
+  CacheHeader const *head = (CacheHeader const *) map;
+  CacheLayout layout;
+  findLayout( head, &layout );
+  char const *text = (char const *) map + layout.text;
+
+  // The instructions and lines get copied, so the code can be freed
+  // like any other.  They're the only part that's proportional to the
+  // size of the program.
+  initCode( code );
+  if ( head->count > code->cap ) {
+    code->cap = head->count;
+    code->instr = (Instr *) realloc( code->instr, code->cap * sizeof( Instr ) );
+    code->lines = (int *) realloc( code->lines, code->cap * sizeof( int ) );
+  }
+  memcpy( code->instr, (char const *) map + layout.instr, head->count * sizeof( Instr ) );
+  memcpy( code->lines, (char const *) map + layout.lines, head->count * sizeof( int ) );
+  code->count = head->count;
+
+  // String literals stay in the mapping, like literals that point into
+  // the program's arena.
+  CacheLiteral const *lits = (CacheLiteral const *) ( (char const *) map + layout.lits );
+  for ( int i = 0; i < head->litCount; i++ ) {
+    int x = addConstant( code, lits[ i ].type, lits[ i ].num );
+    if ( lits[ i ].type == VAL_STR )
+      initConst( &code->lits[ LITERAL_INDEX( x ) ], text + lits[ i ].text );
+  }
+
+  uint32_t const *names = (uint32_t const *) ( (char const *) map + layout.names );
+  for ( int i = 0; i < head->symbolCount; i++ )
+    internSymbol( symbols, text + names[ i ], strlen( text + names[ i ] ) );
+
+  // A repeated name would leave fewer slots than the code uses.
+  if ( symbols->count != head->symbolCount ) {
+    freeCode( code );
+    freeSymbols( symbols );
+    initSymbols( symbols );
+    closeCache( cache );
+    return false;
+  }
+
+  return true;
+}
+
+void closeCache( CacheFile *cache )
+{
+  munmap( cache->map, cache->size );
+}
@@ -0,0 +1,81 @@
+/**
+  @file cache.h
+  @author David Lovato, dalovato
+
+  Compiled script cache.  A program's bytecode, literal pool, variable
+  names and source line table can be saved in a binary file, then mapped
+  back into memory on a later run so the script doesn't have to be
+  parsed or compiled again.  Labels are already resolved to instruction
+  indices in the bytecode, so the file doesn't need a label table.
+*/
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "bytecode.h"
+#include "var.h"
+
+/** Added to the name of a script to get the name of its cache file. */
+#define CACHE_SUFFIX ".ndc"
+
+/** Version of the file format, changed whenever the layout or the
+    meaning of the bytecode changes. */
+#define CACHE_VERSION 2
+
+/** A cache file mapped into memory.  String literals in the loaded
+    code point into the mapping, so it has to stay open until the code
+    is freed. */
+typedef struct {
+  /** Start of the mapping. */
+  void *map;
+
+  /** Size of the mapping. */
+  size_t size;
+} CacheFile;
+
+/** Compute the hash of a script's source, to tell if a cache file was
+    made from the same text.
+    @param buf Text of the script.
+    @param size Number of bytes in the text.
+    @return Hash of the text.
+*/
+uint64_t hashSource( char const *buf, size_t size );
+
+/** Save compiled code in a cache file.  The file is written under a
+    temporary name and renamed into place, so another run never sees a
+    partial file.
+    @param path Name of the cache file.
+    @param hash Hash of the script the code came from.
+    @param optimized True if the code has been through the optimizer.
+    @param code Code to save.
+    @param symbols Symbol table for the code.
+    @return False if the file couldn't be written.
+*/
+bool writeCache( char const *path, uint64_t hash, bool optimized, Code const *code,
+                 SymbolTable const *symbols );
+
+/** Map a cache file and load the code in it.  Nothing is loaded if the
+    file is missing, was made from a different script or by a different
+    version of nonde, was optimized differently from what we want, or
+    doesn't hold valid code.
+    @param cache Cache file structure to fill in.
+    @param path Name of the cache file.
+    @param hash Hash of the script we want code for.
+    @param optimized True if we want optimized code, false for code
+    saved with --no-optimize.
+    @param code Code structure to fill in.
+    @param symbols Empty symbol table to fill in.
+    @return True if the code was loaded.
+*/
+bool openCache( CacheFile *cache, char const *path, uint64_t hash, bool optimized,
+                Code *code, SymbolTable *symbols );
+
+/** Unmap a cache file, after the code loaded from it has been freed.
+    @param cache Cache file to close.
+*/
+void closeCache( CacheFile *cache );
+
+#endif
@@ -0,0 +1,107 @@
+/**
+  This file contains the control-flow graph for bytecode.
+  @file cfg.c
+  @author David Lovato, dalovato
+*/
+
+#include "cfg.h"
+#include <stdlib.h>
+
+/**
+  This function will add a successor to a block.
+  @param block the block to add it to
+  @param succ index of the successor
+*/
+static void addSuccessor( BasicBlock *block, int succ )
+{
+  // An if that jumps to the very next instruction only needs it once.
+  if ( block->succCount && block->succ[ 0 ] == succ )
+    return;
+  block->succ[ block->succCount++ ] = succ;
+}
+
+void buildCfg( Cfg *cfg, Code const *code )
+{
+  // Find the first instruction of every block: the start, every branch
+  // target, and whatever follows a branch.
+  bool *leader = (bool *) calloc( code->count + 1, sizeof( bool ) );
+  leader[ 0 ] = true;
+  for ( int i = 0; i < code->count; i++ ) {
+    int *t = jumpTarget( &code->instr[ i ] );
+    if ( t ) {
+      leader[ *t ] = true;
+      leader[ i + 1 ] = true;
+    }
+  }
+
+  // Number the blocks and record which one each instruction is in.
+  cfg->blockOf = (int *) malloc( ( code->count + 1 ) * sizeof( int ) );
+  cfg->count = 0;
+  for ( int i = 0; i < code->count; i++ ) {
+    if ( leader[ i ] )
+      cfg->count++;
+    cfg->blockOf[ i ] = cfg->count - 1;
+  }
+
+  // Running off the end isn't a block, but it's handy for jumps there.
+  cfg->blockOf[ code->count ] = cfg->count;
+
+  cfg->blocks = (BasicBlock *) malloc( ( cfg->count ? cfg->count : 1 ) * sizeof( BasicBlock ) );
+  for ( int i = 0; i < code->count; i++ ) {
+    BasicBlock *block = &cfg->blocks[ cfg->blockOf[ i ] ];
+    if ( leader[ i ] ) {
+      block->start = i;
+      block->succCount = 0;
+    }
+    block->end = i + 1;
+  }
+
+  // Link each block to the ones that can follow it, from the
+  // instruction at its end.
+  for ( int b = 0; b < cfg->count; b++ ) {
+    BasicBlock *block = &cfg->blocks[ b ];
+    Instr *last = &code->instr[ block->end - 1 ];
+    int *t = jumpTarget( last );
+
+    if ( t && cfg->blockOf[ *t ] < cfg->count )
+      addSuccessor( block, cfg->blockOf[ *t ] );
+    if ( last->op != OP_GOTO && block->end < code->count )
+      addSuccessor( block, b + 1 );
+  }
+
+  free( leader );
+}
+
+bool *findReachable( Cfg const *cfg )
+{
+  bool *reached = (bool *) calloc( cfg->count + 1, sizeof( bool ) );
+  if ( cfg->count == 0 )
+    return reached;
+
+  // Depth-first search, with an explicit stack so long chains of blocks
+  // can't overflow the real one.
+  int *stack = (int *) malloc( cfg->count * sizeof( int ) );
+  int top = 0;
+  stack[ top++ ] = 0;
+  reached[ 0 ] = true;
+
+  while ( top > 0 ) {
+    BasicBlock const *block = &cfg->blocks[ stack[ --top ] ];
+    for ( int i = 0; i < block->succCount; i++ ) {
+      int s = block->succ[ i ];
+      if ( !reached[ s ] ) {
+        reached[ s ] = true;
+        stack[ top++ ] = s;
+      }
+    }
+  }
+
+  free( stack );
+  return reached;
+}
+
+void freeCfg( Cfg *cfg )
+{
+  free( cfg->blocks );
+  free( cfg->blockOf );
+}
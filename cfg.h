@@ -0,0 +1,71 @@
+/**
+  @file cfg.h
+  @author David Lovato, dalovato
+
+  Control-flow graph for compiled bytecode.  The code is split into
+  basic blocks, straight runs of instructions that are only entered at
+  the top and only branch at the bottom, linked to the blocks that can
+  run after them.  Optimization passes use it to reason about every
+  path through a program.
+*/
+
+#ifndef _CFG_H_
+#define _CFG_H_
+
+#include <stdbool.h>
+#include "bytecode.h"
+
+/** Most successors a block can have, for an if. */
+#define MAX_SUCCESSORS 2
+
+/** One basic block in the graph. */
+typedef struct {
+  /** Index of the first instruction in the block. */
+  int start;
+
+  /** Index one past the last instruction in the block. */
+  int end;
+
+  /** Blocks that can run right after this one.  A block that runs off
+      the end of the program doesn't list a successor for that. */
+  int succ[ MAX_SUCCESSORS ];
+
+  /** Number of entries in succ. */
+  int succCount;
+} BasicBlock;
+
+/** Control-flow graph for a block of code. */
+typedef struct {
+  /** Basic blocks, in the same order as the code.  The program starts
+      in block zero. */
+  BasicBlock *blocks;
+
+  /** Number of blocks. */
+  int count;
+
+  /** Index of the block holding each instruction. */
+  int *blockOf;
+} Cfg;
+
+/** Build the control-flow graph for some code.  Fused compare and
+    branch instructions are treated like the compare they replaced, so
+    the branch is always the if right after them, and the pair never
+    ends up in different blocks unless something jumps to the if.
+    @param cfg Graph to fill in.
+    @param code Code to analyze.
+*/
+void buildCfg( Cfg *cfg, Code const *code );
+
+/** Find the blocks that can run, following successors from the start.
+    @param cfg Graph to search.
+    @return Array with an entry for each block, true for the reachable
+    ones.  The caller should free it.
+*/
+bool *findReachable( Cfg const *cfg );
+
+/** Free the memory for a control-flow graph.
+    @param cfg Graph to free.
+*/
+void freeCfg( Cfg *cfg );
+
+#endif
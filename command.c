@@ -4,15 +4,117 @@
 #include <string.h>
 #include "label.h"
 #include "parse.h"
+#include "output.h"
+#include "task.h"
+#include "coroutine.h"
+#include "shared.h"
 
-/** Copy the given string to a dynamically allocated character array.
-    @param str the string to copy.
-    @return the dynamically allocated copy of the string.
+////////////////////////////////////////////////////////////////////////////////
+//Operands
+
+/** An argument to a command, either a literal value or a variable. */
+typedef struct {
+  /** Slot of the variable this operand names, or -1 for a literal. */
+  int slot;
+
+  /** Value of a literal, without its opening quote.  Unused for variables. */
+  Value lit;
+} Operand;
+
+/**
+  This function will fill in an operand from the token that was parsed for
+  it.  Variable names are interned here, so they never have to be looked
+  up by name while the program runs.
+  @param op the operand to fill in
+  @param tok the token, either a quoted literal or a variable name
+  @param symbols the symbol table for the program
+  @param arena the arena to store literal text in
+*/
+static void makeOperand( Operand *op, Token const *tok, SymbolTable *symbols, Arena *arena )
+{
+  if ( tok->text[ 0 ] == '"' ) {
+    // Identical literals share one copy of their text in the arena.
+    op->slot = -1;
+    initConst( &op->lit, internString( arena, tok->text + 1, tok->len - 1 ) );
+
+    // Convert it to a number now, since tasks running in parallel can
+    // share the command and can't cache it later.
+    int64_t num;
+    toNumber( &op->lit, &num );
+  } else {
+    op->slot = internSymbol( symbols, tok->text, tok->len );
+  }
+}
+
+/**
+  This function will return the value of an operand, reporting a runtime
+  error if it names an undefined variable.
+  @param op the operand to evaluate
+  @param vars the variables for the running program
+  @param line the line of the command, for error messages
+  @return the value of the operand
+*/
+static Value *getValue( Operand *op, VarStore *vars, int line )
+{
+  if ( op->slot < 0 )
+    return &op->lit;
+
+  Value *val = getVar( vars, op->slot );
+  if ( val->type == VAL_UNDEF ) {
+    runtimeError( vars->out, "Undefined variable: %s (line %d)", varName( vars, op->slot ), line );
+  }
+  return val;
+}
+
+/**
+  This function will return the numeric value of an operand, reporting a
+  runtime error if it isn't a valid number.  Literals and strings remember
+  their converted value, so they're only parsed the first time.
+  @param op the operand to evaluate
+  @param vars the variables for the running program
+  @param line the line of the command, for error messages
+  @return the value of the operand as a number
+*/
+static int64_t getNumber( Operand *op, VarStore *vars, int line )
+{
+  int64_t value = 0;
+  if ( !toNumber( getValue( op, vars, line ), &value ) ) {
+    runtimeError( vars->out, "Invalid number (line %d)", line );
+  }
+  return value;
+}
+
+/**
+  This function will return the bytecode operand for an operand, adding
+  literals to the code's pool.
+  @param op the operand to compile
+  @param code the code the operand will be used in
+  @return the operand encoded for an instruction
+*/
+static int compileOperand( Operand *op, Code *code )
+{
+  if ( op->slot < 0 )
+    return addLiteral( code, op->lit.str );
+  return op->slot;
+}
+
+/**
+  This function will find the command a label refers to, recording an
+  error if there's no such label.
+  @param labelMap the labels in the program
+  @param name the label to look up
+  @param line the line of the command using the label, for error messages
+  @param target filled in with the index of the command for the label
+  @param ctx the context to report an error in
+  @return false if the label isn't defined
 */
-static char *copyString( char const *str )
+static bool resolveLabel( LabelMap *labelMap, char const *name, int line, int *target,
+                          ParserContext *ctx )
 {
-  char *cpy = (char *) malloc( strlen( str ) + 1 );
-  return strcpy( cpy, str );
+  *target = findLabel( labelMap, name, strlen( name ) );
+  if ( *target == -1 )
+    return parseError( ctx, PARSE_UNDEFINED_LABEL, "Undefined label: %s (line %d)", name, line );
+  return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -20,75 +122,74 @@ static char *copyString( char const *str )
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
+
   /** condition to check for if statement */
-  char *condition;
+  Operand condition;
 
   /**place to jump to in code */
-  char *go_to;
+  char const *go_to;
 
-} IfCommand;
+  /** index of the command for go_to, filled in when the program is linked */
+  int target;
 
-/**
-  This function will destroy the IfCommand Struct.
-  @param IfCommand cmd
-*/
-static void destroyIf(Command *cmd)
-{
-  IfCommand *this = (IfCommand *)cmd;
-  free(this->condition);
-  free(this->go_to);
-  free(this);
-}
+} IfCommand;
 
 // Execute function for the If command
-static int executeIf( Command *cmd, LabelMap *labelMap, int pc )
+static int executeIf( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   IfCommand *this = (IfCommand *)cmd;
 
-  char *val = getenv(this->condition);
-
-  if (val == NULL) {
-    fprintf(stderr, "Undefined variable: %s (line %d)\n", this->condition, this->line);
-    exit(1);
-  }
-
-  if (strcmp("", val) != 0) {
-    int command_to_jump_to = findLabel(labelMap, this->go_to);
-    if (command_to_jump_to == -1) {
-      fprintf(stderr, "Undefined label: %s (line %d)\n", this->go_to, this->line);
-      exit(1);
-    }
-    return command_to_jump_to;
+  if (isTrue(getValue(&this->condition, vars, this->line))) {
+    return this->target;
   } else {
     return pc + 1;
   }
 }
 
+// Link function for the If command
+static bool linkIf( Command *cmd, LabelMap *labelMap, ParserContext *ctx )
+{
+  IfCommand *this = (IfCommand *)cmd;
+  return resolveLabel(labelMap, this->go_to, this->line, &this->target, ctx);
+}
+
+// Compile function for the If command
+static void compileIf( Command *cmd, Code *code )
+{
+  IfCommand *this = (IfCommand *)cmd;
+  emit(code, OP_IF, compileOperand(&this->condition, code), this->target, 0, this->line);
+}
+
 /** Make a command that runs the if statement.
-    @param condition, check before entering if
-    @param go_to, place to jump to in code
+    @param args, tokens for the condition to check and the label to jump to
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements go to.
  */
-static Command *makeIf(char const *condition, char const *go_to)
+static Command *makeIf(Token const *args, SymbolTable *symbols, Arena *arena,
+                       ParserContext *ctx)
 {
   // Allocate space for the IfCommand object
-  IfCommand *this = (IfCommand *) malloc(sizeof(IfCommand));
+  IfCommand *this = (IfCommand *) arenaAlloc(arena, sizeof(IfCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeIf;
-  this->line = getLineNumber();
-  this->destroy = destroyIf;
+  this->line = getLineNumber(ctx);
+  this->link = linkIf;
+  this->compile = compileIf;
 
   // Make a copy of the arguments.
-  this->condition = copyString(condition);
-  this->go_to = copyString(go_to);
+  makeOperand(&this->condition, &args[0], symbols, arena);
+  this->go_to = internString(arena, args[1].text, args[1].len);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -99,60 +200,66 @@ static Command *makeIf(char const *condition, char const *go_to)
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
+
   /** Name of label to go to */
-  char *label;
+  char const *label;
+
+  /** index of the command for label, filled in when the program is linked */
+  int target;
 
 } GoToCommand;
 
-/**
-  This function will destroy the GoToCommand Struct.
-  @param GoToCommand cmd
-*/
-static void destroyGoTo(Command *cmd)
+// Execute function for the GoTo command
+static int executeGoTo( Command *cmd, VarStore *vars, int pc )
 {
+  // Cast the this pointer to the struct type it really points to.
   GoToCommand *this = (GoToCommand *)cmd;
-  free(this->label);
-  free(this);
+
+  return this->target;
 }
 
-// Execute function for the GoTo command
-static int executeGoTo( Command *cmd, LabelMap *labelMap, int pc )
+// Link function for the GoTo command
+static bool linkGoTo( Command *cmd, LabelMap *labelMap, ParserContext *ctx )
 {
-  // Cast the this pointer to the struct type it really points to.
   GoToCommand *this = (GoToCommand *)cmd;
+  return resolveLabel(labelMap, this->label, this->line, &this->target, ctx);
+}
 
-  int command_to_jump_to = findLabel(labelMap, this->label);
-  
-  if (command_to_jump_to == -1) {
-    fprintf(stderr, "Undefined label: %s (line %d)\n", this->label, this->line);
-    exit(1);
-  }
-
-  return command_to_jump_to;
+// Compile function for the GoTo command
+static void compileGoTo( Command *cmd, Code *code )
+{
+  GoToCommand *this = (GoToCommand *)cmd;
+  emit(code, OP_GOTO, this->target, 0, 0, this->line);
 }
 
 /** Makes the goto command.
-    @param label, the place to jump to.
+    @param args, token for the place to jump to
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements go to.
  */
-static Command *makeGoTo(char const *label)
+static Command *makeGoTo(Token const *args, SymbolTable *symbols, Arena *arena,
+                         ParserContext *ctx)
 {
   // Allocate space for the GoToCommand object
-  GoToCommand *this = (GoToCommand *) malloc(sizeof(GoToCommand));
+  GoToCommand *this = (GoToCommand *) arenaAlloc(arena, sizeof(GoToCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeGoTo;
-  this->line = getLineNumber();
-  this->destroy = destroyGoTo;
+  this->line = getLineNumber(ctx);
+  this->link = linkGoTo;
+  this->compile = compileGoTo;
 
   // Make a copy of the arguments.
-  this->label = copyString(label);
+  this->label = internString(arena, args[0].text, args[0].len);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -163,114 +270,71 @@ static Command *makeGoTo(char const *label)
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
-  /** Name of variable the sum will be stored in */
-  char *var;
-  
+
+  /** Slot of variable the result will be stored in */
+  int var;
+
   /** Value of 1st arg */
-  char *val_1;
-  
+  Operand val_1;
+
   /** Value of 2nd arg */
-  char *val_2;
-  
-} LessCommand;
+  Operand val_2;
 
-/**
-  This function will destroy the LessCommand Struct.
-  @param LessCommand cmd
-*/
-static void destroyLess(Command *cmd)
-{
-  LessCommand *this = (LessCommand *)cmd;
-  free(this->var);
-  free(this->val_1);
-  free(this->val_2);
-  free(this);
-}
+} LessCommand;
 
 // Execute function for the less than command
-static int executeLess( Command *cmd, LabelMap *labelMap, int pc )
+static int executeLess( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   LessCommand *this = (LessCommand *)cmd;
 
-  int value = 0;
-  long value_1 = 0;
-  long value_2 = 0;
-  
-  long less = 0;
-  
-  if (this->val_1[0] == '"') {
-    if (sscanf((this->val_1 + 1), "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_1 = getenv(this->val_1);
-    if (str_1 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_1, this->line);
-      exit(1);
-    }
-    if (sscanf(str_1, "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  if (this->val_2[0] == '"') {
-    if (sscanf((this->val_2 + 1), "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_2 = getenv(this->val_2);
-    if (str_2 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_2, this->line);
-      exit(1);
-    }
-    if (sscanf(str_2, "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  char less_str[MAX_TOKEN + 1] = "";
-  
-  if (value_1 < value_2) {
-    less = 1;
-    sprintf(less_str, "%ld", less);
-  }
-  
-  value = setenv(this->var, less_str, 1);
+  int64_t value_1 = getNumber(&this->val_1, vars, this->line);
+  int64_t value_2 = getNumber(&this->val_2, vars, this->line);
+
+  setBool(vars, this->var, value_1 < value_2);
 
   return pc + 1;
 }
 
+// Compile function for the less than command
+static void compileLess( Command *cmd, Code *code )
+{
+  LessCommand *this = (LessCommand *)cmd;
+  emit(code, OP_LESS, this->var, compileOperand(&this->val_1, code),
+       compileOperand(&this->val_2, code), this->line);
+}
+
 /** Make a command that sees if the first value is less than the second one.
-    @param var, the variable to store the result in
-    @param val_1, the first value to compare
-    @param val_2, the second value
+    @param args, tokens for the variable to store the result in, then the
+    first and second values
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements less than.
  */
-static Command *makeLess(char const *var, char const *val_1, char const *val_2)
+static Command *makeLess(Token const *args, SymbolTable *symbols, Arena *arena,
+                         ParserContext *ctx)
 {
   // Allocate space for the LessCommand object
-  LessCommand *this = (LessCommand *) malloc(sizeof(LessCommand));
+  LessCommand *this = (LessCommand *) arenaAlloc(arena, sizeof(LessCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeLess;
-  this->line = getLineNumber();
-  this->destroy = destroyLess;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileLess;
 
   // Make a copy of the arguments.
-  this->var = copyString(var);
-  this->val_1 = copyString(val_1);
-  this->val_2 = copyString(val_2);
+  this->var = internSymbol(symbols, args[0].text, args[0].len);
+  makeOperand(&this->val_1, &args[1], symbols, arena);
+  makeOperand(&this->val_2, &args[2], symbols, arena);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -281,114 +345,71 @@ static Command *makeLess(char const *var, char const *val_1, char const *val_2)
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
-  /** Name of variable the sum will be stored in */
-  char *var;
-  
+
+  /** Slot of variable the result will be stored in */
+  int var;
+
   /** Value of 1st arg */
-  char *val_1;
-  
+  Operand val_1;
+
   /** Value of 2nd arg */
-  char *val_2;
-  
-} EqCommand;
+  Operand val_2;
 
-/**
-  This function will destroy the EqCommand Struct.
-  @param EqCommand cmd
-*/
-static void destroyEq(Command *cmd)
-{
-  EqCommand *this = (EqCommand *)cmd;
-  free(this->var);
-  free(this->val_1);
-  free(this->val_2);
-  free(this);
-}
+} EqCommand;
 
 // Execute function for the equals command
-static int executeEq( Command *cmd, LabelMap *labelMap, int pc )
+static int executeEq( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   EqCommand *this = (EqCommand *)cmd;
 
-  int value = 0;
-  long value_1 = 0;
-  long value_2 = 0;
-  
-  long eq = 0;
-  
-  if (this->val_1[0] == '"') {
-    if (sscanf((this->val_1 + 1), "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_1 = getenv(this->val_1);
-    if (str_1 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_1, this->line);
-      exit(1);
-    }
-    if (sscanf(str_1, "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  if (this->val_2[0] == '"') {
-    if (sscanf((this->val_2 + 1), "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_2 = getenv(this->val_2);
-    if (str_2 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_2, this->line);
-      exit(1);
-    }
-    if (sscanf(str_2, "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  char eq_str[MAX_TOKEN + 1] = "";
-  
-  if (value_1 == value_2) {
-    eq = 1;
-    sprintf(eq_str, "%ld", eq);
-  }
-  
-  value = setenv(this->var, eq_str, 1);
+  int64_t value_1 = getNumber(&this->val_1, vars, this->line);
+  int64_t value_2 = getNumber(&this->val_2, vars, this->line);
+
+  setBool(vars, this->var, value_1 == value_2);
 
   return pc + 1;
 }
 
+// Compile function for the equals command
+static void compileEq( Command *cmd, Code *code )
+{
+  EqCommand *this = (EqCommand *)cmd;
+  emit(code, OP_EQ, this->var, compileOperand(&this->val_1, code),
+       compileOperand(&this->val_2, code), this->line);
+}
+
 /** Make a command that implements the equals command.
-    @param var, the variable to store the result in.
-    @param val_1, the first value
-    @param val_2, the second value
+    @param args, tokens for the variable to store the result in, then the
+    first and second values
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements equals.
  */
-static Command *makeEq(char const *var, char const *val_1, char const *val_2)
+static Command *makeEq(Token const *args, SymbolTable *symbols, Arena *arena,
+                       ParserContext *ctx)
 {
   // Allocate space for the EqCommand object
-  EqCommand *this = (EqCommand *) malloc(sizeof(EqCommand));
+  EqCommand *this = (EqCommand *) arenaAlloc(arena, sizeof(EqCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeEq;
-  this->line = getLineNumber();
-  this->destroy = destroyEq;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileEq;
 
   // Make a copy of the arguments.
-  this->var = copyString(var);
-  this->val_1 = copyString(val_1);
-  this->val_2 = copyString(val_2);
+  this->var = internSymbol(symbols, args[0].text, args[0].len);
+  makeOperand(&this->val_1, &args[1], symbols, arena);
+  makeOperand(&this->val_2, &args[2], symbols, arena);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -399,113 +420,76 @@ static Command *makeEq(char const *var, char const *val_1, char const *val_2)
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
-  /** Name of variable the sum will be stored in */
-  char *var;
-  
+
+  /** Slot of variable the result will be stored in */
+  int var;
+
   /** Value of 1st arg */
-  char *val_1;
-  
+  Operand val_1;
+
   /** Value of 2nd arg */
-  char *val_2;
-  
-} ModCommand;
+  Operand val_2;
 
-/**
-  This function will destroy the ModCommand Struct.
-  @param ModCommand cmd
-*/
-static void destroyMod(Command *cmd)
-{
-  ModCommand *this = (ModCommand *)cmd;
-  free(this->var);
-  free(this->val_1);
-  free(this->val_2);
-  free(this);
-}
+} ModCommand;
 
 // Execute function for the modular command
-static int executeMod( Command *cmd, LabelMap *labelMap, int pc )
+static int executeMod( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   ModCommand *this = (ModCommand *)cmd;
 
-  int value = 0;
-  long value_1 = 0;
-  long value_2 = 0;
-  
-  long mod = 0;
-  
-  if (this->val_1[0] == '"') {
-    if (sscanf((this->val_1 + 1), "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_1 = getenv(this->val_1);
-    if (str_1 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_1, this->line);
-      exit(1);
-    }
-    if (sscanf(str_1, "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  if (this->val_2[0] == '"') {
-    if (sscanf((this->val_2 + 1), "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_2 = getenv(this->val_2);
-    if (str_2 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_2, this->line);
-      exit(1);
-    }
-    if (sscanf(str_2, "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
+  int64_t value_1 = getNumber(&this->val_1, vars, this->line);
+  int64_t value_2 = getNumber(&this->val_2, vars, this->line);
+
+  if (value_2 == 0) {
+    runtimeError(vars->out, "Divide by zero (line %d)", this->line);
   }
-  
-  mod = value_1 % value_2;
-  
-  char mod_str[MAX_TOKEN + 1];
-  
-  sprintf(mod_str, "%ld", mod);
-  
-  value = setenv(this->var, mod_str, 1);
+
+  // INT64_MIN % -1 traps on the hardware, and any number % -1 is 0.
+  setInt(vars, this->var, value_2 == -1 ? 0 : value_1 % value_2);
 
   return pc + 1;
 }
 
+// Compile function for the modular command
+static void compileMod( Command *cmd, Code *code )
+{
+  ModCommand *this = (ModCommand *)cmd;
+  emit(code, OP_MOD, this->var, compileOperand(&this->val_1, code),
+       compileOperand(&this->val_2, code), this->line);
+}
+
 /** Make a command that implements the mod command.
-    @param var, the variable to store the result in.
-    @param val_1, the first value
-    @param val_2, the second value
+    @param args, tokens for the variable to store the result in, then the
+    first and second values
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements modular.
  */
-static Command *makeMod(char const *var, char const *val_1, char const *val_2)
+static Command *makeMod(Token const *args, SymbolTable *symbols, Arena *arena,
+                        ParserContext *ctx)
 {
   // Allocate space for the ModCommand object
-  ModCommand *this = (ModCommand *) malloc(sizeof(ModCommand));
+  ModCommand *this = (ModCommand *) arenaAlloc(arena, sizeof(ModCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeMod;
-  this->line = getLineNumber();
-  this->destroy = destroyMod;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileMod;
 
   // Make a copy of the arguments.
-  this->var = copyString(var);
-  this->val_1 = copyString(val_1);
-  this->val_2 = copyString(val_2);
+  this->var = internSymbol(symbols, args[0].text, args[0].len);
+  makeOperand(&this->val_1, &args[1], symbols, arena);
+  makeOperand(&this->val_2, &args[2], symbols, arena);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -516,118 +500,78 @@ static Command *makeMod(char const *var, char const *val_1, char const *val_2)
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
-  /** Name of variable the sum will be stored in */
-  char *var;
-  
+
+  /** Slot of variable the result will be stored in */
+  int var;
+
   /** Value of 1st arg */
-  char *val_1;
-  
+  Operand val_1;
+
   /** Value of 2nd arg */
-  char *val_2;
-  
-} DivCommand;
+  Operand val_2;
 
-/**
-  This function will destroy the DivCommand Struct.
-  @param DivCommand cmd
-*/
-static void destroyDiv(Command *cmd)
-{
-  DivCommand *this = (DivCommand *)cmd;
-  free(this->var);
-  free(this->val_1);
-  free(this->val_2);
-  free(this);
-}
+} DivCommand;
 
 // Execute function for the divide command
-static int executeDiv( Command *cmd, LabelMap *labelMap, int pc )
+static int executeDiv( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   DivCommand *this = (DivCommand *)cmd;
 
-  int value = 0;
-  long value_1 = 0;
-  long value_2 = 0;
-  
-  long quotient = 0;
-  
-  if (this->val_1[0] == '"') {
-    if (sscanf((this->val_1 + 1), "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_1 = getenv(this->val_1);
-    if (str_1 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_1, this->line);
-      exit(1);
-    }
-    if (sscanf(str_1, "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  if (this->val_2[0] == '"') {
-    if (sscanf((this->val_2 + 1), "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_2 = getenv(this->val_2);
-    if (str_2 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_2, this->line);
-      exit(1);
-    }
-    if (sscanf(str_2, "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
+  int64_t value_1 = getNumber(&this->val_1, vars, this->line);
+  int64_t value_2 = getNumber(&this->val_2, vars, this->line);
+
   if (value_2 == 0) {
-    fprintf(stderr, "Divide by zero (line %d)\n", this->line);
-    exit(1);
+    runtimeError(vars->out, "Divide by zero (line %d)", this->line);
   }
-  
-  quotient = value_1 / value_2;
-  
-  char quotient_str[MAX_TOKEN + 1];
-  
-  sprintf(quotient_str, "%ld", quotient);
-  
-  value = setenv(this->var, quotient_str, 1);
+
+  // INT64_MIN / -1 traps on the hardware, so -1 negates instead, and
+  // wraps like add does.
+  setInt(vars, this->var, value_2 == -1 ? (int64_t) (0 - (uint64_t) value_1) :
+         value_1 / value_2);
 
   return pc + 1;
 }
 
+// Compile function for the divide command
+static void compileDiv( Command *cmd, Code *code )
+{
+  DivCommand *this = (DivCommand *)cmd;
+  emit(code, OP_DIV, this->var, compileOperand(&this->val_1, code),
+       compileOperand(&this->val_2, code), this->line);
+}
+
 /** Make a command that implements the divide command.
-    @param var, the variable to store the result in.
-    @param val_1, the first value
-    @param val_2, the second value
+    @param args, tokens for the variable to store the result in, then the
+    first and second values
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements divide.
  */
-static Command *makeDiv(char const *var, char const *val_1, char const *val_2)
+static Command *makeDiv(Token const *args, SymbolTable *symbols, Arena *arena,
+                        ParserContext *ctx)
 {
   // Allocate space for the DivCommand object
-  DivCommand *this = (DivCommand *) malloc(sizeof(DivCommand));
+  DivCommand *this = (DivCommand *) arenaAlloc(arena, sizeof(DivCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeDiv;
-  this->line = getLineNumber();
-  this->destroy = destroyDiv;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileDiv;
 
   // Make a copy of the arguments.
-  this->var = copyString(var);
-  this->val_1 = copyString(val_1);
-  this->val_2 = copyString(val_2);
+  this->var = internSymbol(symbols, args[0].text, args[0].len);
+  makeOperand(&this->val_1, &args[1], symbols, arena);
+  makeOperand(&this->val_2, &args[2], symbols, arena);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -638,113 +582,71 @@ static Command *makeDiv(char const *var, char const *val_1, char const *val_2)
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
-  /** Name of variable the sum will be stored in */
-  char *var;
-  
+
+  /** Slot of variable the result will be stored in */
+  int var;
+
   /** Value of 1st arg */
-  char *val_1;
-  
+  Operand val_1;
+
   /** Value of 2nd arg */
-  char *val_2;
-  
-} MultCommand;
+  Operand val_2;
 
-/**
-  This function will destroy the MultCommand Struct.
-  @param MultCommand cmd
-*/
-static void destroyMult(Command *cmd)
-{
-  MultCommand *this = (MultCommand *)cmd;
-  free(this->var);
-  free(this->val_1);
-  free(this->val_2);
-  free(this);
-}
+} MultCommand;
 
 // Execute function for the multiply command
-static int executeMult( Command *cmd, LabelMap *labelMap, int pc )
+static int executeMult( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   MultCommand *this = (MultCommand *)cmd;
 
-  int value = 0;
-  long value_1 = 0;
-  long value_2 = 0;
-  
-  long product = 0;
-  
-  if (this->val_1[0] == '"') {
-    if (sscanf((this->val_1 + 1), "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_1 = getenv(this->val_1);
-    if (str_1 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_1, this->line);
-      exit(1);
-    }
-    if (sscanf(str_1, "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  if (this->val_2[0] == '"') {
-    if (sscanf((this->val_2 + 1), "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_2 = getenv(this->val_2);
-    if (str_2 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_2, this->line);
-      exit(1);
-    }
-    if (sscanf(str_2, "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  product = value_1 * value_2;
-  
-  char prod_str[MAX_TOKEN + 1];
-  
-  sprintf(prod_str, "%ld", product);
-  
-  value = setenv(this->var, prod_str, 1);
+  int64_t value_1 = getNumber(&this->val_1, vars, this->line);
+  int64_t value_2 = getNumber(&this->val_2, vars, this->line);
+
+  setInt(vars, this->var, (int64_t) ((uint64_t) value_1 * (uint64_t) value_2));
 
   return pc + 1;
 }
 
+// Compile function for the multiply command
+static void compileMult( Command *cmd, Code *code )
+{
+  MultCommand *this = (MultCommand *)cmd;
+  emit(code, OP_MULT, this->var, compileOperand(&this->val_1, code),
+       compileOperand(&this->val_2, code), this->line);
+}
+
 /** Make a command that implements the multiply command.
-    @param var, the variable to store the result in.
-    @param val_1, the first value
-    @param val_2, the second value
+    @param args, tokens for the variable to store the result in, then the
+    first and second values
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements multiply.
  */
-static Command *makeMult(char const *var, char const *val_1, char const *val_2)
+static Command *makeMult(Token const *args, SymbolTable *symbols, Arena *arena,
+                         ParserContext *ctx)
 {
   // Allocate space for the MultCommand object
-  MultCommand *this = (MultCommand *) malloc(sizeof(MultCommand));
+  MultCommand *this = (MultCommand *) arenaAlloc(arena, sizeof(MultCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeMult;
-  this->line = getLineNumber();
-  this->destroy = destroyMult;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileMult;
 
   // Make a copy of the arguments.
-  this->var = copyString(var);
-  this->val_1 = copyString(val_1);
-  this->val_2 = copyString(val_2);
+  this->var = internSymbol(symbols, args[0].text, args[0].len);
+  makeOperand(&this->val_1, &args[1], symbols, arena);
+  makeOperand(&this->val_2, &args[2], symbols, arena);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -755,113 +657,71 @@ static Command *makeMult(char const *var, char const *val_1, char const *val_2)
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
-  /** Name of variable the sum will be stored in */
-  char *var;
-  
+
+  /** Slot of variable the result will be stored in */
+  int var;
+
   /** Value of 1st arg */
-  char *val_1;
-  
+  Operand val_1;
+
   /** Value of 2nd arg */
-  char *val_2;
-  
-} SubCommand;
+  Operand val_2;
 
-/**
-  This function will destroy the SubCommand Struct.
-  @param SubCommand cmd
-*/
-static void destroySub(Command *cmd)
-{
-  SubCommand *this = (SubCommand *)cmd;
-  free(this->var);
-  free(this->val_1);
-  free(this->val_2);
-  free(this);
-}
+} SubCommand;
 
 // Execute function for the subtract command
-static int executeSub( Command *cmd, LabelMap *labelMap, int pc )
+static int executeSub( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   SubCommand *this = (SubCommand *)cmd;
 
-  int value = 0;
-  long value_1 = 0;
-  long value_2 = 0;
-  
-  long difference = 0;
-  
-  if (this->val_1[0] == '"') {
-    if (sscanf((this->val_1 + 1), "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_1 = getenv(this->val_1);
-    if (str_1 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_1, this->line);
-      exit(1);
-    }
-    if (sscanf(str_1, "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  if (this->val_2[0] == '"') {
-    if (sscanf((this->val_2 + 1), "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_2 = getenv(this->val_2);
-    if (str_2 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_2, this->line);
-      exit(1);
-    }
-    if (sscanf(str_2, "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  difference = value_1 - value_2;
-  
-  char diff_str[MAX_TOKEN + 1];
-  
-  sprintf(diff_str, "%ld", difference);
-  
-  value = setenv(this->var, diff_str, 1);
+  int64_t value_1 = getNumber(&this->val_1, vars, this->line);
+  int64_t value_2 = getNumber(&this->val_2, vars, this->line);
+
+  setInt(vars, this->var, (int64_t) ((uint64_t) value_1 - (uint64_t) value_2));
 
   return pc + 1;
 }
 
+// Compile function for the subtract command
+static void compileSub( Command *cmd, Code *code )
+{
+  SubCommand *this = (SubCommand *)cmd;
+  emit(code, OP_SUB, this->var, compileOperand(&this->val_1, code),
+       compileOperand(&this->val_2, code), this->line);
+}
+
 /** Make a command that implements the subtract command.
-    @param var, the variable to store the result in.
-    @param val_1, the first value
-    @param val_2, the second value
+    @param args, tokens for the variable to store the result in, then the
+    first and second values
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements subtract.
  */
-static Command *makeSub(char const *var, char const *val_1, char const *val_2)
+static Command *makeSub(Token const *args, SymbolTable *symbols, Arena *arena,
+                        ParserContext *ctx)
 {
   // Allocate space for the SubCommand object
-  SubCommand *this = (SubCommand *) malloc(sizeof(SubCommand));
+  SubCommand *this = (SubCommand *) arenaAlloc(arena, sizeof(SubCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeSub;
-  this->line = getLineNumber();
-  this->destroy = destroySub;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileSub;
 
   // Make a copy of the argument.
-  this->var = copyString(var);
-  this->val_1 = copyString(val_1);
-  this->val_2 = copyString(val_2);
+  this->var = internSymbol(symbols, args[0].text, args[0].len);
+  makeOperand(&this->val_1, &args[1], symbols, arena);
+  makeOperand(&this->val_2, &args[2], symbols, arena);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -872,182 +732,303 @@ static Command *makeSub(char const *var, char const *val_1, char const *val_2)
 
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
-  /** Name of variable the sum will be stored in */
-  char *var;
-  
+
+  /** Slot of variable the sum will be stored in */
+  int var;
+
   /** Value of 1st arg */
-  char *val_1;
-  
+  Operand val_1;
+
   /** Value of 2nd arg */
-  char *val_2;
-  
-} AddCommand;
+  Operand val_2;
 
-/**
-  This function will destroy the AddCommand Struct.
-  @param AddCommand cmd
-*/
-static void destroyAdd(Command *cmd)
-{
-  AddCommand *this = (AddCommand *)cmd;
-  free(this->var);
-  free(this->val_1);
-  free(this->val_2);
-  free(this);
-}
+} AddCommand;
 
 // Execute function for the add command
-static int executeAdd( Command *cmd, LabelMap *labelMap, int pc )
+static int executeAdd( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   AddCommand *this = (AddCommand *)cmd;
 
-  int value = 0;
-  long value_1 = 0;
-  long value_2 = 0;
-  
-  long sum = 0;
-  
-  if (this->val_1[0] == '"') {
-    if (sscanf((this->val_1 + 1), "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_1 = getenv(this->val_1);
-    if (str_1 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_1, this->line);
-      exit(1);
-    }
-    if (sscanf(str_1, "%ld", &value_1) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  if (this->val_2[0] == '"') {
-    if (sscanf((this->val_2 + 1), "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  } else {
-    char *str_2 = getenv(this->val_2);
-    if (str_2 == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->val_2, this->line);
-      exit(1);
-    }
-    if (sscanf(str_2, "%ld", &value_2) != 1) {
-      fprintf(stderr, "Invalid number (line %d)\n", this->line);
-      exit(1);
-    }
-  }
-  
-  sum = value_1 + value_2;
-  
-  char sum_str[MAX_TOKEN + 1];
-  
-  sprintf(sum_str, "%ld", sum);
-  
-  value = setenv(this->var, sum_str, 1);
+  int64_t value_1 = getNumber(&this->val_1, vars, this->line);
+  int64_t value_2 = getNumber(&this->val_2, vars, this->line);
+
+  // Add unsigned, so overflow wraps like it does in the bytecode engines.
+  setInt(vars, this->var, (int64_t) ((uint64_t) value_1 + (uint64_t) value_2));
 
   return pc + 1;
 }
 
+// Compile function for the add command
+static void compileAdd( Command *cmd, Code *code )
+{
+  AddCommand *this = (AddCommand *)cmd;
+  emit(code, OP_ADD, this->var, compileOperand(&this->val_1, code),
+       compileOperand(&this->val_2, code), this->line);
+}
+
 /** Make a command that implements the add command.
-    @param var, the variable to store the result in.
-    @param val_1, the first value
-    @param val_2, the second value
+    @param args, tokens for the variable to store the result in, then the
+    first and second values
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements add.
  */
-static Command *makeAdd(char const *var, char const *val_1, char const *val_2)
+static Command *makeAdd(Token const *args, SymbolTable *symbols, Arena *arena,
+                        ParserContext *ctx)
 {
   // Allocate space for the AddCommand object
-  AddCommand *this = (AddCommand *) malloc(sizeof(AddCommand));
+  AddCommand *this = (AddCommand *) arenaAlloc(arena, sizeof(AddCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeAdd;
-  this->line = getLineNumber();
-  this->destroy = destroyAdd;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileAdd;
 
   // Make a copy of the arguments.
-  this->var = copyString(var);
-  this->val_1 = copyString(val_1);
-  this->val_2 = copyString(val_2);
+  this->var = internSymbol(symbols, args[0].text, args[0].len);
+  makeOperand(&this->val_1, &args[1], symbols, arena);
+  makeOperand(&this->val_2, &args[2], symbols, arena);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-//Set Command
+//Atomic Commands
 
+// Representation for atomic_add, atomic_max and cas, which all work on
+// a shared counter.  They only differ in their methods.
 typedef struct {
   //documented in the superclass.
-  int (*execute)(Command *cmd, LabelMap *labelMap, int pc);
-  
-  void (*destroy)(Command *cmd);
-  
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
   int line;
-  
-  /** Name of variable to be set */
-  char *arg;
-  
-  /** Value of variable */
-  char *val;
-} SetCommand;
 
-/**
-  This function will destroy the SetCommand Struct.
-  @param SetCommand cmd
-*/
-static void destroySet(Command *cmd)
+  /** Slot of variable the result will be stored in.  For cas, it also
+      holds the value the counter is expected to have. */
+  int var;
+
+  /** Slot of the shared counter, in its own namespace */
+  int counter;
+
+  /** Value to add, to raise the counter to, or to store in it */
+  Operand val;
+
+} AtomicCommand;
+
+// Execute function for the atomic_add command
+static int executeAtomicAdd( Command *cmd, VarStore *vars, int pc )
 {
-  SetCommand *this = (SetCommand *)cmd;
-  free(this->arg);
-  free(this->val);
-  free(this);
+  // Cast the this pointer to the struct type it really points to.
+  AtomicCommand *this = (AtomicCommand *)cmd;
+
+  int64_t value = getNumber(&this->val, vars, this->line);
+  setInt(vars, this->var, sharedAdd(SHARED_SLOT(vars->shared, this->counter), value));
+
+  return pc + 1;
+}
+
+// Compile function for the atomic_add command
+static void compileAtomicAdd( Command *cmd, Code *code )
+{
+  AtomicCommand *this = (AtomicCommand *)cmd;
+  emit(code, OP_ATOMIC_ADD, this->var, this->counter, compileOperand(&this->val, code),
+       this->line);
+}
+
+// Execute function for the atomic_max command
+static int executeAtomicMax( Command *cmd, VarStore *vars, int pc )
+{
+  // Cast the this pointer to the struct type it really points to.
+  AtomicCommand *this = (AtomicCommand *)cmd;
+
+  int64_t value = getNumber(&this->val, vars, this->line);
+  setInt(vars, this->var, sharedMax(SHARED_SLOT(vars->shared, this->counter), value));
+
+  return pc + 1;
+}
+
+// Compile function for the atomic_max command
+static void compileAtomicMax( Command *cmd, Code *code )
+{
+  AtomicCommand *this = (AtomicCommand *)cmd;
+  emit(code, OP_ATOMIC_MAX, this->var, this->counter, compileOperand(&this->val, code),
+       this->line);
+}
+
+// Execute function for the cas command
+static int executeCas( Command *cmd, VarStore *vars, int pc )
+{
+  // Cast the this pointer to the struct type it really points to.
+  AtomicCommand *this = (AtomicCommand *)cmd;
+
+  Operand expected = { this->var };
+  int64_t value_1 = getNumber(&expected, vars, this->line);
+  int64_t value_2 = getNumber(&this->val, vars, this->line);
+  setInt(vars, this->var,
+         sharedCas(SHARED_SLOT(vars->shared, this->counter), value_1, value_2));
+
+  return pc + 1;
 }
 
+// Compile function for the cas command
+static void compileCas( Command *cmd, Code *code )
+{
+  AtomicCommand *this = (AtomicCommand *)cmd;
+  emit(code, OP_CAS, this->var, this->counter, compileOperand(&this->val, code), this->line);
+}
+
+/** Make a command that works on a shared counter.
+    @param args, tokens for the variable to store the result in, the
+    counter, then the value
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
+    @param execute, the command's execute method
+    @param compile, the command's compile method
+    @return a new Command for the counter.
+ */
+static Command *makeAtomic(Token const *args, SymbolTable *symbols, Arena *arena,
+                           ParserContext *ctx,
+                           int (*execute)(Command *cmd, VarStore *vars, int pc),
+                           void (*compile)(Command *cmd, Code *code))
+{
+  // Allocate space for the AtomicCommand object
+  AtomicCommand *this = (AtomicCommand *) arenaAlloc(arena, sizeof(AtomicCommand));
+
+  // Remember pointers to our overridable methods and line number.
+  this->execute = execute;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compile;
+
+  // Make a copy of the arguments.  Counters are numbered like
+  // variables, but they're stored apart from them.
+  this->var = internSymbol(symbols, args[0].text, args[0].len);
+  this->counter = internSymbol(symbols, args[1].text, args[1].len);
+  makeOperand(&this->val, &args[2], symbols, arena);
+
+  // Return the result, as an instance of the Command interface.
+  return (Command *) this;
+}
+
+/** Make a command that implements the atomic_add command.
+    @param args, tokens for the variable to store the new total in, the
+    counter, then the value to add
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
+    @return a new Command that implements atomic_add.
+ */
+static Command *makeAtomicAdd(Token const *args, SymbolTable *symbols, Arena *arena,
+                              ParserContext *ctx)
+{
+  return makeAtomic(args, symbols, arena, ctx, executeAtomicAdd, compileAtomicAdd);
+}
+
+/** Make a command that implements the atomic_max command.
+    @param args, tokens for the variable to store the new maximum in,
+    the counter, then the value to raise it to
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
+    @return a new Command that implements atomic_max.
+ */
+static Command *makeAtomicMax(Token const *args, SymbolTable *symbols, Arena *arena,
+                              ParserContext *ctx)
+{
+  return makeAtomic(args, symbols, arena, ctx, executeAtomicMax, compileAtomicMax);
+}
+
+/** Make a command that implements the cas command.
+    @param args, tokens for the variable with the expected value, which
+    gets the counter's old value, the counter, then the new value
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
+    @return a new Command that implements cas.
+ */
+static Command *makeCas(Token const *args, SymbolTable *symbols, Arena *arena,
+                        ParserContext *ctx)
+{
+  return makeAtomic(args, symbols, arena, ctx, executeCas, compileCas);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//Set Command
+
+typedef struct {
+  //documented in the superclass.
+  int (*execute)(Command *cmd, VarStore *vars, int pc);
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
+  int line;
+
+  /** Slot of variable to be set */
+  int arg;
+
+  /** Value of variable */
+  Operand val;
+} SetCommand;
+
 // Execute function for the set command
-static int executeSet( Command *cmd, LabelMap *labelMap, int pc )
+static int executeSet( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   SetCommand *this = (SetCommand *)cmd;
 
-  int value = 0;
-  
-  if (this->val[0] == '"') {
-    value = setenv(this->arg, this->val + 1, 1);
-  } else {
-    value = setenv(this->arg, this->val, 1);
-  }
+  setValue(vars, this->arg, getValue(&this->val, vars, this->line));
 
   return pc + 1;
 }
 
-/** Make a command that sets the given argument to an environment variable.
-    @param arg The argument to set, the name of an environment variable.
+// Compile function for the set command
+static void compileSet( Command *cmd, Code *code )
+{
+  SetCommand *this = (SetCommand *)cmd;
+  emit(code, OP_SET, this->arg, compileOperand(&this->val, code), 0, this->line);
+}
+
+/** Make a command that sets the given variable to a value.
+    @param args, tokens for the variable to set and the value to give it,
+    a literal or another variable
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements set.
  */
-static Command *makeSet(char const *arg, char const *val)
+static Command *makeSet(Token const *args, SymbolTable *symbols, Arena *arena,
+                        ParserContext *ctx)
 {
   // Allocate space for the SetCommand object
-  SetCommand *this = (SetCommand *) malloc(sizeof(SetCommand));
+  SetCommand *this = (SetCommand *) arenaAlloc(arena, sizeof(SetCommand));
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executeSet;
-  this->line = getLineNumber();
-  this->destroy = destroySet;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileSet;
 
   // Make a copy of the arguments.
-  this->arg = copyString(arg);
-  this->val = copyString(val);
+  this->arg = internSymbol(symbols, args[0].text, args[0].len);
+  makeOperand(&this->val, &args[1], symbols, arena);
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
@@ -1059,186 +1040,426 @@ static Command *makeSet(char const *arg, char const *val)
 // Representation for a print command, derived from Command.
 typedef struct {
   // Documented in the superclass.
-  int (*execute)( Command *cmd, LabelMap *labelMap, int pc );
+  int (*execute)( Command *cmd, VarStore *vars, int pc );
 
-  void (*destroy)(Command *cmd);
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
 
   int line;
 
   /** Argument we're supposed to print. */
-  char *arg;
+  Operand arg;
 } PrintCommand;
 
-/**
-  This function will destroy the PrintCommand Struct.
-  @param PrintCommand cmd
-*/
-static void destroyPrint(Command *cmd) {
-  PrintCommand *this = (PrintCommand *)cmd;
-  free(this->arg);
-  free(this);
-}
-
 // execute function for the print command
-static int executePrint( Command *cmd, LabelMap *labelMap, int pc )
+static int executePrint( Command *cmd, VarStore *vars, int pc )
 {
   // Cast the this pointer to the struct type it really points to.
   PrintCommand *this = (PrintCommand *)cmd;
 
-  // Right now, we're assuming the argument is a literal value, but
-  // you'll need to add support for variables.
-  
-  if (this->arg[0] == '"') {
-    printf( "%s", this->arg + 1 );
-  } else {
-    //Get the value of the variable to print
-    char *str = getenv(this->arg);
-    
-    if (str == NULL) {
-      fprintf(stderr, "Undefined variable: %s (line %d)\n", this->arg, this->line);
-      exit(1);
-    }
-    
-    //But let's check to make sure that the variable isn't linked to another var
-    char *var = getenv(str);
-    if (var != NULL) {
-      char *str2 = copyString(var);
-      while (var != NULL) {
-        var = getenv(var);
-        if (var != NULL) {
-          free(str2);
-          char *str2 = copyString(var);
-        }
-      }
-      printf("%s", str2);
-      free(str2);
-    } else {
-      if (str == NULL) {
-        fprintf(stderr, "Undefined variable: %s (line %d)\n", this->arg, this->line);
-        exit(1);
-      }
-      printf("%s", str);
-    }
-  }
-  
+  // Room to format the value, if it's a number.
+  char buf[ NUMBER_LEN ];
+  printOutput( vars->out, toText( getValue( &this->arg, vars, this->line ), buf ) );
+
   return pc + 1;
 }
 
+// Compile function for the print command
+static void compilePrint( Command *cmd, Code *code )
+{
+  PrintCommand *this = (PrintCommand *)cmd;
+  emit(code, OP_PRINT, compileOperand(&this->arg, code), 0, 0, this->line);
+}
+
 /** Make a command that prints the given argument to the terminal.
-    @param arg The argument to print, either a string literal or the
-    name of an environment variable.
+    @param args, token for the argument to print, either a string
+    literal or the name of a variable.
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
     @return a new Command that implements print.
  */
-static Command *makePrint( char const *arg )
+static Command *makePrint( Token const *args, SymbolTable *symbols, Arena *arena,
+                           ParserContext *ctx )
 {
   // Allocate space for the PrintCommand object
-  PrintCommand *this = (PrintCommand *) malloc( sizeof( PrintCommand ) );
+  PrintCommand *this = (PrintCommand *) arenaAlloc( arena, sizeof( PrintCommand ) );
 
   // Remember pointers to our overridable methods and line number.
   this->execute = executePrint;
-  this->line = getLineNumber();
-  this->destroy = destroyPrint;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compilePrint;
 
   // Make a copy of the argument.
-  this->arg = copyString( arg );
+  makeOperand( &this->arg, &args[0], symbols, arena );
 
   // Return the result, as an instance of the Command interface.
   return (Command *) this;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+// Spawn Command
+
+// Representation for a spawn command, derived from Command.
+typedef struct {
+  // Documented in the superclass.
+  int (*execute)( Command *cmd, VarStore *vars, int pc );
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
+  int line;
+
+  /** Name of the label the task starts at */
+  char const *label;
+
+  /** index of the command for label, filled in when the program is linked */
+  int target;
+} SpawnCommand;
+
+// Execute function for the spawn command
+static int executeSpawn( Command *cmd, VarStore *vars, int pc )
+{
+  // Cast the this pointer to the struct type it really points to.
+  SpawnCommand *this = (SpawnCommand *)cmd;
+
+  spawnTask( vars, this->target );
+  return pc + 1;
+}
+
+// Link function for the spawn command
+static bool linkSpawn( Command *cmd, LabelMap *labelMap, ParserContext *ctx )
+{
+  SpawnCommand *this = (SpawnCommand *)cmd;
+  return resolveLabel(labelMap, this->label, this->line, &this->target, ctx);
+}
+
+// Compile function for the spawn command
+static void compileSpawn( Command *cmd, Code *code )
+{
+  SpawnCommand *this = (SpawnCommand *)cmd;
+  emit(code, OP_SPAWN, this->target, 0, 0, this->line);
+}
+
+/** Make a command that starts a task running from a label.
+    @param args, token for the label the task starts at
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
+    @return a new Command that implements spawn.
+ */
+static Command *makeSpawn( Token const *args, SymbolTable *symbols, Arena *arena,
+                           ParserContext *ctx )
+{
+  // Allocate space for the SpawnCommand object
+  SpawnCommand *this = (SpawnCommand *) arenaAlloc( arena, sizeof( SpawnCommand ) );
+
+  // Remember pointers to our overridable methods and line number.
+  this->execute = executeSpawn;
+  this->line = getLineNumber(ctx);
+  this->link = linkSpawn;
+  this->compile = compileSpawn;
+
+  // Make a copy of the label.
+  this->label = internString( arena, args[0].text, args[0].len );
+
+  // Return the result, as an instance of the Command interface.
+  return (Command *) this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Join Command
+
+// Representation for a join command, derived from Command.  It doesn't
+// need anything but the common fields.
+typedef struct {
+  // Documented in the superclass.
+  int (*execute)( Command *cmd, VarStore *vars, int pc );
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
+  int line;
+} JoinCommand;
+
+// Execute function for the join command
+static int executeJoin( Command *cmd, VarStore *vars, int pc )
+{
+  joinTasks( vars );
+  return pc + 1;
+}
+
+// Compile function for the join command
+static void compileJoin( Command *cmd, Code *code )
+{
+  JoinCommand *this = (JoinCommand *)cmd;
+  emit(code, OP_JOIN, 0, 0, 0, this->line);
+}
+
+/** Make a command that waits for tasks and merges their results.
+    @param args, unused, since join doesn't take any arguments
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
+    @return a new Command that implements join.
+ */
+static Command *makeJoin( Token const *args, SymbolTable *symbols, Arena *arena,
+                          ParserContext *ctx )
+{
+  // Allocate space for the JoinCommand object
+  JoinCommand *this = (JoinCommand *) arenaAlloc( arena, sizeof( JoinCommand ) );
+
+  // Remember pointers to our overridable methods and line number.
+  this->execute = executeJoin;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileJoin;
+
+  // Return the result, as an instance of the Command interface.
+  return (Command *) this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Go Command
+
+// Representation for a go command, derived from Command.
+typedef struct {
+  // Documented in the superclass.
+  int (*execute)( Command *cmd, VarStore *vars, int pc );
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
+  int line;
+
+  /** Name of the label the coroutine starts at */
+  char const *label;
+
+  /** index of the command for label, filled in when the program is linked */
+  int target;
+} GoCommand;
+
+// Execute function for the go command
+static int executeGo( Command *cmd, VarStore *vars, int pc )
+{
+  // Cast the this pointer to the struct type it really points to.
+  GoCommand *this = (GoCommand *)cmd;
+
+  startCoroutine( vars, this->target );
+  return pc + 1;
+}
+
+// Link function for the go command
+static bool linkGo( Command *cmd, LabelMap *labelMap, ParserContext *ctx )
+{
+  GoCommand *this = (GoCommand *)cmd;
+  return resolveLabel(labelMap, this->label, this->line, &this->target, ctx);
+}
+
+// Compile function for the go command
+static void compileGo( Command *cmd, Code *code )
+{
+  GoCommand *this = (GoCommand *)cmd;
+  emit(code, OP_GO, this->target, 0, 0, this->line);
+}
+
+/** Make a command that starts a coroutine running from a label.
+    @param args, token for the label the coroutine starts at
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
+    @return a new Command that implements go.
+ */
+static Command *makeGo( Token const *args, SymbolTable *symbols, Arena *arena,
+                        ParserContext *ctx )
+{
+  // Allocate space for the GoCommand object
+  GoCommand *this = (GoCommand *) arenaAlloc( arena, sizeof( GoCommand ) );
+
+  // Remember pointers to our overridable methods and line number.
+  this->execute = executeGo;
+  this->line = getLineNumber(ctx);
+  this->link = linkGo;
+  this->compile = compileGo;
+
+  // Make a copy of the label.
+  this->label = internString( arena, args[0].text, args[0].len );
+
+  // Return the result, as an instance of the Command interface.
+  return (Command *) this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Yield Command
+
+// Representation for a yield command, derived from Command.  It doesn't
+// need anything but the common fields.
+typedef struct {
+  // Documented in the superclass.
+  int (*execute)( Command *cmd, VarStore *vars, int pc );
+
+  bool (*link)(Command *cmd, LabelMap *labelMap, ParserContext *ctx);
+
+  void (*compile)(Command *cmd, Code *code);
+
+  int line;
+} YieldCommand;
+
+// Execute function for the yield command
+static int executeYield( Command *cmd, VarStore *vars, int pc )
+{
+  // The scheduler takes it from here, and resumes at the next command.
+  return YIELD_AT( pc + 1 );
+}
+
+// Compile function for the yield command
+static void compileYield( Command *cmd, Code *code )
+{
+  YieldCommand *this = (YieldCommand *)cmd;
+  emit(code, OP_YIELD, 0, 0, 0, this->line);
+}
+
+/** Make a command that lets the other coroutines take a turn.
+    @param args, unused, since yield doesn't take any arguments
+    @param symbols, symbol table for the program
+    @param arena, arena to allocate the command from
+    @param ctx, parser context, for the line number
+    @return a new Command that implements yield.
+ */
+static Command *makeYield( Token const *args, SymbolTable *symbols, Arena *arena,
+                           ParserContext *ctx )
+{
+  // Allocate space for the YieldCommand object
+  YieldCommand *this = (YieldCommand *) arenaAlloc( arena, sizeof( YieldCommand ) );
+
+  // Remember pointers to our overridable methods and line number.
+  this->execute = executeYield;
+  this->line = getLineNumber(ctx);
+  this->link = NULL;
+  this->compile = compileYield;
+
+  // Return the result, as an instance of the Command interface.
+  return (Command *) this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Command registry
+
+/** Most operands any command takes. */
+#define MAX_ARGS 3
+
+/** Number of buckets in the keyword table.  This is a power of two. */
+#define KEYWORD_BUCKETS 64
+
+/** Perfect hash for command names, from the first and last characters
+    and the length.  It was picked by hand so every keyword lands in its
+    own bucket; a new command needs a bucket that isn't taken, and the
+    build warns (-Woverride-init) if two rows of the table collide. */
+#define KEYWORD_HASH( first, last, len ) \
+  ( ( (first) + 4 * (last) + (len) ) & ( KEYWORD_BUCKETS - 1 ) )
+
+/** What kind of token each operand has to be. */
+typedef enum {
+  /** A variable name, for the destination of a result. */
+  ARG_VAR,
+
+  /** A value, either a variable name or a quoted literal. */
+  ARG_VALUE,
+
+  /** The name of a label. */
+  ARG_LABEL
+} ArgKind;
+
+/** Description of one command in the language, enough to parse it. */
+typedef struct {
+  /** Keyword for the command, or NULL for an empty bucket. */
+  char const *name;
+
+  /** Number of operands before the semicolon. */
+  int arity;
+
+  /** Kind of each operand. */
+  ArgKind args[ MAX_ARGS ];
+
+  /** Constructor for the command, given its operands. */
+  Command *(*make)( Token const *args, SymbolTable *symbols, Arena *arena,
+                    ParserContext *ctx );
+} CommandType;
+
+/** Every command, stored in the bucket for its keyword. */
+static CommandType const commandTypes[ KEYWORD_BUCKETS ] = {
+  [ KEYWORD_HASH( 'p', 't', 5 ) ] = { "print", 1, { ARG_VALUE }, makePrint },
+  [ KEYWORD_HASH( 's', 't', 3 ) ] = { "set", 2, { ARG_VAR, ARG_VALUE }, makeSet },
+  [ KEYWORD_HASH( 'a', 'd', 3 ) ] = { "add", 3, { ARG_VAR, ARG_VALUE, ARG_VALUE }, makeAdd },
+  [ KEYWORD_HASH( 's', 'b', 3 ) ] = { "sub", 3, { ARG_VAR, ARG_VALUE, ARG_VALUE }, makeSub },
+  [ KEYWORD_HASH( 'm', 't', 4 ) ] = { "mult", 3, { ARG_VAR, ARG_VALUE, ARG_VALUE }, makeMult },
+  [ KEYWORD_HASH( 'd', 'v', 3 ) ] = { "div", 3, { ARG_VAR, ARG_VALUE, ARG_VALUE }, makeDiv },
+  [ KEYWORD_HASH( 'm', 'd', 3 ) ] = { "mod", 3, { ARG_VAR, ARG_VALUE, ARG_VALUE }, makeMod },
+  [ KEYWORD_HASH( 'e', 'q', 2 ) ] = { "eq", 3, { ARG_VAR, ARG_VALUE, ARG_VALUE }, makeEq },
+  [ KEYWORD_HASH( 'l', 's', 4 ) ] = { "less", 3, { ARG_VAR, ARG_VALUE, ARG_VALUE }, makeLess },
+  [ KEYWORD_HASH( 'g', 'o', 4 ) ] = { "goto", 1, { ARG_LABEL }, makeGoTo },
+  [ KEYWORD_HASH( 'i', 'f', 2 ) ] = { "if", 2, { ARG_VALUE, ARG_LABEL }, makeIf },
+  [ KEYWORD_HASH( 's', 'n', 5 ) ] = { "spawn", 1, { ARG_LABEL }, makeSpawn },
+  [ KEYWORD_HASH( 'j', 'n', 4 ) ] = { "join", 0, { 0 }, makeJoin },
+  [ KEYWORD_HASH( 'g', 'o', 2 ) ] = { "go", 1, { ARG_LABEL }, makeGo },
+  [ KEYWORD_HASH( 'y', 'd', 5 ) ] = { "yield", 0, { 0 }, makeYield },
+  [ KEYWORD_HASH( 'a', 'd', 10 ) ] = { "atomic_add", 3, { ARG_VAR, ARG_VAR, ARG_VALUE },
+                                       makeAtomicAdd },
+  [ KEYWORD_HASH( 'a', 'x', 10 ) ] = { "atomic_max", 3, { ARG_VAR, ARG_VAR, ARG_VALUE },
+                                       makeAtomicMax },
+  [ KEYWORD_HASH( 'c', 's', 3 ) ] = { "cas", 3, { ARG_VAR, ARG_VAR, ARG_VALUE }, makeCas },
+};
+
+/**
+  This function will find the description of a command from its name.
+  @param name the token with the command's name
+  @return the command's description, or NULL if there's no such command
+*/
+static CommandType const *findCommandType( Token const *name )
+{
+  CommandType const *type = &commandTypes[ KEYWORD_HASH( (unsigned char) name->text[ 0 ],
+                                                         (unsigned char) name->text[ name->len - 1 ],
+                                                         name->len ) ];
+  if ( type->name && tokenIs( name, type->name ) )
+    return type;
+  return NULL;
+}
 
 /**
   This function will parse commands from input.
   @param cmdName the name of the command
-  @param fp the FILE we are reading
-  @return the Command to execute
+  @param ctx the context we are reading from
+  @param symbols the symbol table to intern variable names in
+  @param arena the arena to allocate the command and its strings from
+  @return the Command to execute, or NULL if there's an error
 */
-Command *parseCommand( char *cmdName, FILE *fp )
+Command *parseCommand( Token const *cmdName, ParserContext *ctx, SymbolTable *symbols,
+                       Arena *arena )
 {
-  // Read the first token.
-  char tok1[MAX_TOKEN + 1];
-  
-  //Read the second token.
-  char tok2[MAX_TOKEN + 1];
-  
-  //Read the third token.
-  char tok3[MAX_TOKEN + 1];
-
   // Figure out what kind of command it is.
-  if (strcmp(cmdName, "print") == 0) {
-    // Parse the one argument to print.
-    expectToken( tok1, fp );
-    requireToken( ";", fp );
-    return makePrint( tok1 );
-  } else if (strcmp(cmdName, "set") == 0) {
-    //Parse two arguments to set.
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    requireToken(";", fp);
-    return makeSet(tok1, tok2);
-  } else if (strcmp(cmdName, "add") == 0) {
-    //Parse three arguments to be used in add.
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    expectToken(tok3, fp);
-    requireToken(";", fp);
-    return makeAdd(tok1, tok2, tok3);
-  } else if (strcmp(cmdName, "sub") == 0) {
-    //Parse three arguments to be used in subtract.
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    expectToken(tok3, fp);
-    requireToken(";", fp);
-    return makeSub(tok1, tok2, tok3);
-  } else if (strcmp(cmdName, "mult") == 0) {
-    //Parse three arguments to be used in multiply.
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    expectToken(tok3, fp);
-    requireToken(";", fp);
-    return makeMult(tok1, tok2, tok3);
-  } else if (strcmp(cmdName, "div") == 0) {
-    //Parse three arguments to be used in divide.
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    expectToken(tok3, fp);
-    requireToken(";", fp);
-    return makeDiv(tok1, tok2, tok3);
-  } else if (strcmp(cmdName, "mod") == 0) {
-    //Parse three arguments to be used in modular.
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    expectToken(tok3, fp);
-    requireToken(";", fp);
-    return makeMod(tok1, tok2, tok3);
-  } else if (strcmp(cmdName, "eq") == 0) {
-    //Parse three arguments to be used in equals.
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    expectToken(tok3, fp);
-    requireToken(";", fp);
-    return makeEq(tok1, tok2, tok3);
-  } else if (strcmp(cmdName, "less") == 0) {
-    //Parse three arguments to be used in less than.
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    expectToken(tok3, fp);
-    requireToken(";", fp);
-    return makeLess(tok1, tok2, tok3);
-  } else if (strcmp(cmdName, "goto") == 0) {
-    expectToken(tok1, fp);
-    requireToken(";", fp);
-    return makeGoTo(tok1);
-  } else if (strcmp(cmdName, "if") == 0) {
-    expectToken(tok1, fp);
-    expectToken(tok2, fp);
-    requireToken(";", fp);
-    return makeIf(tok1, tok2);
-  } else {
-    syntaxError();
+  CommandType const *type = findCommandType( cmdName );
+  if ( type == NULL ) {
+    syntaxError( ctx );
+    return NULL;
   }
 
-  // Never reached.
-  return NULL;
+  // Read its operands, then the semicolon at the end.
+  Token args[ MAX_ARGS ];
+  for ( int i = 0; i < type->arity; i++ ) {
+    bool ok = type->args[ i ] == ARG_VAR ? expectVariable( ctx, &args[ i ] )
+                                          : expectToken( ctx, &args[ i ] );
+    if ( !ok )
+      return NULL;
+  }
+  if ( !requireToken( ctx, ";" ) )
+    return NULL;
+
+  return type->make( args, symbols, arena, ctx );
 }
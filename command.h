@@ -10,6 +10,10 @@
 
 #include <stdio.h>
 #include "label.h"
+#include "var.h"
+#include "bytecode.h"
+#include "arena.h"
+#include "parse.h"
 
 /** It's weird, but you can give a short name to a struct before you define it.
     Then, you can use the short name in the definition. */
@@ -23,7 +27,7 @@ typedef struct CommandStruct Command;
 struct CommandStruct {
   /** Pointer to a function to execute this command.
       @param cmd The command to be executed.
-      @param labelMap Map for where all the labels are.
+      @param vars Values of all the variables in the running program.
       @param pc Index of the command being run (program counter), so
       this command can return the index of the next command.
       @return Index of the next instruction to run in the program (new
@@ -31,9 +35,25 @@ struct CommandStruct {
       the pc input, but on a branch, the program could jump to
       anywhere.
    */
-  int (*execute)( Command *cmd, LabelMap *labelMap, int pc );
+  int (*execute)( Command *cmd, VarStore *vars, int pc );
 
-  void (*destroy)(Command *cmd);
+  /** Pointer to a function that resolves any labels this command
+      uses into command indices, once the whole program has been read.
+      This is NULL for commands that don't use labels.
+      @param cmd The command to link.
+      @param labelMap Map for where all the labels are.
+      @param ctx Context to report an undefined label in.
+      @return False if a label isn't defined.
+   */
+  bool (*link)( Command *cmd, LabelMap *labelMap, ParserContext *ctx );
+
+  /** Pointer to a function that adds the bytecode for this command to
+      the end of the given code.  This is called after the program is
+      linked, so branch targets are already command indices.
+      @param cmd The command to compile.
+      @param code Code to add the instructions to.
+   */
+  void (*compile)( Command *cmd, Code *code );
 
   /** Source file line containing this command. Used for reporting errors. */
   int line;
@@ -41,9 +61,15 @@ struct CommandStruct {
 
 /** Parse the next command from the given input stream and return a
     pointer to Command object to represent it.
-    @param fp stream to parse the command from.
-    @return the Command object constructed from the input.
+    @param cmdName name of the command, already read from the input.
+    @param ctx context to parse the command from.
+    @param symbols symbol table where variable names are interned.
+    @param arena arena the command and its strings are allocated from.
+    They're freed along with the arena.
+    @return the Command object constructed from the input, or NULL if
+    there's an error.  The error is recorded in ctx.
 */
-Command *parseCommand( char *cmdName, FILE *fp );
+Command *parseCommand( Token const *cmdName, ParserContext *ctx, SymbolTable *symbols,
+                       Arena *arena );
 
 #endif
@@ -0,0 +1,372 @@
+/**
+  This file contains the run queue for coroutines started by the go
+  command.
+  @file coroutine.c
+  @author David Lovato, dalovato
+*/
+
+#include "coroutine.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "task.h"
+
+/** Variable slots that the code from some instruction on can use. */
+typedef struct {
+  /** Number of slots. */
+  int count;
+
+  /** The slots, in order. */
+  int slot[];
+} Slots;
+
+/** A coroutine, with room for its values after it. */
+typedef struct Coroutine {
+  /** Instruction to resume at. */
+  int pc;
+
+  /** Next coroutine in the run queue. */
+  struct Coroutine *next;
+
+  /** Slots the coroutine can use.  Nothing it runs touches any other
+      variable. */
+  Slots const *slots;
+
+  /** Tasks the coroutine spawned since its last join, while another
+      coroutine's tasks are the ones a join would merge. */
+  TaskList tasks;
+
+  /** The coroutine's value for each of its slots, while another
+      coroutine's values are in the variables.  This points just past
+      the coroutine itself. */
+  Value *saved;
+} Coroutine;
+
+/** Coroutines taking turns on one thread.  They all run with the same
+    variables, and the one whose turn it is has its values in the slots
+    it uses.  Every other slot it could use is left empty. */
+typedef struct Scheduler {
+  /** Program they're all running, and the function that runs it. */
+  void *program;
+  SliceRunner run;
+
+  /** The program as bytecode, to see which slots each one uses. */
+  Code *code;
+
+  /** Variables they all run with. */
+  VarStore *vars;
+
+  /** Run queue, from the next coroutine to run to the last. */
+  Coroutine *head;
+  Coroutine *tail;
+
+  /** The coroutine that's running, or NULL between turns. */
+  Coroutine *current;
+
+  /** The coroutine whose values are in the variables, or NULL. */
+  Coroutine *resident;
+
+  /** The first coroutine, with the caller's variables. */
+  Coroutine *first;
+
+  /** Slots used from each instruction, worked out the first time a
+      coroutine starts there. */
+  Slots **slotsAt;
+} Scheduler;
+
+/**
+  This function will find every variable slot that code could use,
+  starting from the given instruction and following every branch.
+  Shared counters aren't variables, so they aren't included.
+  @param code the code to look at
+  @param pc index of the instruction to start at
+  @param varCount number of variable slots
+  @return a new list of the slots
+*/
+static Slots *findSlots( Code *code, int pc, int varCount )
+{
+  bool *seen = (bool *) calloc( code->count + 1, sizeof( bool ) );
+  bool *used = (bool *) calloc( varCount ? varCount : 1, sizeof( bool ) );
+  int *stack = (int *) malloc( ( code->count + 1 ) * sizeof( int ) );
+  int top = 0;
+
+// Mark a variable operand as used.
+#define USE( x ) if ( !IS_LITERAL( x ) ) used[ x ] = true
+
+// Push an instruction we haven't seen yet.
+#define VISIT( i ) if ( ( i ) < code->count && !seen[ i ] ) seen[ stack[ top++ ] = ( i ) ] = true
+
+  VISIT( pc );
+  while ( top > 0 ) {
+    Instr *in = &code->instr[ stack[ --top ] ];
+    switch ( in->op ) {
+    case OP_PRINT:
+    case OP_IF:
+    case OP_INC:
+      USE( in->a );
+      break;
+    case OP_SET:
+      USE( in->a );
+      USE( in->b );
+      break;
+    case OP_ATOMIC_ADD:
+    case OP_ATOMIC_MAX:
+    case OP_CAS:
+      // Operand b is a counter.
+      USE( in->a );
+      USE( in->c );
+      break;
+    case OP_GOTO:
+    case OP_SPAWN:
+    case OP_JOIN:
+    case OP_GO:
+    case OP_YIELD:
+      break;
+    default:
+      USE( in->a );
+      USE( in->b );
+      USE( in->c );
+      break;
+    }
+
+    // Tasks and coroutines started from here run their code with our
+    // values, so a spawn or go counts as a branch.
+    int *target = jumpTarget( in );
+    if ( target )
+      VISIT( *target );
+    if ( in->op != OP_GOTO )
+      VISIT( (int) ( in - code->instr ) + 1 );
+  }
+
+#undef USE
+#undef VISIT
+
+  int count = 0;
+  for ( int i = 0; i < varCount; i++ )
+    count += used[ i ];
+  Slots *slots = (Slots *) malloc( sizeof( Slots ) + count * sizeof( int ) );
+  slots->count = 0;
+  for ( int i = 0; i < varCount; i++ )
+    if ( used[ i ] )
+      slots->slot[ slots->count++ ] = i;
+
+  free( stack );
+  free( used );
+  free( seen );
+  return slots;
+}
+
+/**
+  This function will make a coroutine that starts at the given
+  instruction.  Its saved values are all empty.
+  @param sched the scheduler it belongs to
+  @param pc index of the instruction to start at
+  @return the new coroutine
+*/
+static Coroutine *newCoroutine( Scheduler *sched, int pc )
+{
+  Slots *slots = sched->slotsAt[ pc ];
+  if ( slots == NULL )
+    slots = sched->slotsAt[ pc ] = findSlots( sched->code, pc, sched->vars->count );
+
+  Coroutine *co = (Coroutine *) malloc( sizeof( Coroutine ) + slots->count * sizeof( Value ) );
+  co->pc = pc;
+  co->slots = slots;
+  co->tasks.first = co->tasks.last = NULL;
+  co->saved = (Value *) ( co + 1 );
+  for ( int i = 0; i < slots->count; i++ ) {
+    co->saved[ i ].type = VAL_UNDEF;
+    co->saved[ i ].str = NULL;
+    co->saved[ i ].cap = 0;
+  }
+  return co;
+}
+
+/**
+  This function will move values between a coroutine's saved values and
+  the variables, leaving empty values behind.
+  @param sched the scheduler it belongs to
+  @param co the coroutine to move values for
+  @param out true to save the values from the variables, false to put
+  them back
+*/
+static void moveValues( Scheduler *sched, Coroutine *co, bool out )
+{
+  Value *vals = sched->vars->vals;
+  for ( int i = 0; i < co->slots->count; i++ ) {
+    Value *var = &vals[ co->slots->slot[ i ] ];
+    Value *from = out ? var : &co->saved[ i ];
+    Value *to = out ? &co->saved[ i ] : var;
+    *to = *from;
+    from->type = VAL_UNDEF;
+    from->str = NULL;
+    from->cap = 0;
+  }
+}
+
+/**
+  This function will free the values a coroutine has in the variables,
+  when it's done with them, and leave the slots empty.
+  @param sched the scheduler it belongs to
+  @param co the coroutine whose values are in the variables
+*/
+static void clearValues( Scheduler *sched, Coroutine *co )
+{
+  Value *vals = sched->vars->vals;
+  for ( int i = 0; i < co->slots->count; i++ ) {
+    Value *var = &vals[ co->slots->slot[ i ] ];
+    freeValue( var );
+    var->type = VAL_UNDEF;
+    var->str = NULL;
+    var->cap = 0;
+  }
+}
+
+/**
+  This function will put a coroutine's values and spawned tasks in the
+  variables, saving those of the coroutine that had them.
+  @param sched the scheduler it belongs to
+  @param co the coroutine about to run
+*/
+static void makeResident( Scheduler *sched, Coroutine *co )
+{
+  if ( sched->resident == co )
+    return;
+  if ( sched->resident ) {
+    moveValues( sched, sched->resident, true );
+    swapTasks( sched->vars, &sched->resident->tasks );
+  }
+  moveValues( sched, co, false );
+  swapTasks( sched->vars, &co->tasks );
+  sched->resident = co;
+}
+
+/**
+  This function will add a coroutine to the back of the run queue.
+  @param sched the scheduler to add to
+  @param co the coroutine to add
+*/
+static void enqueue( Scheduler *sched, Coroutine *co )
+{
+  co->next = NULL;
+  if ( sched->tail )
+    sched->tail->next = co;
+  else
+    sched->head = co;
+  sched->tail = co;
+}
+
+/**
+  This function will free a coroutine that isn't resident, along with
+  its saved values.  Tasks it never joined are left for whoever cleans
+  up after the error that stopped it.
+  @param sched the scheduler it belongs to
+  @param co the coroutine to free
+*/
+static void freeCoroutine( Scheduler *sched, Coroutine *co )
+{
+  for ( int i = 0; i < co->slots->count; i++ )
+    freeValue( &co->saved[ i ] );
+  keepTasks( sched->vars, &co->tasks );
+  free( co );
+}
+
+/**
+  This function will give turns to coroutines until they've all ended,
+  for catchError().
+  @param arg the Scheduler to run
+*/
+static void schedule( void *arg )
+{
+  Scheduler *sched = (Scheduler *) arg;
+  while ( sched->head ) {
+    Coroutine *co = sched->head;
+    sched->head = co->next;
+    if ( sched->head == NULL )
+      sched->tail = NULL;
+
+    makeResident( sched, co );
+    sched->current = co;
+    int pc = sched->run( sched->program, sched->vars, co->pc );
+
+    // A coroutine that ends joins its own tasks, since nothing else
+    // will.  The first one's tasks are the caller's to join.
+    if ( pc >= 0 && co != sched->first )
+      joinTasks( sched->vars );
+    sched->current = NULL;
+
+    if ( pc < 0 ) {
+      co->pc = RESUME_AT( pc );
+      enqueue( sched, co );
+    } else if ( co != sched->first ) {
+      // The first coroutine's values are the caller's, so they're kept.
+      clearValues( sched, co );
+      sched->resident = NULL;
+      free( co );
+    }
+  }
+}
+
+void runCoroutines( void *program, Code *code, VarStore *vars, int pc, SliceRunner run )
+{
+  Scheduler sched;
+  sched.program = program;
+  sched.run = run;
+  sched.code = code;
+  sched.vars = vars;
+  sched.head = sched.tail = sched.current = NULL;
+  sched.slotsAt = (Slots **) calloc( code->count + 1, sizeof( Slots * ) );
+
+  // The first coroutine already has its values in the variables.
+  sched.first = newCoroutine( &sched, pc );
+  sched.resident = sched.first;
+  enqueue( &sched, sched.first );
+  vars->sched = &sched;
+
+  // After an error, nothing else gets a turn.
+  bool ok = catchError( vars->out, schedule, &sched );
+  if ( sched.current && sched.current != sched.first ) {
+    clearValues( &sched, sched.current );
+    sched.resident = NULL;
+    free( sched.current );
+  }
+  while ( sched.head ) {
+    Coroutine *co = sched.head;
+    sched.head = co->next;
+    if ( co != sched.first )
+      freeCoroutine( &sched, co );
+  }
+
+  // Put back the first coroutine's values and tasks, if another one's
+  // are there.  Tasks left by the others after an error go along with
+  // the first one's, to be cleaned up by the caller.
+  if ( sched.resident != sched.first ) {
+    if ( sched.resident )
+      clearValues( &sched, sched.resident );
+    moveValues( &sched, sched.first, false );
+    swapTasks( vars, &sched.first->tasks );
+    keepTasks( vars, &sched.first->tasks );
+  }
+  free( sched.first );
+  for ( int i = 0; i <= code->count; i++ )
+    free( sched.slotsAt[ i ] );
+  free( sched.slotsAt );
+
+  vars->sched = NULL;
+  if ( !ok )
+    raiseError( vars->out );
+}
+
+void startCoroutine( VarStore *vars, int pc )
+{
+  Scheduler *sched = vars->sched;
+  Coroutine *co = newCoroutine( sched, pc );
+
+  // The new coroutine's slots are all ones the running coroutine can
+  // use, so it starts with copies of the running one's values.
+  for ( int i = 0; i < co->slots->count; i++ )
+    copyValue( &co->saved[ i ], &vars->vals[ co->slots->slot[ i ] ] );
+
+  enqueue( sched, co );
+}
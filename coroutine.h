@@ -0,0 +1,77 @@
+/**
+  @file coroutine.h
+  @author David Lovato, dalovato
+
+  Coroutines started by the go command, which take turns running on one
+  thread.  Each coroutine has its own copy of the variables, made when
+  it was started, and a change one coroutine makes is never seen by
+  another.  Coroutines only switch at a yield command, which puts the
+  running one at the back of the run queue and resumes the one at the
+  front.  A coroutine ends when it falls off the end of the program,
+  and its variables go away with it.  Shared counters are the same for
+  every coroutine, so that's how they can pass results around.
+
+  A coroutine only keeps values for the variables its code can use,
+  found by following every branch from where it starts.  A waiting
+  coroutine takes 32 bytes, plus 32 for each of those variables, so a
+  small loop is well under a few hundred bytes however many variables
+  the rest of the script has.  All the coroutines run with the same
+  variable storage: when they switch, the values of the one that was
+  running are moved out, and the next one's are moved in.
+
+  The code a program starts with is a coroutine too, and the program
+  keeps going until every coroutine has ended.  Each task from spawn has
+  its own run queue.  A join only merges the tasks the running coroutine
+  spawned, and a coroutine that ends joins any it hadn't joined yet.
+*/
+
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+#include "var.h"
+#include "bytecode.h"
+
+/** What a slice runner returns when the code yields before the
+    instruction at pc.  It's always negative, so it can't be mistaken for
+    an instruction index.
+    @param pc Instruction to resume at.
+*/
+#define YIELD_AT( pc ) ( -1 - ( pc ) )
+
+/** Instruction to resume at, given what a slice runner returned when
+    the code yielded.
+    @param r Value from YIELD_AT().
+*/
+#define RESUME_AT( r ) ( -1 - ( r ) )
+
+/** Function that runs a program from a given instruction until it
+    yields or falls off the end, for whichever engine is running it.
+    @param program The program, in whatever form the engine uses.
+    @param vars Variables of the coroutine to run.
+    @param pc Index of the instruction to start at.
+    @return YIELD_AT() the next instruction if the code yielded, or
+    anything that isn't negative if it ran off the end.
+*/
+typedef int (*SliceRunner)( void *program, VarStore *vars, int pc );
+
+/** Run a program from the given instruction, and every coroutine it
+    starts, until they've all ended.  Afterward, the variables hold the
+    values from the first coroutine.
+    @param program The program to run.
+    @param code The program as bytecode, with an instruction for each
+    place a coroutine can start or resume, to find the variables each
+    one uses.
+    @param vars Variables for the first coroutine.
+    @param pc Index of the instruction to start at.
+    @param run Function that runs the program until it yields.
+*/
+void runCoroutines( void *program, Code *code, VarStore *vars, int pc, SliceRunner run );
+
+/** Start a coroutine at the given instruction, with a copy of the
+    current variables.  It goes at the back of the run queue.
+    @param vars Variables of the coroutine starting the new one.
+    @param pc Index of the instruction the new coroutine starts at.
+*/
+void startCoroutine( VarStore *vars, int pc );
+
+#endif
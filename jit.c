@@ -0,0 +1,507 @@
+/**
+  This file contains the x86-64 JIT compiler.
+  @file jit.c
+  @author David Lovato, dalovato
+*/
+
+// MAP_ANONYMOUS isn't part of POSIX, so ask for the BSD/SysV extras.
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "output.h"
+
+#ifdef HAVE_JIT
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+/** Byte offset of a variable's type field from the start of the variable
+    array. */
+#define TYPE_OFF( slot ) ( (int) ( ( slot ) * sizeof( Value ) + offsetof( Value, type ) ) )
+
+/** Byte offset of a variable's numState field from the start of the
+    variable array. */
+#define STATE_OFF( slot ) ( (int) ( ( slot ) * sizeof( Value ) + offsetof( Value, numState ) ) )
+
+/** Byte offset of a variable's num field from the start of the variable
+    array. */
+#define NUM_OFF( slot ) ( (int) ( ( slot ) * sizeof( Value ) + offsetof( Value, num ) ) )
+
+/** Encode the slow-path stub for instruction i as a jump target, to tell
+    it apart from the native code for an instruction. */
+#define STUB( i ) ( -1 - ( i ) )
+
+/** Register numbers, as they're encoded in an instruction. */
+enum { RAX = 0, RCX = 1 };
+
+/** A 32-bit jump displacement that needs to be filled in once we know
+    where everything is. */
+typedef struct {
+  /** Offset of the displacement in the buffer. */
+  int pos;
+
+  /** Instruction the jump goes to, or STUB() for a slow path. */
+  int target;
+} Fixup;
+
+/** Buffer we generate machine code into, before it's copied to
+    executable memory. */
+typedef struct {
+  /** Bytes of machine code. */
+  unsigned char *buf;
+
+  /** Number of bytes generated so far. */
+  int len;
+
+  /** Capacity of buf. */
+  int cap;
+
+  /** Jumps waiting for their displacements. */
+  Fixup *fix;
+
+  /** Number of fixups. */
+  int fixCount;
+
+  /** Capacity of fix. */
+  int fixCap;
+} Asm;
+
+/**
+  This function will add bytes to the end of the buffer.
+  @param as the buffer
+  @param bytes the bytes to add
+  @param n number of bytes to add
+*/
+static void put( Asm *as, void const *bytes, int n )
+{
+  while ( as->len + n > as->cap ) {
+    as->cap *= GROWTH_RATE;
+    as->buf = (unsigned char *) realloc( as->buf, as->cap );
+  }
+  memcpy( as->buf + as->len, bytes, n );
+  as->len += n;
+}
+
+/**
+  This function will add up to four bytes of an instruction.
+  @param as the buffer
+  @param n number of bytes to add, from b0 on
+  @param b0 first byte
+  @param b1 second byte
+  @param b2 third byte
+  @param b3 fourth byte
+*/
+static void op( Asm *as, int n, int b0, int b1, int b2, int b3 )
+{
+  unsigned char b[] = { b0, b1, b2, b3 };
+  put( as, b, n );
+}
+
+/**
+  This function will add a 32-bit little-endian value.
+  @param as the buffer
+  @param v the value to add
+*/
+static void imm32( Asm *as, int32_t v )
+{
+  put( as, &v, sizeof( v ) );
+}
+
+/**
+  This function will add a 64-bit little-endian value.
+  @param as the buffer
+  @param v the value to add
+*/
+static void imm64( Asm *as, int64_t v )
+{
+  put( as, &v, sizeof( v ) );
+}
+
+/**
+  This function will add a 32-bit jump displacement to be filled in later.
+  @param as the buffer
+  @param target instruction to jump to, or STUB() for a slow path
+*/
+static void rel32( Asm *as, int target )
+{
+  if ( as->fixCount >= as->fixCap ) {
+    as->fixCap *= GROWTH_RATE;
+    as->fix = (Fixup *) realloc( as->fix, as->fixCap * sizeof( Fixup ) );
+  }
+  as->fix[ as->fixCount ].pos = as->len;
+  as->fix[ as->fixCount ].target = target;
+  as->fixCount++;
+  imm32( as, 0 );
+}
+
+/** jmp to the code for an instruction or a stub. */
+static void jmp( Asm *as, int target )
+{
+  op( as, 1, 0xE9, 0, 0, 0 );
+  rel32( as, target );
+}
+
+/** Conditional jump, cc is the low nibble of the 0F 8x opcode. */
+static void jcc( Asm *as, int cc, int target )
+{
+  op( as, 2, 0x0F, 0x80 | cc, 0, 0 );
+  rel32( as, target );
+}
+
+/** Condition codes for jcc and setcc. */
+enum { CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC };
+
+/**
+  This function will emit a call to stepCode() for instruction pc, leaving
+  the index of the next instruction in eax.
+  @param as the buffer
+  @param pc index of the instruction to run in the interpreter
+*/
+static void callStep( Asm *as, int pc )
+{
+  op( as, 3, 0x4C, 0x89, 0xE7, 0 );        // mov rdi, r12   (code)
+  op( as, 3, 0x4C, 0x89, 0xF6, 0 );        // mov rsi, r14   (vars)
+  op( as, 1, 0xBA, 0, 0, 0 );              // mov edx, pc
+  imm32( as, pc );
+  op( as, 2, 0x48, 0xB8, 0, 0 );           // mov rax, stepCode
+  imm64( as, (int64_t) (intptr_t) stepCode );
+  op( as, 2, 0xFF, 0xD0, 0, 0 );           // call rax
+}
+
+/**
+  This function will emit a jump to whatever instruction index is in eax,
+  through the table of native addresses in r13.
+  @param as the buffer
+*/
+static void jumpIndirect( Asm *as )
+{
+  op( as, 3, 0x48, 0x63, 0xC0, 0 );        // movsxd rax, eax
+  op( as, 4, 0x41, 0xFF, 0x64, 0xC5 );     // jmp [r13 + rax*8 + 0]
+  op( as, 1, 0x00, 0, 0, 0 );
+}
+
+/**
+  This function will report whether an operand can be loaded as an integer
+  by native code: either a variable, which is checked when it's loaded, or
+  a literal that's a valid number.
+  @param code the code the operand belongs to
+  @param x the operand
+  @return true if the operand can be loaded natively
+*/
+static bool nativeOperand( Code *code, int x )
+{
+  int64_t num;
+  return !IS_LITERAL( x ) || toNumber( &code->lits[ LITERAL_INDEX( x ) ], &num );
+}
+
+/**
+  This function will load an integer operand into a register.  For a
+  variable, the code branches to the instruction's slow path unless the
+  variable is an integer or a string that's already been converted to a
+  valid number.
+  @param as the buffer
+  @param code the code the operand belongs to
+  @param x the operand, which must pass nativeOperand()
+  @param reg RAX or RCX
+  @param pc index of the instruction, for its slow path
+*/
+static void loadOperand( Asm *as, Code *code, int x, int reg, int pc )
+{
+  if ( IS_LITERAL( x ) ) {
+    int64_t num;
+    toNumber( &code->lits[ LITERAL_INDEX( x ) ], &num );
+    op( as, 2, 0x48, 0xB8 + reg, 0, 0 );   // mov reg, imm64
+    imm64( as, num );
+    return;
+  }
+
+  op( as, 2, 0x83, 0xBB, 0, 0 );           // cmp dword [rbx + type], VAL_INT
+  imm32( as, TYPE_OFF( x ) );
+  op( as, 1, VAL_INT, 0, 0, 0 );
+  op( as, 2, 0x74, 26, 0, 0 );             // je over the next 26 bytes
+  op( as, 2, 0x83, 0xBB, 0, 0 );           // cmp dword [rbx + type], VAL_STR
+  imm32( as, TYPE_OFF( x ) );
+  op( as, 1, VAL_STR, 0, 0, 0 );
+  jcc( as, CC_NE, STUB( pc ) );
+  op( as, 2, 0x83, 0xBB, 0, 0 );           // cmp dword [rbx + state], NUM_VALID
+  imm32( as, STATE_OFF( x ) );
+  op( as, 1, NUM_VALID, 0, 0, 0 );
+  jcc( as, CC_NE, STUB( pc ) );
+  op( as, 3, 0x48, 0x8B, 0x83 | reg << 3, 0 ); // mov reg, [rbx + num]
+  imm32( as, NUM_OFF( x ) );
+}
+
+/**
+  This function will store rax into a variable, with the given type.
+  @param as the buffer
+  @param slot the variable to store into
+  @param type VAL_INT or VAL_BOOL
+*/
+static void storeResult( Asm *as, int slot, int type )
+{
+  op( as, 2, 0xC7, 0x83, 0, 0 );           // mov dword [rbx + type], type
+  imm32( as, TYPE_OFF( slot ) );
+  imm32( as, type );
+  op( as, 3, 0x48, 0x89, 0x83, 0 );        // mov [rbx + num], rax
+  imm32( as, NUM_OFF( slot ) );
+}
+
+/**
+  This function will generate native code for one instruction.
+  @param as the buffer
+  @param code the code being compiled
+  @param pc index of the instruction
+  @return true if the instruction needs a slow-path stub
+*/
+static bool compileInstr( Asm *as, Code *code, int pc )
+{
+  Instr *in = &code->instr[ pc ];
+
+  switch ( in->op ) {
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MULT:
+  case OP_DIV:
+  case OP_MOD:
+  case OP_EQ:
+  case OP_LESS:
+  case OP_LESS_IF:
+  case OP_EQ_IF:
+    if ( !nativeOperand( code, in->b ) || !nativeOperand( code, in->c ) )
+      break;
+
+    loadOperand( as, code, in->b, RAX, pc );
+    loadOperand( as, code, in->c, RCX, pc );
+
+    if ( in->op == OP_ADD ) {
+      op( as, 3, 0x48, 0x01, 0xC8, 0 );    // add rax, rcx
+      storeResult( as, in->a, VAL_INT );
+    } else if ( in->op == OP_SUB ) {
+      op( as, 3, 0x48, 0x29, 0xC8, 0 );    // sub rax, rcx
+      storeResult( as, in->a, VAL_INT );
+    } else if ( in->op == OP_MULT ) {
+      op( as, 4, 0x48, 0x0F, 0xAF, 0xC1 ); // imul rax, rcx
+      storeResult( as, in->a, VAL_INT );
+    } else if ( in->op == OP_DIV || in->op == OP_MOD ) {
+      // Let the interpreter report divide by zero, and handle -1 so
+      // the one quotient that overflows doesn't trap in here.
+      op( as, 3, 0x48, 0x85, 0xC9, 0 );    // test rcx, rcx
+      jcc( as, CC_E, STUB( pc ) );
+      op( as, 4, 0x48, 0x83, 0xF9, 0xFF ); // cmp rcx, -1
+      jcc( as, CC_E, STUB( pc ) );
+      op( as, 2, 0x48, 0x99, 0, 0 );       // cqo
+      op( as, 3, 0x48, 0xF7, 0xF9, 0 );    // idiv rcx
+      if ( in->op == OP_MOD )
+        op( as, 3, 0x48, 0x89, 0xD0, 0 );  // mov rax, rdx
+      storeResult( as, in->a, VAL_INT );
+    } else {
+      int cc = in->op == OP_LESS || in->op == OP_LESS_IF ? CC_L : CC_E;
+      op( as, 3, 0x48, 0x39, 0xC8, 0 );    // cmp rax, rcx
+      op( as, 3, 0x0F, 0x90 | cc, 0xC0, 0 ); // setcc al
+      op( as, 3, 0x0F, 0xB6, 0xC0, 0 );    // movzx eax, al
+      storeResult( as, in->a, VAL_BOOL );
+
+      if ( in->op == OP_LESS_IF || in->op == OP_EQ_IF ) {
+        // Branch the way the if after us would, then skip over it.
+        op( as, 2, 0x85, 0xC0, 0, 0 );     // test eax, eax
+        jcc( as, CC_NE, in[ 1 ].b );
+        jmp( as, pc + 2 );
+      }
+    }
+    return true;
+
+  case OP_INC:
+    op( as, 2, 0x83, 0xBB, 0, 0 );         // cmp dword [rbx + type], VAL_INT
+    imm32( as, TYPE_OFF( in->a ) );
+    op( as, 1, VAL_INT, 0, 0, 0 );
+    jcc( as, CC_NE, STUB( pc ) );
+    op( as, 3, 0x48, 0x81, 0x83, 0 );      // add qword [rbx + num], imm32
+    imm32( as, NUM_OFF( in->a ) );
+    imm32( as, in->c );
+    return true;
+
+  case OP_GOTO:
+    jmp( as, in->a );
+    return false;
+
+  case OP_IF:
+    if ( IS_LITERAL( in->a ) ) {
+      if ( isTrue( &code->lits[ LITERAL_INDEX( in->a ) ] ) )
+        jmp( as, in->b );
+      return false;
+    }
+
+    // Integers are always true, booleans are tested natively, and
+    // strings or undefined variables go to the slow path.
+    op( as, 2, 0x8B, 0x83, 0, 0 );         // mov eax, [rbx + type]
+    imm32( as, TYPE_OFF( in->a ) );
+    op( as, 3, 0x83, 0xF8, VAL_INT, 0 );   // cmp eax, VAL_INT
+    jcc( as, CC_E, in->b );
+    op( as, 3, 0x83, 0xF8, VAL_BOOL, 0 );  // cmp eax, VAL_BOOL
+    jcc( as, CC_NE, STUB( pc ) );
+    op( as, 3, 0x48, 0x83, 0xBB, 0 );      // cmp qword [rbx + num], 0
+    imm32( as, NUM_OFF( in->a ) );
+    op( as, 1, 0x00, 0, 0, 0 );
+    jcc( as, CC_NE, in->b );
+    return true;
+  }
+
+  // Everything else runs in the interpreter, then carries on with the
+  // next instruction, or wherever a compare-and-branch says to go.
+  callStep( as, pc );
+  if ( in->op == OP_LESS_IF || in->op == OP_EQ_IF )
+    jumpIndirect( as );
+  return false;
+}
+
+/** Native code to call, and its arguments, so it can run under
+    catchError(). */
+typedef struct {
+  /** Entry point of the generated code. */
+  void ( *entry )( Value *, Code *, VarStore *, void ** );
+
+  /** Code being run. */
+  Code *code;
+
+  /** Storage for the program's variables. */
+  VarStore *vars;
+
+  /** Native address for each instruction. */
+  void **labels;
+} JitRun;
+
+/**
+  This function will call the generated code.
+  @param arg the JitRun to call
+*/
+static void callNative( void *arg )
+{
+  JitRun *run = (JitRun *) arg;
+  run->entry( run->vars->vals, run->code, run->vars, run->labels );
+}
+
+bool runJit( Code *code, VarStore *vars )
+{
+  // The generated code compares the type and numState fields as 32-bit
+  // values.
+  if ( sizeof( ( (Value *) 0 )->type ) != 4 || sizeof( ( (Value *) 0 )->numState ) != 4 )
+    return false;
+
+  // Tasks and coroutines have to start at a label, and native code can
+  // only start at the top, so code that uses them stays in the
+  // interpreter.
+  for ( int pc = 0; pc < code->count; pc++ ) {
+    int op = code->instr[ pc ].op;
+    if ( op == OP_SPAWN || op == OP_JOIN || op == OP_GO || op == OP_YIELD )
+      return false;
+  }
+
+  Asm as;
+  as.len = 0;
+  as.cap = 256;
+  as.buf = (unsigned char *) malloc( as.cap );
+  as.fixCount = 0;
+  as.fixCap = INITIAL_CAPACITY;
+  as.fix = (Fixup *) malloc( as.fixCap * sizeof( Fixup ) );
+
+  // Native offset for each instruction, plus one for the exit, and for
+  // each instruction's slow-path stub if it has one.
+  int *offset = (int *) malloc( ( code->count + 1 ) * sizeof( int ) );
+  int *stub = (int *) malloc( ( code->count + 1 ) * sizeof( int ) );
+
+  // Prologue: save the callee-saved registers we use (which also leaves
+  // the stack aligned for calls), then keep the variable array in rbx,
+  // the code in r12, the address table in r13 and the store in r14.
+  op( &as, 1, 0x55, 0, 0, 0 );             // push rbp
+  op( &as, 1, 0x53, 0, 0, 0 );             // push rbx
+  op( &as, 2, 0x41, 0x54, 0, 0 );          // push r12
+  op( &as, 2, 0x41, 0x55, 0, 0 );          // push r13
+  op( &as, 2, 0x41, 0x56, 0, 0 );          // push r14
+  op( &as, 3, 0x48, 0x89, 0xFB, 0 );       // mov rbx, rdi
+  op( &as, 3, 0x49, 0x89, 0xF4, 0 );       // mov r12, rsi
+  op( &as, 3, 0x49, 0x89, 0xD6, 0 );       // mov r14, rdx
+  op( &as, 3, 0x49, 0x89, 0xCD, 0 );       // mov r13, rcx
+
+  bool *needStub = (bool *) malloc( ( code->count + 1 ) * sizeof( bool ) );
+  for ( int pc = 0; pc < code->count; pc++ ) {
+    offset[ pc ] = as.len;
+    needStub[ pc ] = compileInstr( &as, code, pc );
+  }
+
+  // Falling off the end of the program lands on the epilogue.
+  offset[ code->count ] = as.len;
+  op( &as, 2, 0x41, 0x5E, 0, 0 );          // pop r14
+  op( &as, 2, 0x41, 0x5D, 0, 0 );          // pop r13
+  op( &as, 2, 0x41, 0x5C, 0, 0 );          // pop r12
+  op( &as, 1, 0x5B, 0, 0, 0 );             // pop rbx
+  op( &as, 1, 0x5D, 0, 0, 0 );             // pop rbp
+  op( &as, 1, 0xC3, 0, 0, 0 );             // ret
+
+  // Slow paths run the whole instruction in the interpreter, then go
+  // wherever it says to.
+  for ( int pc = 0; pc < code->count; pc++ ) {
+    if ( needStub[ pc ] ) {
+      stub[ pc ] = as.len;
+      callStep( &as, pc );
+      jumpIndirect( &as );
+    }
+  }
+
+  // Now that everything has an address, fill in the jumps.
+  for ( int i = 0; i < as.fixCount; i++ ) {
+    int t = as.fix[ i ].target;
+    int dest = t >= 0 ? offset[ t ] : stub[ -1 - t ];
+    int32_t rel = dest - ( as.fix[ i ].pos + 4 );
+    memcpy( as.buf + as.fix[ i ].pos, &rel, sizeof( rel ) );
+  }
+
+  // Copy the code to memory we can execute.
+  void *mem = mmap( NULL, as.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0 );
+  bool ok = mem != MAP_FAILED;
+  bool failed = false;
+  if ( ok ) {
+    memcpy( mem, as.buf, as.len );
+    ok = mprotect( mem, as.len, PROT_READ | PROT_EXEC ) == 0;
+  }
+
+  if ( ok ) {
+    // Table of native addresses, for the slow paths' indirect jumps.
+    void **labels = (void **) malloc( ( code->count + 1 ) * sizeof( void * ) );
+    for ( int pc = 0; pc <= code->count; pc++ )
+      labels[ pc ] = (unsigned char *) mem + offset[ pc ];
+
+    // A runtime error jumps back out through the native code, which is
+    // fine since it doesn't keep anything on the stack that needs
+    // cleaning up.  Everything here does, though.
+    JitRun run = { ( void ( * )( Value *, Code *, VarStore *, void ** ) ) mem,
+                   code, vars, labels };
+    failed = !catchError( vars->out, callNative, &run );
+
+    free( labels );
+  }
+
+  if ( mem != MAP_FAILED )
+    munmap( mem, as.len );
+  free( needStub );
+  free( stub );
+  free( offset );
+  free( as.fix );
+  free( as.buf );
+
+  if ( failed )
+    raiseError( vars->out );
+  return ok;
+}
+
+#else
+
+bool runJit( Code *code, VarStore *vars )
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,33 @@
+/**
+  @file jit.h
+  @author David Lovato, dalovato
+
+  Baseline compiler from bytecode to native x86-64 code.  Integer
+  arithmetic, comparisons and branches run natively against the
+  variable array; anything else, or any operand that turns out not to
+  be an integer, falls back to the interpreter one instruction at a
+  time.
+*/
+
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include <stdbool.h>
+#include "bytecode.h"
+#include "var.h"
+
+/** The JIT only knows how to generate code for x86-64. */
+#if defined( __x86_64__ ) && !defined( NO_JIT )
+#define HAVE_JIT 1
+#endif
+
+/** Compile the given code to native code and run it.
+    @param code Code to run.
+    @param vars Storage for the program's variables.
+    @return False if the JIT isn't available on this machine, or the
+    code uses tasks or coroutines, in which case nothing was run and the
+    caller should use the interpreter.
+*/
+bool runJit( Code *code, VarStore *vars );
+
+#endif
@@ -6,46 +6,113 @@
   @author David Lovato
 */
 
+/**
+  This function will compute a hash code for a label name (FNV-1a).
+  @param name the name to hash
+  @param len the length of the name
+  @return the hash code for name
+*/
+static unsigned int hashName(char const *name, int len)
+{
+  unsigned int h = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    h ^= (unsigned char) name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/**
+  This function will find the bucket where the given name is, or the
+  empty bucket where it would go.
+  @param labelMap the map to search
+  @param name the label to look for, which doesn't need to be null terminated
+  @param len the length of the name
+  @return the index of the bucket
+*/
+static int findBucket(LabelMap *labelMap, char const *name, int len)
+{
+  int mask = labelMap->cap - 1;
+  int i = hashName(name, len) & mask;
+  while (labelMap->table[i].name != -1 &&
+         (strncmp(labelMap->names + labelMap->table[i].name, name, len) != 0 ||
+          labelMap->names[labelMap->table[i].name + len] != '\0')) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+/**
+  This function will allocate an empty hash table for the map.
+  @param labelMap the map to give a new table
+  @param cap number of buckets in the table
+*/
+static void makeTable(LabelMap *labelMap, int cap)
+{
+  labelMap->cap = cap;
+  labelMap->table = (LabelEntry *)malloc(cap * sizeof(LabelEntry));
+  for (int i = 0; i < cap; i++) {
+    labelMap->table[i].name = -1;
+  }
+}
+
 void initMap( LabelMap *labelMap )
 {
-  labelMap->cap = INITIAL_CAPACITY;
+  makeTable(labelMap, INITIAL_BUCKETS);
   labelMap->len = 0;
-  labelMap->labels = (char **)malloc(labelMap->cap * sizeof(char *));
-  labelMap->label_numbers = (int *)malloc(labelMap->cap * sizeof(int));
+  labelMap->namesLen = 0;
+  labelMap->namesCap = INITIAL_BUCKETS * INITIAL_CAPACITY;
+  labelMap->names = (char *)malloc(labelMap->namesCap);
 }
 
-void addLabel( LabelMap *labelMap, char *name, int loc )
+bool addLabel( LabelMap *labelMap, char const *name, int len, int loc )
 {
-  if (findLabel(labelMap, name) != -1) {
-    printf("Duplicate label: %s\n", name);
-    exit(1);
+  // Keep the table at most half full, so probe sequences stay short.
+  if ((labelMap->len + 1) * 2 > labelMap->cap) {
+    LabelEntry *old = labelMap->table;
+    int oldCap = labelMap->cap;
+    makeTable(labelMap, oldCap * GROWTH_RATE);
+    for (int i = 0; i < oldCap; i++) {
+      if (old[i].name != -1) {
+        char const *oldName = labelMap->names + old[i].name;
+        int b = findBucket(labelMap, oldName, strlen(oldName));
+        labelMap->table[b] = old[i];
+      }
+    }
+    free(old);
   }
-  if (labelMap->len >= labelMap->cap) {
-    labelMap->cap *= GROWTH_RATE;
-    labelMap->labels = (char **)realloc(labelMap->labels, labelMap->cap * sizeof(char *));
-    labelMap->label_numbers = (int *) realloc(labelMap->label_numbers, labelMap->cap * sizeof(int));
+
+  int b = findBucket(labelMap, name, len);
+  if (labelMap->table[b].name != -1) {
+    return false;
+  }
+
+  // Copy the name to the end of the arena.
+  while (labelMap->namesLen + len + 1 > labelMap->namesCap) {
+    labelMap->namesCap *= GROWTH_RATE;
+    labelMap->names = (char *)realloc(labelMap->names, labelMap->namesCap);
   }
-  labelMap->labels[labelMap->len] = (char *) malloc(MAX_TOKEN + 1);
-  strcpy(labelMap->labels[labelMap->len], name);
-  labelMap->label_numbers[labelMap->len] = loc;
+  memcpy(labelMap->names + labelMap->namesLen, name, len);
+  labelMap->names[labelMap->namesLen + len] = '\0';
+
+  labelMap->table[b].name = labelMap->namesLen;
+  labelMap->table[b].loc = loc;
+  labelMap->namesLen += len + 1;
   labelMap->len = labelMap->len + 1;
+  return true;
 }
 
 void freeMap(LabelMap *labelMap)
 {
-  for (int i = 0; i < labelMap->len; i++) {
-    free(labelMap->labels[i]);
-  }
-  free(labelMap->labels);
-  free(labelMap->label_numbers);
+  free(labelMap->table);
+  free(labelMap->names);
 }
 
-int findLabel(LabelMap *labelMap, char *name)
+int findLabel(LabelMap *labelMap, char const *name, int len)
 {
-  for (int i = 0; i < labelMap->len; i++) {
-    if (strcmp(labelMap->labels[i], name) == 0) {
-      return labelMap->label_numbers[i];
-    }
+  int b = findBucket(labelMap, name, len);
+  if (labelMap->table[b].name == -1) {
+    return -1;
   }
-  return -1;
+  return labelMap->table[b].loc;
 }
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 
 /** Initial capacity for resizable arrays. */
 #define INITIAL_CAPACITY 5
@@ -20,19 +21,42 @@
 // Maximum length of a token in the source file.
 #define MAX_TOKEN 1023
 
-/** Map from label names to locations in the code. */
+/** Number of buckets in a new label map's hash table.  This needs to
+    be a power of two. */
+#define INITIAL_BUCKETS 16
+
+/** One bucket in the label map's hash table. */
 typedef struct {
+  /** Offset of the label's name in the names arena, or -1 if this
+      bucket is empty. */
+  int name;
+
+  /** Command number for the label. */
+  int loc;
+} LabelEntry;
+
+/** Map from label names to locations in the code.  This is an
+    open-addressing hash table, with all the names packed one after
+    another in a single string arena. */
+typedef struct {
+
+  /** Hash table of labels, with linear probing. */
+  LabelEntry *table;
 
-  //Corresponding integer array containing the command number for
-  //each label at the same index of the label in the char array.
-  int *label_numbers;
-  
+  /** Number of buckets in the table, always a power of two. */
   int cap;
-  
+
+  /** Number of labels in the map. */
   int len;
-  
-  /** Pointer to pointers to char arrays which contain labels */
-  char **labels;
+
+  /** Arena holding the null-terminated names of all the labels. */
+  char *names;
+
+  /** Number of bytes used in the names arena. */
+  int namesLen;
+
+  /** Capacity of the names arena. */
+  int namesCap;
 
 } LabelMap;
 
@@ -41,22 +65,26 @@ typedef struct {
 */
 void initMap( LabelMap *labelMap );
 
-/** Add a label to the given labelMap.  Print an error message and
-    exit if the label is a duplicate.
+/** Add a label to the given labelMap, unless it's a duplicate.
     @param labelMap LabelMap to add a label to.
-    @param name Name of the label to add.
+    @param name Name of the label to add.  It doesn't need to be null
+    terminated.
+    @param len Length of the name.
     @param loc Location of the label in the code.
+    @return False if the label was already in the map.
 */
-void addLabel( LabelMap *labelMap, char *name, int loc );
+bool addLabel( LabelMap *labelMap, char const *name, int len, int loc );
 
 /**
-  This function will find the label's command number by searching through
-  the struct's label array, returning the command number to jump to.
+  This function will find the label's command number by looking it up
+  in the hash table, returning the command number to jump to.
   @param *labelMap, pointer to LabelMap
-  @param name, the label to search for
-  @return int, the command to jump to
+  @param name, the label to search for, which doesn't need to be null
+  terminated
+  @param len, the length of the name
+  @return int, the command to jump to, or -1 if there's no such label
 */
-int findLabel(LabelMap *labelMap, char *name);
+int findLabel(LabelMap *labelMap, char const *name, int len);
 
 /**
   This function will free all the dynamically allocated memory for the
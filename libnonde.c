@@ -0,0 +1,177 @@
+/**
+  This file contains the interface for running scripts inside another
+  program.
+  @file libnonde.c
+  @author David Lovato, dalovato
+*/
+
+#include "libnonde.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "program.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "output.h"
+
+/** Everything for one interpreter instance. */
+struct Nonde {
+  /** True if a script is loaded. */
+  bool loaded;
+
+  /** The loaded script. */
+  Program prog;
+
+  /** The script, compiled and optimized. */
+  Code code;
+
+  /** Values of the script's variables. */
+  VarStore vars;
+
+  /** Where the script's output goes. */
+  Output out;
+
+  /** Room for the text of a number, for nondeGetVar(). */
+  char number[ NUMBER_LEN ];
+
+  /** Message for the last error. */
+  char error[ MAX_ERROR + 1 ];
+};
+
+/** Status for each way loading a script can fail, indexed by
+    ParseStatus. */
+static NondeStatus const loadStatus[] = {
+  [ PARSE_OK ] = NONDE_OK,
+  [ PARSE_SYNTAX ] = NONDE_SYNTAX_ERROR,
+  [ PARSE_DUPLICATE_LABEL ] = NONDE_DUPLICATE_LABEL,
+  [ PARSE_UNDEFINED_LABEL ] = NONDE_UNDEFINED_LABEL
+};
+
+/**
+  This function will free the loaded script, if there is one.
+  @param nonde the instance to unload
+*/
+static void unload( Nonde *nonde )
+{
+  if ( !nonde->loaded )
+    return;
+
+  freeVars( &nonde->vars );
+  freeCode( &nonde->code );
+  freeProgram( &nonde->prog );
+  nonde->loaded = false;
+}
+
+/**
+  This function will find the slot for one of the loaded script's
+  variables.
+  @param nonde the instance with the script
+  @param name the name of the variable
+  @return the slot for the variable, or -1 if the script doesn't use it
+*/
+static int findVar( Nonde *nonde, char const *name )
+{
+  return findLabel( &nonde->prog.symbols.index, name, strlen( name ) );
+}
+
+Nonde *nondeCreate( void )
+{
+  Nonde *nonde = (Nonde *) malloc( sizeof( Nonde ) );
+  nonde->loaded = false;
+  initOutput( &nonde->out, NULL, NULL );
+  nonde->error[ 0 ] = '\0';
+  return nonde;
+}
+
+void nondeSetOutput( Nonde *nonde, NondeOutputFunc write, void *data )
+{
+  flushOutput( &nonde->out );
+  nonde->out.write = write;
+  nonde->out.data = data;
+}
+
+NondeStatus nondeLoad( Nonde *nonde, char const *buf, size_t len )
+{
+  unload( nonde );
+  nonde->error[ 0 ] = '\0';
+
+  ParserContext ctx;
+  openParserBuffer( &ctx, buf, len );
+  initProgram( &nonde->prog );
+  bool loaded = loadProgram( &nonde->prog, &ctx ) && linkProgram( &nonde->prog, &ctx );
+  closeParser( &ctx );
+  if ( !loaded ) {
+    snprintf( nonde->error, sizeof( nonde->error ), "%s", ctx.message );
+    freeProgram( &nonde->prog );
+    return loadStatus[ ctx.status ];
+  }
+
+  // The host can read any variable back once the script has run, so
+  // none of them are dead at the end.
+  compileOptimized( &nonde->prog, &nonde->code, true );
+  initVars( &nonde->vars, &nonde->prog.symbols, &nonde->out );
+  importEnvironment( &nonde->vars );
+  nonde->loaded = true;
+  return NONDE_OK;
+}
+
+NondeStatus nondeRun( Nonde *nonde )
+{
+  if ( !nonde->loaded )
+    return NONDE_NOT_LOADED;
+
+  bool ok = catchThreaded( &nonde->code, &nonde->vars );
+  flushOutput( &nonde->out );
+  if ( !ok ) {
+    snprintf( nonde->error, sizeof( nonde->error ), "%s", nonde->out.error );
+    return NONDE_RUNTIME_ERROR;
+  }
+  return NONDE_OK;
+}
+
+NondeStatus nondeSetVar( Nonde *nonde, char const *name, char const *value )
+{
+  if ( !nonde->loaded )
+    return NONDE_NOT_LOADED;
+
+  int slot = findVar( nonde, name );
+  if ( slot < 0 )
+    return NONDE_UNKNOWN_VARIABLE;
+
+  // setValue() makes its own copy of the text.
+  Value val;
+  initConst( &val, value );
+  setValue( &nonde->vars, slot, &val );
+  return NONDE_OK;
+}
+
+NondeStatus nondeGetVar( Nonde *nonde, char const *name, char const **value )
+{
+  if ( !nonde->loaded )
+    return NONDE_NOT_LOADED;
+
+  int slot = findVar( nonde, name );
+  if ( slot < 0 )
+    return NONDE_UNKNOWN_VARIABLE;
+
+  Value *val = getVar( &nonde->vars, slot );
+  if ( val->type == VAL_UNDEF )
+    return NONDE_UNDEFINED_VARIABLE;
+
+  *value = toText( val, nonde->number );
+  return NONDE_OK;
+}
+
+char const *nondeError( Nonde const *nonde )
+{
+  return nonde->error;
+}
+
+void nondeFree( Nonde *nonde )
+{
+  unload( nonde );
+  flushOutput( &nonde->out );
+  free( nonde );
+}
@@ -0,0 +1,117 @@
+/**
+  @file libnonde.h
+  @author David Lovato, dalovato
+
+  Interface for running nonde scripts inside another program.  Each
+  interpreter instance has its own program, variables and output, so
+  any number of them can be used at once, as long as each one is only
+  used by one thread at a time.  Nothing here exits the process; every
+  error comes back as a status code, with a message from nondeError().
+*/
+
+#ifndef _LIBNONDE_H_
+#define _LIBNONDE_H_
+
+#include <stddef.h>
+
+/** An interpreter instance. */
+typedef struct Nonde Nonde;
+
+/** Result of a call on an instance. */
+typedef enum {
+  /** Everything worked. */
+  NONDE_OK,
+
+  /** The script isn't valid. */
+  NONDE_SYNTAX_ERROR,
+
+  /** The script defines the same label twice. */
+  NONDE_DUPLICATE_LABEL,
+
+  /** The script jumps to a label it doesn't define. */
+  NONDE_UNDEFINED_LABEL,
+
+  /** The script stopped with an error while it was running. */
+  NONDE_RUNTIME_ERROR,
+
+  /** There's no script loaded to run. */
+  NONDE_NOT_LOADED,
+
+  /** The script doesn't use a variable with the given name. */
+  NONDE_UNKNOWN_VARIABLE,
+
+  /** The variable doesn't have a value. */
+  NONDE_UNDEFINED_VARIABLE
+} NondeStatus;
+
+/** Function that takes a script's output.
+    @param data Pointer given along with the function.
+    @param str Text the script printed.  It isn't null terminated.
+    @param len Number of bytes in the text.
+*/
+typedef void (*NondeOutputFunc)( void *data, char const *str, size_t len );
+
+/** Make a new interpreter instance, with no script loaded and output
+    going to standard output.
+    @return The new instance.
+*/
+Nonde *nondeCreate( void );
+
+/** Send a script's output to a function instead of standard output.
+    Output is buffered, and always passed on by the time nondeRun()
+    returns.
+    @param nonde Instance to change.
+    @param write Function to call with output, or NULL for standard
+    output.
+    @param data Pointer to pass to the function.
+*/
+void nondeSetOutput( Nonde *nonde, NondeOutputFunc write, void *data );
+
+/** Load a script, replacing any script that was loaded before.  Like
+    the nonde command, variables the script uses start out with their
+    values from the environment.
+    @param nonde Instance to load the script into.
+    @param buf Text of the script.  It isn't used after this returns.
+    @param len Number of bytes in the text.
+    @return NONDE_OK, or the reason the script couldn't be loaded.
+*/
+NondeStatus nondeLoad( Nonde *nonde, char const *buf, size_t len );
+
+/** Run the loaded script from the top.  Variables keep their values
+    from any earlier run.
+    @param nonde Instance to run.
+    @return NONDE_OK, NONDE_RUNTIME_ERROR or NONDE_NOT_LOADED.
+*/
+NondeStatus nondeRun( Nonde *nonde );
+
+/** Give one of the script's variables a value, before or between runs.
+    @param nonde Instance with the variable.
+    @param name Name of the variable.
+    @param value New text for the variable, which is copied.
+    @return NONDE_OK, NONDE_UNKNOWN_VARIABLE or NONDE_NOT_LOADED.
+*/
+NondeStatus nondeSetVar( Nonde *nonde, char const *name, char const *value );
+
+/** Get the value of one of the script's variables.
+    @param nonde Instance with the variable.
+    @param name Name of the variable.
+    @param value Set to the text of the variable.  It's only valid
+    until the next call on the instance.
+    @return NONDE_OK, NONDE_UNKNOWN_VARIABLE, NONDE_UNDEFINED_VARIABLE
+    or NONDE_NOT_LOADED.
+*/
+NondeStatus nondeGetVar( Nonde *nonde, char const *name, char const **value );
+
+/** Return a message for the last load or runtime error.
+    @param nonde Instance to check.
+    @return Message for the error, or an empty string if there hasn't
+    been one.
+*/
+char const *nondeError( Nonde const *nonde );
+
+/** Free an instance and everything it holds.
+    @param nonde Instance to free.
+*/
+void nondeFree( Nonde *nonde );
+
+#endif
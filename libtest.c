@@ -0,0 +1,92 @@
+/**
+  This file contains a small host program for libnonde, used by
+  test.sh to check the library the way an embedding program sees it.
+  @file libtest.c
+  @author David Lovato, dalovato
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libnonde.h"
+
+/**
+  This function will pass a script's output on to standard output.
+  @param data unused
+  @param str text the script printed
+  @param len number of bytes in the text
+*/
+static void writeOutput( void *data, char const *str, size_t len )
+{
+  fwrite( str, 1, len, stdout );
+}
+
+/**
+  This function will load a script from a string, reporting an error
+  if it doesn't load.
+  @param nonde the instance to load it into
+  @param script text of the script
+*/
+static void load( Nonde *nonde, char const *script )
+{
+  NondeStatus status = nondeLoad( nonde, script, strlen( script ) );
+  if ( status != NONDE_OK )
+    printf( "load: %d %s\n", status, nondeError( nonde ) );
+}
+
+/**
+  This function will print the value of a variable, or the status if
+  it can't be read.
+  @param nonde the instance with the variable
+  @param name the name of the variable
+*/
+static void show( Nonde *nonde, char const *name )
+{
+  char const *value;
+  NondeStatus status = nondeGetVar( nonde, name, &value );
+  if ( status == NONDE_OK )
+    printf( "%s = %s\n", name, value );
+  else
+    printf( "%s: status %d\n", name, status );
+}
+
+/** Starting point for the program
+    @return exit status
+*/
+int main( void )
+{
+  Nonde *nonde = nondeCreate();
+  nondeSetOutput( nonde, writeOutput, NULL );
+
+  // Variables the script never reads again are still there afterward.
+  load( nonde, "set result \"42\";\nadd total \"1\" \"2\";\nprint \"ran\\n\";\n" );
+  nondeRun( nonde );
+  show( nonde, "result" );
+  show( nonde, "total" );
+  show( nonde, "missing" );
+
+  // Variables keep their values from one run to the next.
+  load( nonde, "add n n \"1\";\n" );
+  show( nonde, "n" );
+  nondeSetVar( nonde, "n", "10" );
+  nondeRun( nonde );
+  nondeRun( nonde );
+  show( nonde, "n" );
+
+  // The division that traps on the hardware doesn't take the host down.
+  load( nonde, "div q x y;\nmod r x y;\n" );
+  nondeSetVar( nonde, "x", "-9223372036854775808" );
+  nondeSetVar( nonde, "y", "-1" );
+  nondeRun( nonde );
+  show( nonde, "q" );
+  show( nonde, "r" );
+
+  // Errors come back as a status, with a message.
+  nondeSetVar( nonde, "y", "0" );
+  if ( nondeRun( nonde ) == NONDE_RUNTIME_ERROR )
+    printf( "error: %s\n", nondeError( nonde ) );
+  load( nonde, "goto nowhere;\n" );
+
+  nondeFree( nonde );
+  return 0;
+}
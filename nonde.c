@@ -9,91 +9,87 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
 
 #include "command.h"
 #include "label.h"
 #include "parse.h"
+#include "var.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "optimize.h"
+#include "jit.h"
+#include "arena.h"
+#include "output.h"
+#include "cache.h"
+#include "program.h"
+#include "server.h"
+#include "batch.h"
+#include "rows.h"
+#include "shard.h"
+#include "task.h"
+#include "coroutine.h"
+#include "shared.h"
 
-/** Initial capacity for resizable arrays. */
-#define INITIAL_CAPACITY 5
+/** Ways we can run a program. */
+typedef enum {
+  /** Compile to bytecode and run it with direct-threaded dispatch. */
+  ENGINE_THREADED,
 
-/** Growth rate (multiplier) for resizable arrays. */
-#define GROWTH_RATE 2
+  /** Compile to bytecode and run it in the switch dispatch loop. */
+  ENGINE_SWITCH,
 
-/** Type used to represent a whole program, including a list of commands and
-    a record of where all the labels are. */
-typedef struct {
-  /** Sequence of all the commands in the program. */
-  Command **cmd;
-
-  /** Number of commands in the program. */
-  int count;
+  /** Call each Command object's execute method, one after another. */
+  ENGINE_OBJECTS
+} Engine;
 
-  /** Capacity of the command list, for resize behavior. */
-  int cap;
+/** What the objects engine runs. */
+typedef struct {
+  /** Program with the commands to run. */
+  Program *prog;
 
-  /** Label map, for the targets of if and goto. */
-  LabelMap labelMap;
-} Program;
+  /** The same program as plain bytecode, one instruction per command,
+      so coroutines can see which variables they use. */
+  Code code;
+} CommandRun;
 
-/** Print a short usage message, then exit. */
-static void usage()
+/**
+  This function will run a program's commands from the given one until
+  it yields or falls off the end, as a SliceRunner for the objects
+  engine.
+  @param program the CommandRun to run
+  @param vars the variables for the running coroutine
+  @param pc index of the command to start at
+  @return YIELD_AT() the next command, or the command count
+*/
+static int runSlice( void *program, VarStore *vars, int pc )
 {
-  fprintf( stderr, "usage: nonde <script>\n" );
-  exit( EXIT_FAILURE );
+  Program *prog = ( (CommandRun *) program )->prog;
+  while ( (unsigned) pc < (unsigned) prog->count )
+    pc = prog->cmd[ pc ]->execute( prog->cmd[ pc ], vars, pc );
+  return pc;
 }
 
-/** Initialize the given Program structure and read in the program
-    definition from the given file.
-    @param prog Program structure to populate.
-    @param fp File to read from.
+/**
+  This function will run a program's commands from the given one, along
+  with any coroutines they start, as a TaskRunner for the objects engine.
+  @param program the CommandRun to run
+  @param vars the variables for the running program
+  @param pc index of the command to start at
 */
-static void loadProgram( Program *prog, FILE *fp )
+static void runCommands( void *program, VarStore *vars, int pc )
 {
-  // Initialize the array of command pointers.
-  prog->count = 0;
-  prog->cap = INITIAL_CAPACITY;
-  prog->cmd = (Command **) malloc( prog->cap * sizeof( Command * ) );
-
-  // Initialize the labelMap structure in the program.
-  initMap( & prog->labelMap );
-
-  // One token of read-ahead, so we can tell what's next in the program.
-  char tok[ MAX_TOKEN + 1 ];
-  while ( parseToken( tok, fp ) ) {
-
-    // Is this token a label?
-    int tlen = strlen( tok );
-    if ( tok[ tlen - 1 ] == ':' ) {
-      // Throw away the : at the end, and put it in the map.
-      tok[ tlen - 1 ] = '\0';
-      if ( !isVarName( tok ) )
-        syntaxError();
-      addLabel( & prog->labelMap, tok, prog->count );
-    } else {
-      // If it's not a label, it must be a command.
-      Command *cmd = parseCommand( tok, fp );
-
-      // Enlarge the command list if needed, and store the new command.
-      if ( prog->count >= prog->cap ) {
-        prog->cap *= GROWTH_RATE;
-        prog->cmd = (Command **) realloc( prog->cmd, prog->cap * sizeof( Command * ) );
-      }
-      prog->cmd[ prog->count ++ ] = cmd;
-    }
-  }
+  runCoroutines( program, &( (CommandRun *) program )->code, vars, pc, runSlice );
 }
 
-/** Free memory for a program.
-    @param prog A pointer to the program we're supposed to free.
-*/
-static void freeProgram( Program *prog )
+/** Print a short usage message, then exit. */
+static void usage()
 {
-  for (int i = 0; i < prog->count; i++) {
-    prog->cmd[i]->destroy(prog->cmd[i]);
-  }
-  free( prog->cmd );
-  freeMap(&(prog->labelMap));
+  fprintf( stderr, "usage: nonde [--engine=threaded|switch|objects] [--jit] [--no-optimize] [--dump-bytecode] [--stats] [--flush=exit|line|<bytes>] [--output-thread] [--compile] [--connect <socket>] [--rows <csv> [--shards=<count>]] [--workers=<count>] <script>\n"
+           "       nonde --serve <socket> [--workers=<count>]\n"
+           "       nonde --batch <manifest> [--workers=<count>]\n" );
+  exit( EXIT_FAILURE );
 }
 
 /** Starting point for the program
@@ -103,28 +99,238 @@ static void freeProgram( Program *prog )
 */
 int main( int argc, char *argv[] )
 {
-  // Make sure we get one filename on the command line, and that we can open the file.
-  if ( argc != 2 )
+  // Sort out the options and the one script filename.
+  Engine engine = ENGINE_THREADED;
+  bool dump = false;
+  bool optimize = true;
+  bool jit = false;
+  bool stats = false;
+  bool outputThread = false;
+  bool compile = false;
+  int status = EXIT_SUCCESS;
+
+  // Like stdio, flush each line to a terminal, but otherwise only write
+  // when the buffer is full.
+  FlushPolicy flush = isatty( STDOUT_FILENO ) ? FLUSH_LINE : FLUSH_EXIT;
+  long flushSize = 0;
+  char *path = NULL;
+
+  // Sockets for daemon mode, and for running a script on a daemon.
+  char *serveSocket = NULL;
+  char *connectSocket = NULL;
+
+  // List of scripts for batch mode.
+  char *manifest = NULL;
+
+  // Input with a row of variable bindings for each run, and how many
+  // processes to split the rows across.
+  char *rowsPath = NULL;
+  long shards = 1;
+  long workers = sysconf( _SC_NPROCESSORS_ONLN );
+
+  for ( int i = 1; i < argc; i++ ) {
+    if ( strcmp( argv[ i ], "--engine=threaded" ) == 0 )
+      engine = ENGINE_THREADED;
+    else if ( strcmp( argv[ i ], "--engine=switch" ) == 0 )
+      engine = ENGINE_SWITCH;
+    else if ( strcmp( argv[ i ], "--engine=objects" ) == 0 )
+      engine = ENGINE_OBJECTS;
+    else if ( strcmp( argv[ i ], "--dump-bytecode" ) == 0 )
+      dump = true;
+    else if ( strcmp( argv[ i ], "--jit" ) == 0 )
+      jit = true;
+    else if ( strcmp( argv[ i ], "--no-optimize" ) == 0 )
+      optimize = false;
+    else if ( strcmp( argv[ i ], "--stats" ) == 0 )
+      stats = true;
+    else if ( strcmp( argv[ i ], "--serve" ) == 0 && i + 1 < argc )
+      serveSocket = argv[ ++i ];
+    else if ( strcmp( argv[ i ], "--connect" ) == 0 && i + 1 < argc )
+      connectSocket = argv[ ++i ];
+    else if ( strcmp( argv[ i ], "--batch" ) == 0 && i + 1 < argc )
+      manifest = argv[ ++i ];
+    else if ( strcmp( argv[ i ], "--rows" ) == 0 && i + 1 < argc )
+      rowsPath = argv[ ++i ];
+    else if ( strncmp( argv[ i ], "--shards=", 9 ) == 0 ) {
+      char *end;
+      shards = strtol( argv[ i ] + 9, &end, 10 );
+      if ( end == argv[ i ] + 9 || *end || shards <= 0 )
+        usage();
+    }
+    else if ( strncmp( argv[ i ], "--workers=", 10 ) == 0 ) {
+      char *end;
+      workers = strtol( argv[ i ] + 10, &end, 10 );
+      if ( end == argv[ i ] + 10 || *end || workers <= 0 )
+        usage();
+    }
+    else if ( strcmp( argv[ i ], "--compile" ) == 0 )
+      compile = true;
+    else if ( strcmp( argv[ i ], "--output-thread" ) == 0 )
+      outputThread = true;
+    else if ( strcmp( argv[ i ], "--flush=exit" ) == 0 )
+      flush = FLUSH_EXIT;
+    else if ( strcmp( argv[ i ], "--flush=line" ) == 0 )
+      flush = FLUSH_LINE;
+    else if ( strncmp( argv[ i ], "--flush=", 8 ) == 0 ) {
+      char *end;
+      flush = FLUSH_SIZE;
+      flushSize = strtol( argv[ i ] + 8, &end, 10 );
+      if ( end == argv[ i ] + 8 || *end || flushSize <= 0 )
+        usage();
+    }
+    else if ( argv[ i ][ 0 ] == '-' || path )
+      usage();
+    else
+      path = argv[ i ];
+  }
+
+  // A server doesn't take a script, it runs whatever it's sent.
+  if ( serveSocket ) {
+    if ( path || connectSocket || manifest || rowsPath )
+      usage();
+    return serve( serveSocket, workers > 0 ? workers : 1 );
+  }
+
+  // Neither does a batch, it runs the scripts in the manifest.
+  if ( manifest ) {
+    if ( path || connectSocket || rowsPath )
+      usage();
+    return runBatch( manifest, workers > 0 ? workers : 1 );
+  }
+
+  // Make sure we got a filename, and that we can open the file.  Only
+  // rows can be split into shards.
+  if ( path == NULL || ( shards > 1 && rowsPath == NULL ) )
     usage();
 
-  FILE *fp = fopen( argv[ 1 ], "r" );
-  if ( fp == NULL ) {
-    fprintf( stderr, "Can't open file: %s\n", argv[ 1 ] );
+  if ( connectSocket ) {
+    if ( rowsPath )
+      usage();
+    return runRemote( connectSocket, path );
+  }
+
+  ParserContext ctx;
+  if ( !openParser( &ctx, path ) ) {
+    fprintf( stderr, "Can't open file: %s\n", path );
     usage();
   }
 
-  // Make a program structure, and load it from the given file.
+  // A compiled copy of the script can be kept next to it.  It's only
+  // used if it was made from exactly the same text with the same
+  // optimize setting, and the objects engine always needs the parsed
+  // commands.
+  char *cachePath = (char *) malloc( strlen( path ) + strlen( CACHE_SUFFIX ) + 1 );
+  strcpy( cachePath, path );
+  strcat( cachePath, CACHE_SUFFIX );
+  uint64_t hash = hashSource( ctx.buf, ctx.size );
+
   Program prog;
-  loadProgram( &prog, fp );
-  fclose( fp );
+  initProgram( &prog );
+  Code code;
+  CacheFile cache;
+  bool cached = !compile && engine != ENGINE_OBJECTS &&
+    openCache( &cache, cachePath, hash, optimize, &code, &prog.symbols );
+
+  // Otherwise, load the program from the given file.  The program
+  // keeps copies of everything it needs from the tokens.
+  bool loaded = cached || ( loadProgram( &prog, &ctx ) && linkProgram( &prog, &ctx ) );
+  closeParser( &ctx );
+  if ( !loaded ) {
+    // Duplicate labels have always been reported on standard output.
+    fprintf( ctx.status == PARSE_DUPLICATE_LABEL ? stdout : stderr, "%s\n", ctx.message );
+    freeProgram( &prog );
+    free( cachePath );
+    exit( EXIT_FAILURE );
+  }
 
-  // Index of the current command.
-  int pc = 0;
+  // Tasks the script spawns are spread over the workers.
+  setTaskWorkers( workers > 0 ? workers : 1 );
 
-  // Run commands int he program until we reach the end (possibly
-  // looping as we run).
-  while ( pc < prog.count )
-    pc = prog.cmd[ pc ]->execute( prog.cmd[ pc ], & prog.labelMap, pc );
+  // Storage for all the variables the program uses.
+  VarStore vars;
+  // Everything the program prints goes to standard output.
+  Output out;
+  initOutput( &out, NULL, NULL );
+  setFlushPolicy( &out, flush, flushSize );
+  initVars( &vars, &prog.symbols, &out );
+  importEnvironment( &vars );
+
+  // Counters for the atomic commands, shared by tasks and by shards.
+  SharedCounters counters;
+  openShared( &counters, prog.symbols.count, rowsPath && shards > 1 );
+  vars.shared = counters.slots;
+
+  // If the thread won't start, we can still write output ourselves.
+  if ( outputThread && !startOutputThread( &out ) )
+    fprintf( stderr, "Can't start output thread, writing output directly\n" );
+
+  // Running over rows always needs bytecode.
+  if ( engine == ENGINE_OBJECTS && !dump && !compile && !rowsPath ) {
+    // Run commands in the program until we reach the end (possibly
+    // looping as we run).
+    CommandRun run = { &prog };
+    compileProgram( &prog, &run.code );
+    runTasks( &run, &vars, runCommands );
+    freeCode( &run.code );
+  } else {
+    if ( !cached )
+      compileProgram( &prog, &code );
+    int compiled = code.count;
+    DeadCodeStats removed = { 0, 0, 0 };
+    if ( optimize && !cached ) {
+      foldConstants( &code, prog.symbols.count );
+      eliminateDeadCode( &code, prog.symbols.count, false, &removed );
+      fuseInstructions( &code );
+    }
+
+    // The report goes to standard error, so it doesn't get mixed in
+    // with what the program prints.  Cached code was optimized when it
+    // was saved, so there's nothing to report about that.
+    if ( stats && cached )
+      fprintf( stderr, "%d instructions loaded from %s\n", code.count, cachePath );
+    else if ( stats && !optimize )
+      fprintf( stderr, "%d instructions compiled, not optimized\n", compiled );
+    else if ( stats )
+      fprintf( stderr, "%d instructions compiled, %d after optimizing; removed %d "
+               "unreachable, %d dead stores, %d jumps\n", compiled, code.count,
+               removed.unreachable, removed.deadStores, removed.jumps );
+
+    // With --compile, the code is saved instead of run.  The JIT falls
+    // back to the chosen engine if it can't run here.
+    if ( compile ) {
+      if ( !writeCache( cachePath, hash, optimize, &code, &prog.symbols ) ) {
+        fprintf( stderr, "Can't write compiled file: %s\n", cachePath );
+        status = EXIT_FAILURE;
+      }
+    } else if ( dump )
+      dumpCode( &code, &prog.symbols, stdout );
+    else if ( rowsPath ) {
+      if ( shards > 1 )
+        status = runShards( &code, &prog.symbols, rowsPath, shards, vars.shared, &out );
+      else
+        status = runRows( &code, &prog.symbols, rowsPath, vars.shared, &out );
+
+      // No one row sees the final counters, so they're reported at the
+      // end.  They go to standard error, so they don't get mixed in with
+      // the rows' own output.
+      printShared( &code, &prog.symbols, vars.shared, stderr );
+    }
+    else if ( jit && runJit( &code, &vars ) )
+      ;
+    else if ( engine == ENGINE_THREADED )
+      runThreaded( &code, &vars );
+    else
+      runCode( &code, &vars );
+
+    freeCode( &code );
+    if ( cached )
+      closeCache( &cache );
+  }
 
+  finishOutput( &out );
+  closeShared( &counters );
+  freeVars( &vars );
   freeProgram( &prog );
+  free( cachePath );
+  return status;
 }
@@ -0,0 +1,547 @@
+/**
+  This file contains the optimization passes over compiled bytecode.
+  @file optimize.c
+  @author David Lovato, dalovato
+*/
+
+#include "optimize.h"
+#include "cfg.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+
+/**
+  This function will find all the instructions that something branches to.
+  @param code the code to look at
+  @return an array with an entry for each instruction, true for the
+  branch targets.  The caller should free it.
+*/
+static bool *findTargets( Code *code )
+{
+  bool *target = (bool *) calloc( code->count + 1, sizeof( bool ) );
+  for ( int i = 0; i < code->count; i++ ) {
+    int *t = jumpTarget( &code->instr[ i ] );
+    if ( t )
+      target[ *t ] = true;
+  }
+  return target;
+}
+
+/**
+  This function will get the number for a literal operand, if it is one
+  and it fits in an instruction field.
+  @param code the code the operand belongs to
+  @param x the operand
+  @param num storage for the number
+  @return true if x is a literal with a usable numeric value
+*/
+static bool smallLiteral( Code *code, int x, int *num )
+{
+  int64_t val;
+  if ( !IS_LITERAL( x ) || !toNumber( &code->lits[ LITERAL_INDEX( x ) ], &val ) )
+    return false;
+
+  // Leave room to negate it for sub.
+  if ( val <= INT_MIN || val > INT_MAX )
+    return false;
+
+  *num = val;
+  return true;
+}
+
+/**
+  This function will merge a run of prints of literals, starting at
+  instruction i, into a single print.  The run stops at anything that
+  isn't a literal print, and before any instruction something jumps to.
+  @param code the code to modify
+  @param i index of the first print in the run
+  @param target which instructions are branch targets
+  @param dead storage to mark instructions that should be removed
+  @return index of the first instruction after the run
+*/
+static int mergePrints( Code *code, int i, bool const *target, bool *dead )
+{
+  int end = i + 1;
+  int len = 0;
+  while ( end < code->count && code->instr[ end ].op == OP_PRINT &&
+          IS_LITERAL( code->instr[ end ].a ) && !target[ end ] )
+    end++;
+
+  // Nothing to merge with.
+  if ( end == i + 1 )
+    return end;
+
+  // Literals from constant folding are numbers, so they need to be
+  // turned into text.
+  char buf[ NUMBER_LEN ];
+  for ( int j = i; j < end; j++ )
+    len += strlen( toText( &code->lits[ LITERAL_INDEX( code->instr[ j ].a ) ], buf ) );
+
+  char *text = (char *) malloc( len + 1 );
+  len = 0;
+  for ( int j = i; j < end; j++ ) {
+    char const *str = toText( &code->lits[ LITERAL_INDEX( code->instr[ j ].a ) ], buf );
+    strcpy( text + len, str );
+    len += strlen( str );
+    if ( j > i )
+      dead[ j ] = true;
+  }
+
+  code->instr[ i ].a = addLiteral( code, text );
+  free( text );
+
+  return end;
+}
+
+void fuseInstructions( Code *code )
+{
+  bool *target = findTargets( code );
+  bool *dead = (bool *) calloc( code->count + 1, sizeof( bool ) );
+
+  int i = 0;
+  while ( i < code->count ) {
+    Instr *in = &code->instr[ i ];
+    Instr *next = i + 1 < code->count ? &code->instr[ i + 1 ] : NULL;
+    int num;
+
+    if ( ( in->op == OP_LESS || in->op == OP_EQ ) &&
+         next && next->op == OP_IF && next->a == in->a ) {
+      // Compare-and-branch.  The if stays where it is, both to hold the
+      // target and so anything that jumps straight to it still works.
+      in->op = in->op == OP_LESS ? OP_LESS_IF : OP_EQ_IF;
+      i += 2;
+    } else if ( ( in->op == OP_ADD || in->op == OP_SUB ) && in->b == in->a &&
+                smallLiteral( code, in->c, &num ) ) {
+      // In-place increment (or decrement) by a constant.
+      in->c = in->op == OP_ADD ? num : -num;
+      in->op = OP_INC;
+      i++;
+    } else if ( in->op == OP_PRINT && IS_LITERAL( in->a ) ) {
+      i = mergePrints( code, i, target, dead );
+    } else {
+      i++;
+    }
+  }
+
+  removeInstructions( code, dead );
+  free( dead );
+  free( target );
+}
+
+/**
+  This function will work out the result of an arithmetic or comparison
+  instruction on two literals, adding it to the literal pool.  It gives
+  up on anything that would be an error when the program runs, so the
+  instruction can stay in place and report it.
+  @param code the code the instruction belongs to
+  @param in the instruction, with literals for both of its operands
+  @param result storage for the operand for the result
+  @return true if the instruction could be folded
+*/
+static bool foldInstruction( Code *code, Instr const *in, int *result )
+{
+  int64_t x, y;
+  if ( !toNumber( &code->lits[ LITERAL_INDEX( in->b ) ], &x ) ||
+       !toNumber( &code->lits[ LITERAL_INDEX( in->c ) ], &y ) )
+    return false;
+
+  // Do the arithmetic unsigned, so overflow wraps the same way it does
+  // when the program runs instead of being undefined here.
+  uint64_t ux = x, uy = y;
+  switch ( in->op ) {
+  case OP_ADD:
+    *result = addConstant( code, VAL_INT, (int64_t) ( ux + uy ) );
+    return true;
+  case OP_SUB:
+    *result = addConstant( code, VAL_INT, (int64_t) ( ux - uy ) );
+    return true;
+  case OP_MULT:
+    *result = addConstant( code, VAL_INT, (int64_t) ( ux * uy ) );
+    return true;
+  case OP_DIV:
+  case OP_MOD:
+    if ( y == 0 )
+      return false;
+
+    // Dividing by -1 negates, with the same wrapping as at run time,
+    // since INT64_MIN / -1 would trap.
+    if ( y == -1 )
+      *result = addConstant( code, VAL_INT, in->op == OP_DIV ? (int64_t) ( 0 - ux ) : 0 );
+    else
+      *result = addConstant( code, VAL_INT, in->op == OP_DIV ? x / y : x % y );
+    return true;
+  case OP_EQ:
+    *result = addConstant( code, VAL_BOOL, x == y );
+    return true;
+  case OP_LESS:
+    *result = addConstant( code, VAL_BOOL, x < y );
+    return true;
+  default:
+    return false;
+  }
+}
+
+void foldConstants( Code *code, int varCount )
+{
+  bool *target = findTargets( code );
+  bool *dead = (bool *) calloc( code->count + 1, sizeof( bool ) );
+
+  // The literal each variable is known to hold, or zero if we don't
+  // know.  An entry only counts if its block number is the current
+  // one, so starting a new block forgets everything at once.
+  int *known = (int *) calloc( varCount ? varCount : 1, sizeof( int ) );
+  int *knownBlock = (int *) calloc( varCount ? varCount : 1, sizeof( int ) );
+  int block = 1;
+
+  // Replace a variable operand with its value, if we know it.
+#define PROPAGATE( x ) \
+  if ( !IS_LITERAL( x ) && knownBlock[ x ] == block && known[ x ] ) ( x ) = known[ x ]
+
+  // Record what an instruction stored in a variable, a literal or zero.
+#define RECORD( slot, lit ) \
+  ( known[ slot ] = ( lit ), knownBlock[ slot ] = block )
+
+  for ( int i = 0; i < code->count; i++ ) {
+    Instr *in = &code->instr[ i ];
+
+    // Anything could be in the variables when we get here by a jump.
+    // That includes the start, since variables can come from the
+    // environment.
+    if ( target[ i ] )
+      block++;
+
+    switch ( in->op ) {
+    case OP_PRINT:
+      PROPAGATE( in->a );
+      break;
+
+    case OP_SET:
+      PROPAGATE( in->b );
+      RECORD( in->a, IS_LITERAL( in->b ) ? in->b : 0 );
+      break;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MULT:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_EQ:
+    case OP_LESS: {
+      PROPAGATE( in->b );
+      PROPAGATE( in->c );
+
+      int result;
+      if ( IS_LITERAL( in->b ) && IS_LITERAL( in->c ) &&
+           foldInstruction( code, in, &result ) ) {
+        in->op = OP_SET;
+        in->b = result;
+        in->c = 0;
+        RECORD( in->a, result );
+      } else {
+        RECORD( in->a, 0 );
+      }
+      break;
+    }
+
+    case OP_GOTO:
+      // What follows is only reached by a jump.
+      block++;
+      break;
+
+    case OP_SPAWN:
+    case OP_GO:
+      // The task or coroutine starts at a target, and the code here
+      // goes on with the same variables.
+      break;
+
+    case OP_YIELD:
+      // Other coroutines have their own variables, so ours are the
+      // same when we get back.
+      break;
+
+    case OP_JOIN:
+      // Tasks can change any variable when they're merged.
+      block++;
+      break;
+
+    case OP_ATOMIC_ADD:
+    case OP_ATOMIC_MAX:
+    case OP_CAS:
+      // Operand b is a counter, and another worker can change it at
+      // any time, so all we know is the value going in.
+      PROPAGATE( in->c );
+      RECORD( in->a, 0 );
+      break;
+
+    case OP_IF:
+      PROPAGATE( in->a );
+      if ( IS_LITERAL( in->a ) ) {
+        // The branch always goes the same way.
+        if ( isTrue( &code->lits[ LITERAL_INDEX( in->a ) ] ) ) {
+          in->op = OP_GOTO;
+          in->a = in->b;
+          in->b = 0;
+          block++;
+        } else {
+          dead[ i ] = true;
+        }
+      }
+      break;
+
+    default:
+      // Superinstructions shouldn't be here yet, but they all store
+      // something we don't know in variable a.
+      RECORD( in->a, 0 );
+      break;
+    }
+  }
+
+#undef PROPAGATE
+#undef RECORD
+
+  removeInstructions( code, dead );
+  free( knownBlock );
+  free( known );
+  free( dead );
+  free( target );
+}
+
+/**
+  This function will find the variables an instruction reads.
+  @param in the instruction
+  @param reads storage for up to two variable slots
+  @return the number of slots stored in reads
+*/
+static int readsOf( Instr const *in, int *reads )
+{
+  int n = 0;
+  switch ( in->op ) {
+  case OP_PRINT:
+  case OP_IF:
+  case OP_INC:
+    if ( !IS_LITERAL( in->a ) )
+      reads[ n++ ] = in->a;
+    break;
+  case OP_SET:
+    if ( !IS_LITERAL( in->b ) )
+      reads[ n++ ] = in->b;
+    break;
+  case OP_ATOMIC_ADD:
+  case OP_ATOMIC_MAX:
+    // Operand b is a counter rather than a variable.
+    if ( !IS_LITERAL( in->c ) )
+      reads[ n++ ] = in->c;
+    break;
+  case OP_CAS:
+    reads[ n++ ] = in->a;
+    if ( !IS_LITERAL( in->c ) )
+      reads[ n++ ] = in->c;
+    break;
+  case OP_GOTO:
+  case OP_SPAWN:
+  case OP_JOIN:
+  case OP_GO:
+  case OP_YIELD:
+    break;
+  default:
+    // Everything else reads two values.
+    if ( !IS_LITERAL( in->b ) )
+      reads[ n++ ] = in->b;
+    if ( !IS_LITERAL( in->c ) )
+      reads[ n++ ] = in->c;
+    break;
+  }
+  return n;
+}
+
+/**
+  This function will return the variable an instruction stores into.
+  @param in the instruction
+  @return the variable's slot, or -1 if it doesn't store anything
+*/
+static int writeOf( Instr const *in )
+{
+  if ( in->op == OP_PRINT || in->op == OP_GOTO || in->op == OP_IF ||
+       in->op == OP_SPAWN || in->op == OP_JOIN || in->op == OP_GO || in->op == OP_YIELD )
+    return -1;
+  return in->a;
+}
+
+/**
+  This function will update the set of live variables for the point just
+  before an instruction, given the set for the point after it.
+  @param in the instruction
+  @param live bitset of live variables, modified in place
+*/
+static void stepLiveness( Instr const *in, uint64_t *live )
+{
+  int w = writeOf( in );
+  if ( w >= 0 )
+    live[ w / 64 ] &= ~( (uint64_t) 1 << ( w % 64 ) );
+
+  int reads[ 2 ];
+  int n = readsOf( in, reads );
+  for ( int i = 0; i < n; i++ )
+    live[ reads[ i ] / 64 ] |= (uint64_t) 1 << ( reads[ i ] % 64 );
+}
+
+/**
+  This function will return true if a block can run off the end of the
+  program.
+  @param code the code the block is in
+  @param cfg the code's control-flow graph
+  @param b index of the block
+  @return true if the program can end right after the block
+*/
+static bool reachesEnd( Code *code, Cfg const *cfg, int b )
+{
+  Instr *last = &code->instr[ cfg->blocks[ b ].end - 1 ];
+  int *t = jumpTarget( last );
+  if ( t && *t >= code->count )
+    return true;
+  return last->op != OP_GOTO && cfg->blocks[ b ].end >= code->count;
+}
+
+/**
+  This function will mark the stores in reachable code that nothing will
+  ever read.  Only stores that can't fail are marked, so removing them
+  can't hide an error the program would have reported.
+  @param code the code to look at
+  @param cfg the code's control-flow graph
+  @param reached which blocks are reachable
+  @param varCount number of variable slots
+  @param keepVars true if every variable is looked at after the program
+  ends
+  @param dead storage to mark instructions that should be removed
+  @return the number of stores marked
+*/
+static int findDeadStores( Code *code, Cfg const *cfg, bool const *reached, int varCount,
+                           bool keepVars, bool *dead )
+{
+  // Bitsets of the variables live on entry to each block.
+  int words = ( varCount + 63 ) / 64;
+  if ( words == 0 )
+    words = 1;
+  uint64_t *liveIn = (uint64_t *) calloc( (size_t) cfg->count * words, sizeof( uint64_t ) );
+  uint64_t *live = (uint64_t *) malloc( words * sizeof( uint64_t ) );
+
+  // A task's variables are all looked at when it's joined, and a task
+  // ends by running off the end of the program.
+  bool liveAtEnd = keepVars;
+  for ( int i = 0; i < code->count; i++ )
+    liveAtEnd = liveAtEnd || code->instr[ i ].op == OP_SPAWN;
+
+  // Variables live on exit from block b are the ones live on entry to
+  // any of its successors.
+#define LIVE_OUT( b ) \
+  do { \
+    memset( live, liveAtEnd && reachesEnd( code, cfg, b ) ? 0xFF : 0, \
+            words * sizeof( uint64_t ) ); \
+    for ( int s = 0; s < cfg->blocks[ b ].succCount; s++ ) \
+      for ( int w = 0; w < words; w++ ) \
+        live[ w ] |= liveIn[ (size_t) cfg->blocks[ b ].succ[ s ] * words + w ]; \
+  } while ( 0 )
+
+  // Keep sweeping backward until nothing changes.
+  bool changed = true;
+  while ( changed ) {
+    changed = false;
+    for ( int b = cfg->count - 1; b >= 0; b-- ) {
+      if ( !reached[ b ] )
+        continue;
+
+      LIVE_OUT( b );
+      for ( int i = cfg->blocks[ b ].end - 1; i >= cfg->blocks[ b ].start; i-- )
+        stepLiveness( &code->instr[ i ], live );
+
+      uint64_t *in = liveIn + (size_t) b * words;
+      if ( memcmp( in, live, words * sizeof( uint64_t ) ) != 0 ) {
+        memcpy( in, live, words * sizeof( uint64_t ) );
+        changed = true;
+      }
+    }
+  }
+
+  // Now find stores of literals into variables that aren't live after.
+  int count = 0;
+  for ( int b = 0; b < cfg->count; b++ ) {
+    if ( !reached[ b ] )
+      continue;
+
+    LIVE_OUT( b );
+    for ( int i = cfg->blocks[ b ].end - 1; i >= cfg->blocks[ b ].start; i-- ) {
+      Instr const *in = &code->instr[ i ];
+      if ( in->op == OP_SET && IS_LITERAL( in->b ) &&
+           !( live[ in->a / 64 ] & ( (uint64_t) 1 << ( in->a % 64 ) ) ) ) {
+        dead[ i ] = true;
+        count++;
+      } else {
+        stepLiveness( in, live );
+      }
+    }
+  }
+
+#undef LIVE_OUT
+
+  free( live );
+  free( liveIn );
+  return count;
+}
+
+void eliminateDeadCode( Code *code, int varCount, bool keepVars, DeadCodeStats *stats )
+{
+  stats->unreachable = 0;
+  stats->deadStores = 0;
+  stats->jumps = 0;
+
+  // Removing some instructions can make others dead, so repeat until
+  // there's nothing left to remove.
+  bool removed = true;
+  while ( removed ) {
+    Cfg cfg;
+    buildCfg( &cfg, code );
+    bool *reached = findReachable( &cfg );
+    bool *dead = (bool *) calloc( code->count + 1, sizeof( bool ) );
+    int count = 0;
+
+    // Blocks nothing can get to.
+    for ( int b = 0; b < cfg.count; b++ ) {
+      if ( !reached[ b ] ) {
+        for ( int i = cfg.blocks[ b ].start; i < cfg.blocks[ b ].end; i++ )
+          dead[ i ] = true;
+        stats->unreachable += cfg.blocks[ b ].end - cfg.blocks[ b ].start;
+        count += cfg.blocks[ b ].end - cfg.blocks[ b ].start;
+      }
+    }
+
+    // Gotos that just go to the next instruction that's kept.
+    for ( int i = 0; i < code->count; i++ ) {
+      if ( dead[ i ] || code->instr[ i ].op != OP_GOTO )
+        continue;
+      int next = i + 1;
+      while ( next < code->count && dead[ next ] )
+        next++;
+      int target = code->instr[ i ].a;
+      while ( target < code->count && dead[ target ] )
+        target++;
+      if ( target == next ) {
+        dead[ i ] = true;
+        stats->jumps++;
+        count++;
+      }
+    }
+
+    int stores = findDeadStores( code, &cfg, reached, varCount, keepVars, dead );
+    stats->deadStores += stores;
+    count += stores;
+
+    removed = count > 0;
+    if ( removed )
+      removeInstructions( code, dead );
+
+    free( dead );
+    free( reached );
+    freeCfg( &cfg );
+  }
+}
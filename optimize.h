@@ -0,0 +1,62 @@
+/**
+  @file optimize.h
+  @author David Lovato, dalovato
+
+  Optimization passes that run over a program's bytecode after it's
+  compiled.  Every pass keeps the observable behaviour of the program
+  the same, including which errors it reports and on what line.
+*/
+
+#ifndef _OPTIMIZE_H_
+#define _OPTIMIZE_H_
+
+#include "bytecode.h"
+
+/** How much dead code elimination removed. */
+typedef struct {
+  /** Instructions that could never run. */
+  int unreachable;
+
+  /** Stores to variables that were never read afterward. */
+  int deadStores;
+
+  /** Gotos to the instruction right after them. */
+  int jumps;
+} DeadCodeStats;
+
+/** Peephole pass that replaces common instruction sequences with
+    superinstructions: a less or eq followed by an if on its result
+    becomes a compare-and-branch, adding or subtracting a literal number
+    from a variable in place becomes an increment, and runs of prints of
+    literals are merged into a single print.
+    @param code Code to optimize.
+*/
+void fuseInstructions( Code *code );
+
+/** Constant propagation and folding.  Within straight-line code
+    between branch targets, variables that are known to hold a literal
+    are replaced by that literal, arithmetic and comparisons on
+    literals are worked out ahead of time, and an if on a known value
+    becomes a goto or disappears.  Anything that would report an error
+    when it runs, like dividing by zero, is left alone.  This needs to
+    run before fuseInstructions().
+    @param code Code to optimize.
+    @param varCount Number of variable slots the code uses.
+*/
+void foldConstants( Code *code, int varCount );
+
+/** Dead code elimination, using the control-flow graph.  This removes
+    code that can't be reached from the start of the program, gotos
+    that go to the next instruction anyway, and stores of literals into
+    variables that aren't read again on any path before they're
+    overwritten.  Stores that could report an error are kept.  This
+    runs before fuseInstructions(), so it sees plain compares and ifs.
+    @param code Code to optimize.
+    @param varCount Number of variable slots the code uses.
+    @param keepVars True if the variables are looked at after the
+    program ends, so every one of them is live there.
+    @param stats Filled in with how much was removed.
+*/
+void eliminateDeadCode( Code *code, int varCount, bool keepVars, DeadCodeStats *stats );
+
+#endif
@@ -0,0 +1,395 @@
+/**
+  This file contains the buffered output layer.
+  @file output.c
+  @author David Lovato, dalovato
+*/
+
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "label.h"
+
+/** Atomic load and store for the ring buffer indices.  Everything uses
+    sequential consistency, since each side stores its own index and
+    then reads the other side's sleeping flag (or the other way around),
+    and those can't be reordered. */
+#define LOAD( x ) __atomic_load_n( &( x ), __ATOMIC_SEQ_CST )
+#define STORE( x, v ) __atomic_store_n( &( x ), ( v ), __ATOMIC_SEQ_CST )
+
+/** Ring buffer for handing output to the writer thread.  The
+    interpreter is the only one that moves head, and the writer is the
+    only one that moves tail, so the text itself is passed without
+    locking.  The mutex and condition variables are just for one side to
+    sleep when it has to wait on the other. */
+struct OutputRing {
+  /** Output the thread is writing for. */
+  Output *out;
+
+  /** The writer thread. */
+  pthread_t thread;
+
+  /** Storage for the ring. */
+  char *data;
+
+  /** Total bytes ever added to the ring.  The next byte goes at head
+      modulo the ring size. */
+  size_t head;
+
+  /** Total bytes ever written out by the thread. */
+  size_t tail;
+
+  /** Value of head the last time the writer was woken up. */
+  size_t handedOff;
+
+  /** Set when the writer is waiting for more text. */
+  int writerWaiting;
+
+  /** Set when the interpreter is waiting for the writer. */
+  int printerWaiting;
+
+  /** Set when the writer should exit once the ring is empty. */
+  int done;
+
+  /** Lock for sleeping on the condition variables. */
+  pthread_mutex_t lock;
+
+  /** Signaled when there's more text for the writer. */
+  pthread_cond_t moreText;
+
+  /** Signaled when the writer has written some text out. */
+  pthread_cond_t moreSpace;
+};
+
+/**
+  This function will write a list of blocks of memory to standard
+  output, or to the output's function, picking up where it left off
+  after a short write.
+  @param out the output being written
+  @param iov the blocks to write, which are modified as they're written
+  @param count number of blocks
+*/
+static void writeAll( Output *out, struct iovec *iov, int count )
+{
+  if ( out->write ) {
+    for ( int i = 0; i < count; i++ )
+      if ( iov[ i ].iov_len > 0 )
+        out->write( out->data, iov[ i ].iov_base, iov[ i ].iov_len );
+    return;
+  }
+
+  while ( count > 0 ) {
+    ssize_t n = writev( STDOUT_FILENO, iov, count );
+    if ( n < 0 ) {
+      if ( errno == EINTR )
+        continue;
+
+      // Nowhere to put the output, so drop it.
+      return;
+    }
+
+    // Skip over whatever was written.
+    while ( count > 0 && (size_t) n >= iov->iov_len ) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if ( count > 0 ) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+/**
+  This function will wake up the writer thread if it's waiting, so it
+  writes out everything in the ring so far.
+  @param ring the ring to hand off
+*/
+static void wakeWriter( struct OutputRing *ring )
+{
+  ring->handedOff = ring->head;
+  if ( LOAD( ring->writerWaiting ) ) {
+    pthread_mutex_lock( &ring->lock );
+    pthread_cond_signal( &ring->moreText );
+    pthread_mutex_unlock( &ring->lock );
+  }
+}
+
+/**
+  This function will wait until the writer thread has written out
+  everything up to the given point, or at least gotten tail that far.
+  @param ring the ring to wait on
+  @param until the value of tail to wait for
+*/
+static void waitForWriter( struct OutputRing *ring, size_t until )
+{
+  wakeWriter( ring );
+
+  pthread_mutex_lock( &ring->lock );
+  STORE( ring->printerWaiting, 1 );
+  while ( LOAD( ring->tail ) < until )
+    pthread_cond_wait( &ring->moreSpace, &ring->lock );
+  STORE( ring->printerWaiting, 0 );
+  pthread_mutex_unlock( &ring->lock );
+}
+
+/**
+  This function is the writer thread.  It writes out text from the ring
+  as it shows up, until it's told to stop.
+  @param arg the ring to write from
+  @return NULL
+*/
+static void *writerThread( void *arg )
+{
+  struct OutputRing *ring = (struct OutputRing *) arg;
+  while ( true ) {
+    size_t tail = ring->tail;
+    size_t head = LOAD( ring->head );
+
+    if ( head == tail ) {
+      // Nothing to write, so sleep until the interpreter hands us more,
+      // or we're done.
+      if ( LOAD( ring->done ) )
+        break;
+
+      pthread_mutex_lock( &ring->lock );
+      STORE( ring->writerWaiting, 1 );
+      while ( LOAD( ring->head ) == tail && !LOAD( ring->done ) )
+        pthread_cond_wait( &ring->moreText, &ring->lock );
+      STORE( ring->writerWaiting, 0 );
+      pthread_mutex_unlock( &ring->lock );
+      continue;
+    }
+
+    // Write as much as we can without wrapping around.
+    size_t start = tail & ( OUTPUT_RING_SIZE - 1 );
+    size_t len = head - tail;
+    if ( len > OUTPUT_RING_SIZE - start )
+      len = OUTPUT_RING_SIZE - start;
+
+    struct iovec iov = { ring->data + start, len };
+    writeAll( ring->out, &iov, 1 );
+
+    // Give the space back, and let the interpreter know if it's waiting.
+    STORE( ring->tail, tail + len );
+    if ( LOAD( ring->printerWaiting ) ) {
+      pthread_mutex_lock( &ring->lock );
+      pthread_cond_signal( &ring->moreSpace );
+      pthread_mutex_unlock( &ring->lock );
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  This function will copy text into the ring for the writer thread,
+  waiting for room if the ring is full.
+  @param out the output with the ring
+  @param str text to add
+  @param len number of bytes in the text
+*/
+static void writeRing( Output *out, char const *str, size_t len )
+{
+  struct OutputRing *ring = out->ring;
+  bool newline = out->policy == FLUSH_LINE && memchr( str, '\n', len );
+
+  while ( len > 0 ) {
+    size_t space = OUTPUT_RING_SIZE - ( ring->head - LOAD( ring->tail ) );
+    if ( space == 0 ) {
+      waitForWriter( ring, ring->head - OUTPUT_RING_SIZE + 1 );
+      continue;
+    }
+
+    // Copy up to the end of the ring, then go around again for the rest.
+    size_t start = ring->head & ( OUTPUT_RING_SIZE - 1 );
+    size_t n = len;
+    if ( n > space )
+      n = space;
+    if ( n > OUTPUT_RING_SIZE - start )
+      n = OUTPUT_RING_SIZE - start;
+
+    memcpy( ring->data + start, str, n );
+    STORE( ring->head, ring->head + n );
+    str += n;
+    len -= n;
+  }
+
+  // The writer sleeps until it's handed a good-sized chunk, so it isn't
+  // woken up for every print.
+  size_t pending = ring->head - ring->handedOff;
+  if ( newline || ( out->policy == FLUSH_SIZE && pending >= out->flushSize ) ||
+       pending >= OUTPUT_RING_SIZE / 4 )
+    wakeWriter( ring );
+}
+
+void initOutput( Output *out, OutputFunc write, void *data )
+{
+  out->used = 0;
+  out->policy = FLUSH_EXIT;
+  out->flushSize = OUTPUT_BUFFER_SIZE;
+  out->write = write;
+  out->data = data;
+  out->ring = NULL;
+  out->handler = NULL;
+  out->error[ 0 ] = '\0';
+}
+
+void appendText( void *data, char const *str, size_t len )
+{
+  TextBuffer *buf = (TextBuffer *) data;
+  if ( buf->len + len > buf->cap ) {
+    buf->cap = buf->cap ? buf->cap : INITIAL_CAPACITY;
+    while ( buf->len + len > buf->cap )
+      buf->cap *= GROWTH_RATE;
+    buf->text = (char *) realloc( buf->text, buf->cap );
+  }
+  memcpy( buf->text + buf->len, str, len );
+  buf->len += len;
+}
+
+void setFlushPolicy( Output *out, FlushPolicy policy, size_t size )
+{
+  out->policy = policy;
+  out->flushSize = size < OUTPUT_BUFFER_SIZE ? size : OUTPUT_BUFFER_SIZE;
+}
+
+void writeOutput( Output *out, char const *str, size_t len )
+{
+  if ( out->ring ) {
+    writeRing( out, str, len );
+    return;
+  }
+
+  if ( out->used + len <= OUTPUT_BUFFER_SIZE ) {
+    memcpy( out->buffer + out->used, str, len );
+    out->used += len;
+  } else {
+    // Too big to fit, so write what's buffered along with it in one
+    // call, without copying.
+    struct iovec iov[ 2 ] = {
+      { out->buffer, out->used },
+      { (void *) str, len }
+    };
+    writeAll( out, iov, 2 );
+    out->used = 0;
+    return;
+  }
+
+  if ( ( out->policy == FLUSH_LINE && memchr( str, '\n', len ) ) ||
+       ( out->policy == FLUSH_SIZE && out->used >= out->flushSize ) )
+    flushOutput( out );
+}
+
+void printOutput( Output *out, char const *str )
+{
+  writeOutput( out, str, strlen( str ) );
+}
+
+void flushOutput( Output *out )
+{
+  if ( out->ring ) {
+    waitForWriter( out->ring, out->ring->head );
+    return;
+  }
+
+  if ( out->used == 0 )
+    return;
+
+  struct iovec iov = { out->buffer, out->used };
+  writeAll( out, &iov, 1 );
+  out->used = 0;
+}
+
+bool startOutputThread( Output *out )
+{
+  // Anything already buffered has to come out first.
+  flushOutput( out );
+
+  struct OutputRing *ring = (struct OutputRing *) malloc( sizeof( struct OutputRing ) );
+  ring->out = out;
+  ring->data = (char *) malloc( OUTPUT_RING_SIZE );
+  ring->head = ring->tail = ring->handedOff = 0;
+  ring->writerWaiting = ring->printerWaiting = ring->done = 0;
+  pthread_mutex_init( &ring->lock, NULL );
+  pthread_cond_init( &ring->moreText, NULL );
+  pthread_cond_init( &ring->moreSpace, NULL );
+
+  if ( pthread_create( &ring->thread, NULL, writerThread, ring ) != 0 ) {
+    pthread_cond_destroy( &ring->moreSpace );
+    pthread_cond_destroy( &ring->moreText );
+    pthread_mutex_destroy( &ring->lock );
+    free( ring->data );
+    free( ring );
+    return false;
+  }
+
+  out->ring = ring;
+  return true;
+}
+
+void finishOutput( Output *out )
+{
+  flushOutput( out );
+  struct OutputRing *ring = out->ring;
+  if ( ring == NULL )
+    return;
+
+  // Tell the writer to stop, now that the ring is empty.
+  pthread_mutex_lock( &ring->lock );
+  STORE( ring->done, 1 );
+  pthread_cond_signal( &ring->moreText );
+  pthread_mutex_unlock( &ring->lock );
+  pthread_join( ring->thread, NULL );
+
+  out->ring = NULL;
+  pthread_cond_destroy( &ring->moreSpace );
+  pthread_cond_destroy( &ring->moreText );
+  pthread_mutex_destroy( &ring->lock );
+  free( ring->data );
+  free( ring );
+}
+
+void runtimeError( Output *out, char const *fmt, ... )
+{
+  va_list ap;
+  va_start( ap, fmt );
+  vsnprintf( out->error, sizeof( out->error ), fmt, ap );
+  va_end( ap );
+
+  raiseError( out );
+}
+
+bool catchError( Output *out, void (*fn)( void * ), void *arg )
+{
+  jmp_buf here;
+  jmp_buf *outer = out->handler;
+  out->handler = &here;
+
+  if ( setjmp( here ) == 0 ) {
+    fn( arg );
+    out->handler = outer;
+    return true;
+  }
+
+  out->handler = outer;
+  return false;
+}
+
+void raiseError( Output *out )
+{
+  if ( out->handler )
+    longjmp( *out->handler, 1 );
+
+  // Nobody's catching it, so this is the end of the program.
+  flushOutput( out );
+  fprintf( stderr, "%s\n", out->error );
+  exit( EXIT_FAILURE );
+}
@@ -0,0 +1,182 @@
+/**
+  @file output.h
+  @author David Lovato, dalovato
+
+  Output layer for what a script prints.  Text is collected in one
+  large buffer and handed to the operating system with write() and
+  writev(), rather than going through stdio a piece at a time.  When
+  the buffer is written out is up to the flush policy.
+
+  Output can also be handed to a separate writer thread through a
+  lock-free ring buffer, so the interpreter doesn't wait on the kernel
+  while it writes.
+
+  Each running program has its own Output, which is also where its
+  runtime errors go.  A program embedded in another one can send its
+  output to a callback, and catch its errors instead of exiting.
+*/
+
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <setjmp.h>
+
+/** Size of the output buffer. */
+#define OUTPUT_BUFFER_SIZE 65536
+
+/** Size of the ring buffer shared with the writer thread.  This needs
+    to be a power of two. */
+#define OUTPUT_RING_SIZE ( 1 << 20 )
+
+/** Longest runtime error message we keep. */
+#define MAX_RUNTIME_ERROR 1100
+
+/** When buffered output gets written.  With the writer thread, this is
+    when output is handed over to the thread to be written. */
+typedef enum {
+  /** Only when the buffer fills up, and when the program exits. */
+  FLUSH_EXIT,
+
+  /** Whenever at least a given number of bytes are waiting. */
+  FLUSH_SIZE,
+
+  /** After any text that contains a newline, like a terminal would
+      expect. */
+  FLUSH_LINE
+} FlushPolicy;
+
+/** Function that takes output when it's written, instead of standard
+    output.
+    @param data Pointer given along with the function.
+    @param str Text that was printed.  It isn't null terminated.
+    @param len Number of bytes in the text.
+*/
+typedef void (*OutputFunc)( void *data, char const *str, size_t len );
+
+/** Text kept in memory, growing as it's written. */
+typedef struct {
+  /** The text, which isn't null terminated. */
+  char *text;
+
+  /** Number of bytes of text. */
+  size_t len;
+
+  /** Capacity of the text array. */
+  size_t cap;
+} TextBuffer;
+
+/** Where a running program's output and errors go. */
+typedef struct Output {
+  /** Text waiting to be written. */
+  char buffer[ OUTPUT_BUFFER_SIZE ];
+
+  /** Number of bytes in the buffer. */
+  size_t used;
+
+  /** When to write the buffer. */
+  FlushPolicy policy;
+
+  /** For FLUSH_SIZE, how much can wait in the buffer. */
+  size_t flushSize;
+
+  /** Function to write output with, or NULL for standard output. */
+  OutputFunc write;
+
+  /** Pointer to pass to the write function. */
+  void *data;
+
+  /** Ring buffer for the writer thread, or NULL if there isn't one. */
+  struct OutputRing *ring;
+
+  /** Where to jump for a runtime error, or NULL to report it and exit. */
+  jmp_buf *handler;
+
+  /** Message for the last runtime error. */
+  char error[ MAX_RUNTIME_ERROR + 1 ];
+} Output;
+
+/** Initialize output with an empty buffer and the FLUSH_EXIT policy.
+    @param out Output to initialize.
+    @param write Function to send output to, or NULL for standard output.
+    @param data Pointer to pass to the write function.
+*/
+void initOutput( Output *out, OutputFunc write, void *data );
+
+/** Add text to the end of a text buffer.  This is an OutputFunc, so
+    output can be kept in a buffer by passing it as the data.
+    @param data TextBuffer to add to.
+    @param str Text to add.
+    @param len Number of bytes in the text.
+*/
+void appendText( void *data, char const *str, size_t len );
+
+/** Choose when output is written.
+    @param out Output to change.
+    @param policy New flush policy.
+    @param size For FLUSH_SIZE, how many bytes can wait in the buffer.
+*/
+void setFlushPolicy( Output *out, FlushPolicy policy, size_t size );
+
+/** Add text to the output.
+    @param out Output to add to.
+    @param str Text to print.
+    @param len Number of bytes in the text.
+*/
+void writeOutput( Output *out, char const *str, size_t len );
+
+/** Add a null-terminated string to the output.
+    @param out Output to add to.
+    @param str String to print.
+*/
+void printOutput( Output *out, char const *str );
+
+/** Write out everything in the buffer.  With the writer thread, this
+    waits until the thread has written everything so far.
+    @param out Output to flush.
+*/
+void flushOutput( Output *out );
+
+/** Start a writer thread, so print only copies text into a ring buffer
+    and the thread does the writing.  If the ring is full, print waits
+    for the thread to catch up.
+    @param out Output to write with the thread.
+    @return False if the thread couldn't be started, in which case
+    output stays in the normal buffered mode.
+*/
+bool startOutputThread( Output *out );
+
+/** Write out everything that's been printed, and stop the writer
+    thread if there is one.
+    @param out Output to finish.
+*/
+void finishOutput( Output *out );
+
+/** Report an error while the program is running.  The message is
+    formatted like printf(), and saved in the output's error field.  If
+    something is catching errors, this jumps back to it.  Otherwise,
+    buffered output is written, then the message goes to standard
+    error and the program exits.
+    @param out Output for the program with the error.
+    @param fmt Format for the message.
+*/
+void runtimeError( Output *out, char const *fmt, ... );
+
+/** Call a function, catching any runtime error while it runs.
+    @param out Output for the program being run.
+    @param fn Function to call.
+    @param arg Pointer to pass to the function.
+    @return False if there was a runtime error, with its message in the
+    output's error field.
+*/
+bool catchError( Output *out, void (*fn)( void * ), void *arg );
+
+/** Pass a runtime error that was caught on to whoever is catching
+    errors outside, after cleaning up.  This works just like calling
+    runtimeError() with the same message again.
+    @param out Output for the program with the error.
+*/
+void raiseError( Output *out );
+
+#endif
@@ -8,28 +8,132 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/** Current line we're parsing, starting from 1 like most editors. */
-static int lineCount = 1;
+/** Size of the first buffer for reading a script that can't be mapped. */
+#define READ_CHUNK 65536
 
-int getLineNumber()
+/**
+  This function will read everything from a file descriptor into one
+  dynamically allocated buffer.
+  @param ctx the context to store the buffer in
+  @param fd the file to read
+  @return false if there's an error reading
+*/
+static bool readAll( ParserContext *ctx, int fd )
 {
-  return lineCount;
+  size_t cap = READ_CHUNK;
+  ctx->buf = (char *) malloc( cap );
+  ctx->size = 0;
+
+  ssize_t n;
+  while ( ( n = read( fd, ctx->buf + ctx->size, cap - ctx->size ) ) > 0 ) {
+    ctx->size += n;
+    if ( ctx->size == cap ) {
+      cap *= 2;
+      ctx->buf = (char *) realloc( ctx->buf, cap );
+    }
+  }
+
+  if ( n < 0 ) {
+    free( ctx->buf );
+    return false;
+  }
+  return true;
 }
 
-void syntaxError()
+/**
+  This function will set up a context to start at the top of its
+  buffer.
+  @param ctx the context to initialize
+*/
+static void startParser( ParserContext *ctx )
 {
-  fprintf( stderr, "Syntax error (line %d)\n", lineCount );
-  exit( EXIT_FAILURE );
+  ctx->pos = 0;
+  ctx->mapped = false;
+  ctx->line = 1;
+  ctx->status = PARSE_OK;
+  ctx->message[ 0 ] = '\0';
 }
 
-bool isVarName( char const *str )
+bool openParser( ParserContext *ctx, char const *path )
 {
-  for ( int i = 0; str[ i ]; i++ ) {
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return false;
+
+  startParser( ctx );
+
+  // Map regular files.  The mapping is private, so unescaping a string
+  // only copies the page it's on, and never touches the file.
+  struct stat st;
+  if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 ) {
+    void *buf = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    if ( buf != MAP_FAILED ) {
+      ctx->buf = (char *) buf;
+      ctx->size = st.st_size;
+      ctx->mapped = true;
+    }
+  }
+
+  bool ok = ctx->mapped || readAll( ctx, fd );
+  close( fd );
+  return ok;
+}
+
+void openParserBuffer( ParserContext *ctx, char const *buf, size_t size )
+{
+  startParser( ctx );
+  ctx->buf = (char *) malloc( size ? size : 1 );
+  memcpy( ctx->buf, buf, size );
+  ctx->size = size;
+}
+
+void closeParser( ParserContext *ctx )
+{
+  if ( ctx->mapped )
+    munmap( ctx->buf, ctx->size );
+  else
+    free( ctx->buf );
+}
+
+int getLineNumber( ParserContext const *ctx )
+{
+  return ctx->line;
+}
+
+bool parseError( ParserContext *ctx, ParseStatus status, char const *fmt, ... )
+{
+  // Only the first error counts, anything after it could just be
+  // confusion from the first one.
+  if ( ctx->status != PARSE_OK )
+    return false;
+
+  va_list ap;
+  va_start( ap, fmt );
+  vsnprintf( ctx->message, sizeof( ctx->message ), fmt, ap );
+  va_end( ap );
+
+  ctx->status = status;
+  return false;
+}
+
+bool syntaxError( ParserContext *ctx )
+{
+  return parseError( ctx, PARSE_SYNTAX, "Syntax error (line %d)", ctx->line );
+}
+
+bool isVarName( char const *str, int len )
+{
+  for ( int i = 0; i < len; i++ ) {
     // Character better be a letter, an underscore or a digit (and not
     // the first character).
-    if ( ! ( isalpha( str[ i ] ) || str[ i ] == '_' ||
-             ( i > 0 && isdigit( str[ i ] ) ) ) )
+    if ( ! ( isalpha( (unsigned char) str[ i ] ) || str[ i ] == '_' ||
+             ( i > 0 && isdigit( (unsigned char) str[ i ] ) ) ) )
       return false;
     if ( i >= MAX_VARNAME )
       return false;
@@ -38,63 +142,83 @@ bool isVarName( char const *str )
   return true;
 }
 
-bool parseToken( char *token, FILE *fp )
+bool tokenIs( Token const *tok, char const *str )
+{
+  return strncmp( tok->text, str, tok->len ) == 0 && str[ tok->len ] == '\0';
+}
+
+/**
+  This function will return the next character from the lexer, or EOF
+  at the end of the input.
+  @param ctx the context to read from
+  @return the next character
+*/
+static int nextChar( ParserContext *ctx )
+{
+  if ( ctx->pos >= ctx->size )
+    return EOF;
+  return (unsigned char) ctx->buf[ ctx->pos++ ];
+}
+
+bool parseToken( ParserContext *ctx, Token *tok )
 {
   int ch;
 
   // Skip whitespace and comments.
-  while ( isspace( ch = fgetc( fp ) ) || ch == '#' ) {
+  while ( isspace( ch = nextChar( ctx ) ) || ch == '#' ) {
     // If we hit the comment characer, skip the whole line.
-    if ( ch == '#' )
-      while ( ( ch = fgetc( fp ) ) != EOF && ch != '\n' );
+    if ( ch == '#' ) {
+      char const *nl = memchr( ctx->buf + ctx->pos, '\n', ctx->size - ctx->pos );
+      ctx->pos = nl ? nl - ctx->buf : ctx->size;
+      ch = nextChar( ctx );
+    }
 
     if ( ch == '\n' )
-      lineCount++;
+      ctx->line++;
   }
 
   if ( ch == EOF )
     return false;
 
-  // Record the character we've read and keep up with the token length.
-  int len = 0;
-  token[ len++ ] = ch;
+  // The token starts at the character we just read.
+  char *start = ctx->buf + ctx->pos - 1;
+  tok->text = start;
 
   // Was that a command terminator?  If so, we're done.
   if ( ch == ';' ) {
-    token[ len++ ] = '\0';
+    tok->len = 1;
     return true;
   }
 
   // Handle non-quoted words.
   if ( ch != '"' ) {
-    while ( ( ch = fgetc( fp ) ) != EOF && !isspace( ch )
-            && ch != '"' && ch != '#' && ch != ';' ) {
-      // Complain if the token is too long.
-      if ( len >= MAX_TOKEN )
-        syntaxError();
-
-      token[ len++ ] = ch;
+    while ( ctx->pos < ctx->size ) {
+      ch = (unsigned char) ctx->buf[ ctx->pos ];
+      if ( isspace( ch ) || ch == '"' || ch == '#' || ch == ';' )
+        break;
+      ctx->pos++;
     }
 
-    // We had to read one character too far to find the end of the token.
-    // put it back.
-    if ( ch != EOF )
-      ungetc( ch, fp );
-
-    token[ len ] = '\0';
+    // Complain if the token is too long.
+    tok->len = ctx->buf + ctx->pos - start;
+    if ( tok->len > MAX_TOKEN )
+      return syntaxError( ctx );
     return true;
   }
 
-  // Most interesting case, handle strings.
+  // Most interesting case, handle strings.  Escape sequences are
+  // replaced in place, so dest trails behind the characters we're
+  // reading once we've seen one.
+  char *dest = start + 1;
 
   // Is the next character escaped.
   bool escape = false;
 
   // Keep reading until we hit the matching close quote.
-  while ( ( ch = fgetc( fp ) ) != '"' || escape ) {
+  while ( ( ch = nextChar( ctx ) ) != '"' || escape ) {
     // Error conditions
     if ( ch == EOF || ch == '\n' )
-      syntaxError();
+      return syntaxError( ctx );
 
     // On a backslash, we just enable escape mode.
     if ( !escape && ch == '\\' ) {
@@ -116,40 +240,46 @@ bool parseToken( char *token, FILE *fp )
           ch = '\\';
           break;
         default:
-          syntaxError();
+          return syntaxError( ctx );
         }
         escape = false;
       }
 
       // Complain if this string, with the eventual close quote, is too long.
-      if ( len + 1 >= MAX_TOKEN )
-        syntaxError();
+      if ( dest - start + 1 >= MAX_TOKEN )
+        return syntaxError( ctx );
 
-      token[ len++ ] = ch;
+      // Only write if we're behind, so strings without escapes never
+      // touch the buffer.
+      if ( dest != ctx->buf + ctx->pos - 1 )
+        *dest = ch;
+      dest++;
     }
   }
 
   // We leave off the closing quote, so it's easier to use just the content of a quoted string.
-  token[ len ] = '\0';
-  return token;
+  tok->len = dest - start;
+  return true;
 }
 
-void expectToken( char *tok, FILE *fp )
+bool expectToken( ParserContext *ctx, Token *tok )
 {
-  if ( !parseToken( tok, fp ) )
-    syntaxError();
+  if ( !parseToken( ctx, tok ) )
+    return syntaxError( ctx );
+  return true;
 }
 
-void expectVariable( char *tok, FILE *fp )
+bool expectVariable( ParserContext *ctx, Token *tok )
 {
-  if ( !parseToken( tok, fp ) || ! isVarName( tok ) )
-    syntaxError();
+  if ( !parseToken( ctx, tok ) || ! isVarName( tok->text, tok->len ) )
+    return syntaxError( ctx );
+  return true;
 }
 
-void requireToken( char const *target, FILE *fp )
+bool requireToken( ParserContext *ctx, char const *target )
 {
-  char tok[ MAX_TOKEN + 1 ];
-  expectToken( tok, fp );
-  if ( strcmp( tok, target ) != 0 )
-    syntaxError();
+  Token tok;
+  if ( !expectToken( ctx, &tok ) || !tokenIs( &tok, target ) )
+    return syntaxError( ctx );
+  return true;
 }
@@ -2,7 +2,12 @@
   @file parse.h
   @author David Lovato, dalovato
 
-  Tokenizer and parser functions for our language.
+  Tokenizer and parser functions for our language.  The whole script is
+  mapped (or read) into memory at once, and tokens are returned as
+  slices of that buffer rather than being copied out.  All the state
+  for loading a script lives in a ParserContext, and errors are
+  recorded there for the caller instead of ending the program, so
+  several scripts can be loaded at once.
 */
 
 #ifndef _PARSE_H_
@@ -10,6 +15,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 // Maximum length of a token in the source file.
 #define MAX_TOKEN 1023
@@ -17,51 +23,154 @@
 /** Maximum length of a variable name or a label. */
 #define MAX_VARNAME 20
 
+/** A token, as a slice of the lexer's buffer.  It isn't null
+    terminated. */
+typedef struct {
+  /** First character of the token.  For a double-quoted string, this
+      is the opening quote, and the escape sequences in the rest of the
+      string have already been replaced with the characters they stand
+      for. */
+  char const *text;
+
+  /** Number of characters in the token.  For a string, this counts the
+      opening quote but not the closing one. */
+  int len;
+} Token;
+
+/** Maximum length of an error message from loading a script. */
+#define MAX_ERROR 1100
+
+/** Kinds of error that can stop a script from loading. */
+typedef enum {
+  /** No error so far. */
+  PARSE_OK,
+
+  /** The script isn't written correctly. */
+  PARSE_SYNTAX,
+
+  /** The same label is defined twice. */
+  PARSE_DUPLICATE_LABEL,
+
+  /** A goto or if uses a label that isn't defined. */
+  PARSE_UNDEFINED_LABEL
+} ParseStatus;
+
+/** State for loading one script, the source of its tokens and a record
+    of the first error, if any. */
+typedef struct {
+  /** Contents of the script.  This is a private, writable mapping of
+      the file, so strings can be unescaped in place. */
+  char *buf;
+
+  /** Number of bytes in buf. */
+  size_t size;
+
+  /** Offset of the next character to read. */
+  size_t pos;
+
+  /** True if buf is mapped with mmap(), rather than allocated. */
+  bool mapped;
+
+  /** Current line we're parsing, starting from 1 like most editors. */
+  int line;
+
+  /** Kind of the first error, or PARSE_OK. */
+  ParseStatus status;
+
+  /** Message for the first error, without a newline. */
+  char message[ MAX_ERROR + 1 ];
+} ParserContext;
+
+/** Open a script and get ready to tokenize it.  Regular files are
+    mapped into memory.  Anything else, like a pipe, is read in with
+    one buffer.
+    @param ctx Context to initialize.
+    @param path Name of the script file.
+    @return False if the file can't be opened or read.
+*/
+bool openParser( ParserContext *ctx, char const *path );
+
+/** Get ready to tokenize a script that's already in memory.  The text
+    is copied, since strings are unescaped in place.
+    @param ctx Context to initialize.
+    @param buf Text of the script.
+    @param size Number of bytes in the text.
+*/
+void openParserBuffer( ParserContext *ctx, char const *buf, size_t size );
+
+/** Free the context's buffer.  Tokens from it aren't valid after this.
+    @param ctx Context to close.
+*/
+void closeParser( ParserContext *ctx );
+
 /** Return the current line number in the input (for error messages).
+    @param ctx Context for the script being parsed.
     @return Line number in the input.
 */
-int getLineNumber();
+int getLineNumber( ParserContext const *ctx );
+
+/** Record an error in the context, unless there's one already.  The
+    message is formatted like printf().
+    @param ctx Context to record the error in.
+    @param status Kind of error.
+    @param fmt Format for the message.
+    @return False, so callers can return the result directly.
+*/
+bool parseError( ParserContext *ctx, ParseStatus status, char const *fmt, ... );
 
-/** Print a syntax error message, with a line number and exit. */
-void syntaxError();
+/** Record a syntax error for the current line.
+    @param ctx Context to record the error in.
+    @return False, so callers can return the result directly.
+*/
+bool syntaxError( ParserContext *ctx );
 
-/** Return true if the given string is a legal variable name.
+/** Return true if the given text is a legal variable name.
+    @param str Start of the text to check.
+    @param len Number of characters in the text.
     @return True if it's a legal variable name.
 */
-bool isVarName( char const *str );
+bool isVarName( char const *str, int len );
+
+/** Return true if a token is exactly the given string.
+    @param tok Token to check.
+    @param str String to compare it to.
+    @return True if they match.
+*/
+bool tokenIs( Token const *tok, char const *str );
 
-/** Read the next token from the given file, a space-delimtied word, a
-    double quoted string or closing parentheses, crly brackets or a
-    semi-colon.  For double-quoted strings, it removes the final
+/** Read the next token, a space-delimtied word, a double quoted string
+    or a semi-colon.  For double-quoted strings, it removes the final
     double quote, but leaves the one at the start.
-    @param tok storage for the token, with room for a string of up to
-     MAX_TOKEN characters.
-    @param fp file to read tokens from.
-    @return true if the token is successfully read.
+    @param ctx context to read tokens from.
+    @param tok filled in with the token.
+    @return true if the token is successfully read.  On false, the
+    context's status tells whether it was the end of the input or an
+    error.
 */
-bool parseToken( char *token, FILE *fp );
+bool parseToken( ParserContext *ctx, Token *tok );
 
 /** Called when we expect another token on the input.  This function
-    parses the token and exits with an error if there isn't one.
-    @param storage for the next token, with capacity for at least
-    MAX_TOKEN characters.
-    @param fp file tokens should be read from.
+    parses the token and records a syntax error if there isn't one.
+    @param ctx context to read tokens from.
+    @param tok filled in with the token.
+    @return false if there was an error.
 */
-void expectToken( char *tok, FILE *fp );
+bool expectToken( ParserContext *ctx, Token *tok );
 
 /** Called when there needs to be a next token, and it needs to be a legal
-    variable name.  Prints the syntax error message if it's not.
-    @param storage for the next token, with capacity for at least
-    MAX_TOKEN characters.
-    @param fp file tokens should be read from.
+    variable name.  Records a syntax error if it's not.
+    @param ctx context to read tokens from.
+    @param tok filled in with the token.
+    @return false if there was an error.
 */
-void expectVariable( char *tok, FILE *fp );
+bool expectVariable( ParserContext *ctx, Token *tok );
 
 /** Called when the next token, must be a particular value,
-    target.  Prints an error message and exits if it's not.
+    target.  Records a syntax error if it's not.
+    @param ctx context to read tokens from.
     @param target string that the next token should match.
-    @param fp file tokens should be read from.
+    @return false if there was an error.
 */
-void requireToken( char const *target, FILE *fp );
+bool requireToken( ParserContext *ctx, char const *target );
 
 #endif
@@ -0,0 +1,94 @@
+/**
+  This file contains the program structure, and loading and compiling
+  a whole program.
+  @file program.c
+  @author David Lovato, dalovato
+*/
+
+#include "program.h"
+#include <stdlib.h>
+#include "optimize.h"
+
+void initProgram( Program *prog )
+{
+  // Initialize the array of command pointers.
+  prog->count = 0;
+  prog->cap = INITIAL_CAPACITY;
+  prog->cmd = (Command **) malloc( prog->cap * sizeof( Command * ) );
+
+  // Initialize the labelMap structure in the program.
+  initMap( & prog->labelMap );
+
+  // Variable names get interned as the commands are parsed.
+  initSymbols( & prog->symbols );
+
+  // Everything else the commands need comes from the arena.
+  initArena( & prog->arena );
+}
+
+bool loadProgram( Program *prog, ParserContext *ctx )
+{
+  // One token of read-ahead, so we can tell what's next in the program.
+  Token tok;
+  while ( parseToken( ctx, &tok ) ) {
+
+    // Is this token a label?
+    if ( tok.text[ tok.len - 1 ] == ':' ) {
+      // Throw away the : at the end, and put it in the map.
+      if ( !isVarName( tok.text, tok.len - 1 ) )
+        return syntaxError( ctx );
+      if ( !addLabel( & prog->labelMap, tok.text, tok.len - 1, prog->count ) )
+        return parseError( ctx, PARSE_DUPLICATE_LABEL, "Duplicate label: %.*s",
+                           tok.len - 1, tok.text );
+    } else {
+      // If it's not a label, it must be a command.
+      Command *cmd = parseCommand( &tok, ctx, & prog->symbols, & prog->arena );
+      if ( cmd == NULL )
+        return false;
+
+      // Enlarge the command list if needed, and store the new command.
+      if ( prog->count >= prog->cap ) {
+        prog->cap *= GROWTH_RATE;
+        prog->cmd = (Command **) realloc( prog->cmd, prog->cap * sizeof( Command * ) );
+      }
+      prog->cmd[ prog->count ++ ] = cmd;
+    }
+  }
+
+  // We stopped either at the end of the input or on a bad token.
+  return ctx->status == PARSE_OK;
+}
+
+bool linkProgram( Program *prog, ParserContext *ctx )
+{
+  for ( int i = 0; i < prog->count; i++ )
+    if ( prog->cmd[ i ]->link &&
+         !prog->cmd[ i ]->link( prog->cmd[ i ], & prog->labelMap, ctx ) )
+      return false;
+  return true;
+}
+
+void compileProgram( Program *prog, Code *code )
+{
+  initCode( code );
+  for ( int i = 0; i < prog->count; i++ )
+    prog->cmd[ i ]->compile( prog->cmd[ i ], code );
+}
+
+void compileOptimized( Program *prog, Code *code, bool keepVars )
+{
+  DeadCodeStats removed;
+  compileProgram( prog, code );
+  foldConstants( code, prog->symbols.count );
+  eliminateDeadCode( code, prog->symbols.count, keepVars, &removed );
+  fuseInstructions( code );
+}
+
+void freeProgram( Program *prog )
+{
+  // The commands all live in the arena, so they go away together.
+  freeArena( & prog->arena );
+  free( prog->cmd );
+  freeMap(&(prog->labelMap));
+  freeSymbols(&(prog->symbols));
+}
@@ -0,0 +1,87 @@
+/**
+  @file program.h
+  @author David Lovato, dalovato
+
+  A whole program as it's parsed from a script, as a list of command
+  objects along with its labels and variables, and how it gets lowered
+  to bytecode.
+*/
+
+#ifndef _PROGRAM_H_
+#define _PROGRAM_H_
+
+#include <stdbool.h>
+#include "command.h"
+#include "label.h"
+#include "parse.h"
+#include "var.h"
+#include "bytecode.h"
+#include "arena.h"
+
+/** Type used to represent a whole program, including a list of commands and
+    a record of where all the labels are. */
+typedef struct {
+  /** Sequence of all the commands in the program. */
+  Command **cmd;
+
+  /** Number of commands in the program. */
+  int count;
+
+  /** Capacity of the command list, for resize behavior. */
+  int cap;
+
+  /** Label map, for the targets of if and goto. */
+  LabelMap labelMap;
+
+  /** Names of all the variables the program uses. */
+  SymbolTable symbols;
+
+  /** Storage for the commands and their strings. */
+  Arena arena;
+} Program;
+
+/** Initialize the given Program structure as an empty program.
+    @param prog Program structure to initialize.
+*/
+void initProgram( Program *prog );
+
+/** Read the program definition from the given file into an empty
+    program.  Even if there's an error, the program needs to be freed.
+    @param prog Program structure to populate.
+    @param ctx Context for the file to read from.
+    @return False if there's an error, which is recorded in ctx.
+*/
+bool loadProgram( Program *prog, ParserContext *ctx );
+
+/** Resolve the labels used by every command in the program, so
+    branches don't need to look anything up while the program runs.
+    @param prog Program to link.
+    @param ctx Context to report an undefined label in.
+    @return False if any label isn't defined.
+*/
+bool linkProgram( Program *prog, ParserContext *ctx );
+
+/** Lower a linked program to bytecode.  Each command turns into one
+    instruction, so command indices used as branch targets are also
+    instruction indices.
+    @param prog Program to compile.
+    @param code Code structure to fill in.
+*/
+void compileProgram( Program *prog, Code *code );
+
+/** Lower a linked program to bytecode and run all the optimization
+    passes on it, the way the nonde command does by default.
+    @param prog Program to compile.
+    @param code Code structure to fill in.
+    @param keepVars True if the caller looks at the variables after the
+    program ends, so stores to them have to be kept even if the program
+    never reads them.
+*/
+void compileOptimized( Program *prog, Code *code, bool keepVars );
+
+/** Free memory for a program.
+    @param prog A pointer to the program we're supposed to free.
+*/
+void freeProgram( Program *prog );
+
+#endif
@@ -0,0 +1,855 @@
+/**
+  This file contains lockstep execution of a program over the rows of a
+  CSV file.
+  @file rows.c
+  @author David Lovato, dalovato
+*/
+
+#include "rows.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+
+#include "shared.h"
+
+/** One variable's value in every lane.  Types and numbers each get
+    their own array, so arithmetic on integers is a plain loop. */
+typedef struct {
+  /** Type of the value in each lane, a ValueType. */
+  unsigned char *type;
+
+  /** Value in each lane that holds a VAL_INT or a VAL_BOOL. */
+  int64_t *num;
+
+  /** Value in each lane that holds a VAL_STR.  Other lanes keep their
+      string buffer here for the next time they get a string. */
+  Value *text;
+} Column;
+
+/** Lanes that are all at the same instruction. */
+typedef struct {
+  /** Index of the next instruction for these lanes. */
+  int pc;
+
+  /** Index of each lane. */
+  int *lane;
+
+  /** Number of lanes. */
+  int count;
+} Group;
+
+/** State for running a block of rows. */
+typedef struct {
+  /** Code being run. */
+  Code *code;
+
+  /** Symbol table, for error messages. */
+  SymbolTable *symbols;
+
+  /** Shared counters for the atomic commands. */
+  int64_t *shared;
+
+  /** Column for each variable slot. */
+  Column *cols;
+
+  /** Output from each lane. */
+  TextBuffer *out;
+
+  /** Runtime error for each lane, or NULL if it hasn't had one.  A lane
+      with an error doesn't run any further. */
+  char **error;
+
+  /** Room for the first operand of each lane in a group, and the
+      result. */
+  int64_t *x;
+
+  /** Room for the second operand of each lane in a group. */
+  int64_t *y;
+
+  /** Groups waiting to run. */
+  Group *groups;
+
+  /** Number of waiting groups. */
+  int groupCount;
+
+  /** Capacity of the groups array. */
+  int groupCap;
+} Rows;
+
+/** One line of a CSV file, split into fields. */
+typedef struct {
+  /** Text of all the fields, each one null terminated. */
+  char *text;
+
+  /** Number of bytes used in text. */
+  size_t len;
+
+  /** Capacity of text. */
+  size_t cap;
+
+  /** Offset of each field in text. */
+  size_t *start;
+
+  /** Number of fields. */
+  int count;
+
+  /** Capacity of start. */
+  int fieldCap;
+
+  /** Offset in the file just past the last record that was read. */
+  long pos;
+} Record;
+
+/**
+  This function will read the next character of a CSV file, keeping
+  track of where the record reader is.
+  @param fp the file to read from
+  @param rec the record being read
+  @return the character, or EOF
+*/
+static int nextChar( FILE *fp, Record *rec )
+{
+  int ch = getc( fp );
+  if ( ch != EOF )
+    rec->pos++;
+  return ch;
+}
+
+/**
+  This function will add one character to the current field of a record.
+  @param rec the record being read
+  @param ch the character to add
+*/
+static void addChar( Record *rec, char ch )
+{
+  if ( rec->len >= rec->cap ) {
+    rec->cap *= GROWTH_RATE;
+    rec->text = (char *) realloc( rec->text, rec->cap );
+  }
+  rec->text[ rec->len++ ] = ch;
+}
+
+/**
+  This function will start a new field in a record.
+  @param rec the record being read
+*/
+static void startField( Record *rec )
+{
+  if ( rec->count >= rec->fieldCap ) {
+    rec->fieldCap *= GROWTH_RATE;
+    rec->start = (size_t *) realloc( rec->start, rec->fieldCap * sizeof( size_t ) );
+  }
+  rec->start[ rec->count++ ] = rec->len;
+}
+
+/**
+  This function will read one line of a CSV file.  Fields are separated
+  by commas, and a field in double quotes can have commas, newlines and
+  doubled double quotes in it.
+  @param fp the file to read from
+  @param rec the record to fill in
+  @return false if there are no more lines
+*/
+static bool readRecord( FILE *fp, Record *rec )
+{
+  rec->len = 0;
+  rec->count = 0;
+
+  int ch = nextChar( fp, rec );
+  if ( ch == EOF )
+    return false;
+
+  startField( rec );
+  bool quoted = false;
+  bool fresh = true;
+  for ( ;; ch = nextChar( fp, rec ) ) {
+    if ( quoted ) {
+      if ( ch == EOF )
+        break;
+      if ( ch != '"' ) {
+        addChar( rec, ch );
+        continue;
+      }
+
+      // A doubled quote is a quote, anything else ends the quotes.
+      ch = nextChar( fp, rec );
+      if ( ch == '"' ) {
+        addChar( rec, ch );
+        continue;
+      }
+      quoted = false;
+    }
+
+    if ( ch == '\r' ) {
+      int next = nextChar( fp, rec );
+      if ( next == '\n' )
+        ch = next;
+      else if ( next != EOF ) {
+        ungetc( next, fp );
+        rec->pos--;
+      }
+    }
+
+    if ( ch == EOF || ch == '\n' )
+      break;
+
+    if ( ch == ',' ) {
+      addChar( rec, '\0' );
+      startField( rec );
+      fresh = true;
+    } else if ( ch == '"' && fresh ) {
+      quoted = true;
+      fresh = false;
+    } else {
+      addChar( rec, ch );
+      fresh = false;
+    }
+  }
+
+  addChar( rec, '\0' );
+  return true;
+}
+
+/**
+  This function will initialize an empty record.
+  @param rec the record to initialize
+*/
+static void initRecord( Record *rec )
+{
+  rec->cap = INITIAL_CAPACITY;
+  rec->text = (char *) malloc( rec->cap );
+  rec->fieldCap = INITIAL_CAPACITY;
+  rec->start = (size_t *) malloc( rec->fieldCap * sizeof( size_t ) );
+  rec->pos = 0;
+}
+
+/**
+  This function will return true if the last record read was a blank
+  line, which doesn't count as a row.
+  @param rec the record to check
+  @return true if the record is blank
+*/
+static bool blankRecord( Record const *rec )
+{
+  return rec->count == 1 && rec->text[ 0 ] == '\0';
+}
+
+/**
+  This function will record a runtime error for a lane, which stops it.
+  @param rows the block being run
+  @param lane the lane with the error
+  @param fmt format for the message, like printf()
+*/
+static void laneError( Rows *rows, int lane, char const *fmt, ... )
+{
+  if ( rows->error[ lane ] )
+    return;
+
+  rows->error[ lane ] = (char *) malloc( MAX_RUNTIME_ERROR + 1 );
+  va_list ap;
+  va_start( ap, fmt );
+  vsnprintf( rows->error[ lane ], MAX_RUNTIME_ERROR + 1, fmt, ap );
+  va_end( ap );
+}
+
+/**
+  This function will return the value of an operand in one lane,
+  reporting an error for the lane if it's an undefined variable.
+  @param rows the block being run
+  @param x the operand, a variable slot or a literal
+  @param lane the lane to get the value for
+  @param pc index of the instruction, for error messages
+  @param tmp room to build a value that isn't a string
+  @return the value, or NULL if it's undefined
+*/
+static Value *laneValue( Rows *rows, int x, int lane, int pc, Value *tmp )
+{
+  if ( IS_LITERAL( x ) )
+    return &rows->code->lits[ LITERAL_INDEX( x ) ];
+
+  Column *col = &rows->cols[ x ];
+  switch ( col->type[ lane ] ) {
+  case VAL_UNDEF:
+    laneError( rows, lane, "Undefined variable: %s (line %d)", rows->symbols->names[ x ],
+               rows->code->lines[ pc ] );
+    return NULL;
+  case VAL_STR:
+    return &col->text[ lane ];
+  default:
+    tmp->type = col->type[ lane ];
+    tmp->num = col->num[ lane ];
+    tmp->str = NULL;
+    tmp->cap = 0;
+    return tmp;
+  }
+}
+
+/**
+  This function will get the numeric value of an operand for every lane
+  in a group.  Lanes where it isn't a number get an error.
+  @param rows the block being run
+  @param g the group being run
+  @param x the operand, a variable slot or a literal
+  @param pc index of the instruction, for error messages
+  @param dest where to put the number for each lane in the group
+*/
+static void gatherNumbers( Rows *rows, Group *g, int x, int pc, int64_t *dest )
+{
+  // A literal is the same in every lane, so only convert it once.
+  if ( IS_LITERAL( x ) ) {
+    int64_t num;
+    bool valid = toNumber( &rows->code->lits[ LITERAL_INDEX( x ) ], &num );
+    for ( int i = 0; i < g->count; i++ ) {
+      if ( valid )
+        dest[ i ] = num;
+      else
+        laneError( rows, g->lane[ i ], "Invalid number (line %d)", rows->code->lines[ pc ] );
+    }
+    return;
+  }
+
+  Column *col = &rows->cols[ x ];
+  for ( int i = 0; i < g->count; i++ ) {
+    int lane = g->lane[ i ];
+    if ( col->type[ lane ] == VAL_INT ) {
+      dest[ i ] = col->num[ lane ];
+      continue;
+    }
+
+    Value tmp;
+    Value *val = rows->error[ lane ] ? NULL : laneValue( rows, x, lane, pc, &tmp );
+    if ( val && !toNumber( val, &dest[ i ] ) )
+      laneError( rows, lane, "Invalid number (line %d)", rows->code->lines[ pc ] );
+  }
+}
+
+/**
+  This function will remove the lanes that have had an error from a
+  group, keeping the operands lined up with the lanes that are left.
+  @param rows the block being run
+  @param g the group to check
+*/
+static void dropFailed( Rows *rows, Group *g )
+{
+  int n = 0;
+  for ( int i = 0; i < g->count; i++ )
+    if ( !rows->error[ g->lane[ i ] ] ) {
+      g->lane[ n ] = g->lane[ i ];
+      rows->x[ n ] = rows->x[ i ];
+      rows->y[ n ] = rows->y[ i ];
+      n++;
+    }
+  g->count = n;
+}
+
+/**
+  This function will store the number computed for each lane in a group
+  in a variable.
+  @param rows the block being run
+  @param g the group being run
+  @param slot the variable to store in
+  @param type VAL_INT or VAL_BOOL
+*/
+static void scatter( Rows *rows, Group *g, int slot, ValueType type )
+{
+  Column *col = &rows->cols[ slot ];
+  for ( int i = 0; i < g->count; i++ ) {
+    col->type[ g->lane[ i ] ] = type;
+    col->num[ g->lane[ i ] ] = rows->x[ i ];
+  }
+}
+
+/**
+  This function will add a group to the ones waiting to run.
+  @param rows the block being run
+  @param pc the instruction the group is at
+  @param lane the lanes in the group, which the group takes over
+  @param count the number of lanes
+*/
+static void pushGroup( Rows *rows, int pc, int *lane, int count )
+{
+  if ( rows->groupCount >= rows->groupCap ) {
+    rows->groupCap *= GROWTH_RATE;
+    rows->groups = (Group *) realloc( rows->groups, rows->groupCap * sizeof( Group ) );
+  }
+  Group *g = &rows->groups[ rows->groupCount++ ];
+  g->pc = pc;
+  g->lane = lane;
+  g->count = count;
+}
+
+/**
+  This function will split a group at a branch.  Lanes whose entry in x
+  is true go to the target, and the rest keep going in this group.
+  @param rows the block being run
+  @param g the group at the branch
+  @param target where the branch goes
+  @param next where the other lanes go
+  @return the instruction the taken lanes are waiting at, or INT_MAX if
+  none had to be split off
+*/
+static int branch( Rows *rows, Group *g, int target, int next )
+{
+  int taken = 0;
+  for ( int i = 0; i < g->count; i++ )
+    taken += rows->x[ i ] != 0;
+
+  if ( taken == 0 || taken == g->count ) {
+    g->pc = taken ? target : next;
+    return INT_MAX;
+  }
+
+  int *lane = (int *) malloc( taken * sizeof( int ) );
+  int n = 0;
+  taken = 0;
+  for ( int i = 0; i < g->count; i++ ) {
+    if ( rows->x[ i ] )
+      lane[ taken++ ] = g->lane[ i ];
+    else
+      g->lane[ n++ ] = g->lane[ i ];
+  }
+  g->count = n;
+  g->pc = next;
+  pushGroup( rows, target, lane, taken );
+  return target;
+}
+
+/**
+  This function will run one instruction for every lane in a group.
+  @param rows the block being run
+  @param g the group to run
+  @return the instruction a group that was split off is waiting at, or
+  INT_MAX if there isn't one
+*/
+static int stepGroup( Rows *rows, Group *g )
+{
+  int pc = g->pc;
+  Instr *in = &rows->code->instr[ pc ];
+  int64_t *x = rows->x;
+  int64_t *y = rows->y;
+  int n;
+
+  // Room to format a value, if print needs a number's text.
+  char buf[ NUMBER_LEN ];
+  Value tmp;
+
+  switch ( in->op ) {
+  case OP_PRINT:
+    for ( int i = 0; i < g->count; i++ ) {
+      Value *val = laneValue( rows, in->a, g->lane[ i ], pc, &tmp );
+      if ( val ) {
+        char const *text = toText( val, buf );
+        appendText( &rows->out[ g->lane[ i ] ], text, strlen( text ) );
+      }
+    }
+    dropFailed( rows, g );
+    g->pc++;
+    return INT_MAX;
+
+  case OP_SET: {
+    Column *dest = &rows->cols[ in->a ];
+    for ( int i = 0; i < g->count; i++ ) {
+      int lane = g->lane[ i ];
+      Value *val = laneValue( rows, in->b, lane, pc, &tmp );
+      if ( val == NULL )
+        continue;
+      if ( val->type == VAL_STR )
+        copyValue( &dest->text[ lane ], val );
+      else
+        dest->num[ lane ] = val->num;
+      dest->type[ lane ] = val->type;
+    }
+    dropFailed( rows, g );
+    g->pc++;
+    return INT_MAX;
+  }
+
+  case OP_GOTO:
+    g->pc = in->a;
+    return INT_MAX;
+
+  case OP_IF:
+    for ( int i = 0; i < g->count; i++ ) {
+      Value *val = laneValue( rows, in->a, g->lane[ i ], pc, &tmp );
+      x[ i ] = val && isTrue( val );
+    }
+    dropFailed( rows, g );
+    return branch( rows, g, in->b, pc + 1 );
+
+  case OP_SPAWN:
+  case OP_JOIN:
+    // The lanes are already running side by side, and a task couldn't
+    // be merged back into just one of them.
+    for ( int i = 0; i < g->count; i++ )
+      laneError( rows, g->lane[ i ], "Tasks can't run over rows (line %d)",
+                 rows->code->lines[ pc ] );
+    dropFailed( rows, g );
+    g->pc++;
+    return INT_MAX;
+
+  case OP_GO:
+    for ( int i = 0; i < g->count; i++ )
+      laneError( rows, g->lane[ i ], "Coroutines can't run over rows (line %d)",
+                 rows->code->lines[ pc ] );
+    dropFailed( rows, g );
+    g->pc++;
+    return INT_MAX;
+
+  case OP_YIELD:
+    // A row is the only coroutine it has, so it just keeps going.
+    g->pc++;
+    return INT_MAX;
+
+  case OP_ATOMIC_ADD:
+  case OP_ATOMIC_MAX:
+  case OP_CAS: {
+    // Every lane updates the counter in turn, in lane order.
+    int64_t *counter = SHARED_SLOT( rows->shared, in->b );
+    if ( in->op == OP_CAS )
+      gatherNumbers( rows, g, in->a, pc, x );
+    gatherNumbers( rows, g, in->c, pc, y );
+    dropFailed( rows, g );
+    n = g->count;
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = in->op == OP_ATOMIC_ADD ? sharedAdd( counter, y[ i ] ) :
+               in->op == OP_ATOMIC_MAX ? sharedMax( counter, y[ i ] ) :
+               sharedCas( counter, x[ i ], y[ i ] );
+    scatter( rows, g, in->a, VAL_INT );
+    g->pc++;
+    return INT_MAX;
+  }
+
+  case OP_INC:
+    gatherNumbers( rows, g, in->a, pc, x );
+    dropFailed( rows, g );
+    n = g->count;
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = (int64_t) ( (uint64_t) x[ i ] + (uint64_t) in->c );
+    scatter( rows, g, in->a, VAL_INT );
+    g->pc++;
+    return INT_MAX;
+  }
+
+  // Everything else works on two numbers.
+  gatherNumbers( rows, g, in->b, pc, x );
+  gatherNumbers( rows, g, in->c, pc, y );
+  if ( in->op == OP_DIV || in->op == OP_MOD )
+    for ( int i = 0; i < g->count; i++ )
+      if ( y[ i ] == 0 )
+        laneError( rows, g->lane[ i ], "Divide by zero (line %d)", rows->code->lines[ pc ] );
+  dropFailed( rows, g );
+
+  // Each of these is a simple loop over the lanes, with no calls in it.
+  // Arithmetic wraps, and dividing by -1 negates instead of trapping on
+  // INT64_MIN, the same as in the scalar engines.
+  n = g->count;
+  switch ( in->op ) {
+  case OP_ADD:
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = (int64_t) ( (uint64_t) x[ i ] + (uint64_t) y[ i ] );
+    break;
+  case OP_SUB:
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = (int64_t) ( (uint64_t) x[ i ] - (uint64_t) y[ i ] );
+    break;
+  case OP_MULT:
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = (int64_t) ( (uint64_t) x[ i ] * (uint64_t) y[ i ] );
+    break;
+  case OP_DIV:
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = y[ i ] == -1 ? (int64_t) ( 0 - (uint64_t) x[ i ] ) : x[ i ] / y[ i ];
+    break;
+  case OP_MOD:
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = y[ i ] == -1 ? 0 : x[ i ] % y[ i ];
+    break;
+  case OP_EQ:
+  case OP_EQ_IF:
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = x[ i ] == y[ i ];
+    break;
+  case OP_LESS:
+  case OP_LESS_IF:
+    for ( int i = 0; i < n; i++ )
+      x[ i ] = x[ i ] < y[ i ];
+    break;
+  }
+
+  switch ( in->op ) {
+  case OP_EQ:
+  case OP_LESS:
+    scatter( rows, g, in->a, VAL_BOOL );
+    g->pc++;
+    return INT_MAX;
+  case OP_EQ_IF:
+  case OP_LESS_IF:
+    scatter( rows, g, in->a, VAL_BOOL );
+    return branch( rows, g, in[ 1 ].b, pc + 2 );
+  default:
+    scatter( rows, g, in->a, VAL_INT );
+    g->pc++;
+    return INT_MAX;
+  }
+}
+
+/**
+  This function will take the waiting group that's furthest behind, and
+  merge any others at the same instruction into it.
+  @param rows the block being run
+  @param g set to the group to run
+  @return the earliest instruction any group left waiting is at, or
+  INT_MAX if there aren't any
+*/
+static int takeGroup( Rows *rows, Group *g )
+{
+  int first = 0;
+  for ( int i = 1; i < rows->groupCount; i++ )
+    if ( rows->groups[ i ].pc < rows->groups[ first ].pc )
+      first = i;
+  *g = rows->groups[ first ];
+  rows->groups[ first ] = rows->groups[ --rows->groupCount ];
+
+  int next = INT_MAX;
+  for ( int i = 0; i < rows->groupCount; ) {
+    Group *other = &rows->groups[ i ];
+    if ( other->pc != g->pc ) {
+      if ( other->pc < next )
+        next = other->pc;
+      i++;
+      continue;
+    }
+
+    g->lane = (int *) realloc( g->lane, ( g->count + other->count ) * sizeof( int ) );
+    memcpy( g->lane + g->count, other->lane, other->count * sizeof( int ) );
+    g->count += other->count;
+    free( other->lane );
+    *other = rows->groups[ --rows->groupCount ];
+  }
+  return next;
+}
+
+/**
+  This function will run the code for a block of lanes, until every one
+  of them falls off the end or has an error.  The group furthest behind
+  always runs, and it stops when it catches up to another one, so lanes
+  that split at a branch come back together where the paths meet.
+  @param rows the block to run, with its variables filled in
+  @param lanes the number of lanes
+*/
+static void runBlock( Rows *rows, int lanes )
+{
+  int *lane = (int *) malloc( lanes * sizeof( int ) );
+  for ( int i = 0; i < lanes; i++ )
+    lane[ i ] = i;
+  pushGroup( rows, 0, lane, lanes );
+
+  while ( rows->groupCount > 0 ) {
+    Group g;
+    int next = takeGroup( rows, &g );
+    while ( g.count > 0 && g.pc < rows->code->count && g.pc < next ) {
+      int split = stepGroup( rows, &g );
+      if ( split < next )
+        next = split;
+    }
+
+    if ( g.count > 0 && g.pc < rows->code->count )
+      pushGroup( rows, g.pc, g.lane, g.count );
+    else
+      free( g.lane );
+  }
+}
+
+/**
+  This function will give a lane in a column a copy of some text.
+  @param col the column to change
+  @param lane the lane to change
+  @param str the text
+*/
+static void setText( Column *col, int lane, char const *str )
+{
+  Value val;
+  initConst( &val, str );
+  copyValue( &col->text[ lane ], &val );
+  col->type[ lane ] = VAL_STR;
+}
+
+int runRows( Code *code, SymbolTable *symbols, char const *path, int64_t *shared, Output *out )
+{
+  return runRowRange( code, symbols, path, 0, -1, 0, shared, out );
+}
+
+bool splitRows( char const *path, int parts, long *bounds, int *firstRow )
+{
+  FILE *fp = fopen( path, "r" );
+  if ( fp == NULL )
+    return false;
+
+  fseek( fp, 0, SEEK_END );
+  long size = ftell( fp );
+  rewind( fp );
+
+  // Split by size, moving each boundary up to the start of a row.
+  Record rec;
+  initRecord( &rec );
+  readRecord( fp, &rec );
+  long header = rec.pos;
+  bounds[ 0 ] = header;
+  firstRow[ 0 ] = 0;
+
+  int part = 1;
+  int row = 0;
+  long pos = header;
+  while ( readRecord( fp, &rec ) ) {
+    while ( part < parts && pos >= header + ( size - header ) / parts * part ) {
+      bounds[ part ] = pos;
+      firstRow[ part ] = row;
+      part++;
+    }
+    if ( !blankRecord( &rec ) )
+      row++;
+    pos = rec.pos;
+  }
+
+  // Any parts that are left over are empty.
+  for ( ; part <= parts; part++ ) {
+    bounds[ part ] = pos;
+    firstRow[ part ] = row;
+  }
+
+  free( rec.start );
+  free( rec.text );
+  fclose( fp );
+  return true;
+}
+
+int runRowRange( Code *code, SymbolTable *symbols, char const *path, long start, long end,
+                 int firstRow, int64_t *shared, Output *out )
+{
+  FILE *fp = fopen( path, "r" );
+  if ( fp == NULL ) {
+    fprintf( stderr, "Can't open file: %s\n", path );
+    return EXIT_FAILURE;
+  }
+
+  Record rec;
+  initRecord( &rec );
+
+  // The first line says which variable each column is for.  Columns
+  // the program doesn't use are skipped.
+  int columns = 0;
+  int *slots = NULL;
+  if ( readRecord( fp, &rec ) ) {
+    columns = rec.count;
+    slots = (int *) malloc( columns * sizeof( int ) );
+    for ( int i = 0; i < columns; i++ ) {
+      char const *name = rec.text + rec.start[ i ];
+      slots[ i ] = findLabel( &symbols->index, name, strlen( name ) );
+    }
+  }
+
+  // Skip ahead to the part of the file we're supposed to run.
+  if ( start > rec.pos && fseek( fp, start, SEEK_SET ) == 0 )
+    rec.pos = start;
+
+  Rows rows;
+  rows.code = code;
+  rows.symbols = symbols;
+  rows.shared = shared;
+  rows.cols = (Column *) malloc( ( symbols->count ? symbols->count : 1 ) * sizeof( Column ) );
+  for ( int s = 0; s < symbols->count; s++ ) {
+    rows.cols[ s ].type = (unsigned char *) malloc( ROW_BLOCK );
+    rows.cols[ s ].num = (int64_t *) malloc( ROW_BLOCK * sizeof( int64_t ) );
+    rows.cols[ s ].text = (Value *) malloc( ROW_BLOCK * sizeof( Value ) );
+    for ( int i = 0; i < ROW_BLOCK; i++ ) {
+      rows.cols[ s ].text[ i ].type = VAL_UNDEF;
+      rows.cols[ s ].text[ i ].str = NULL;
+      rows.cols[ s ].text[ i ].cap = 0;
+    }
+  }
+  rows.out = (TextBuffer *) calloc( ROW_BLOCK, sizeof( TextBuffer ) );
+  rows.error = (char **) calloc( ROW_BLOCK, sizeof( char * ) );
+  rows.x = (int64_t *) malloc( ROW_BLOCK * sizeof( int64_t ) );
+  rows.y = (int64_t *) malloc( ROW_BLOCK * sizeof( int64_t ) );
+  rows.groupCap = INITIAL_CAPACITY;
+  rows.groupCount = 0;
+  rows.groups = (Group *) malloc( rows.groupCap * sizeof( Group ) );
+
+  // Variables that aren't in the file come from the environment, the
+  // same as a normal run.
+  char const **env = (char const **) malloc( ( symbols->count ? symbols->count : 1 ) *
+                                             sizeof( char * ) );
+  for ( int s = 0; s < symbols->count; s++ )
+    env[ s ] = getenv( symbols->names[ s ] );
+
+  int status = EXIT_SUCCESS;
+  int row = firstRow;
+  bool more = columns > 0;
+  while ( more ) {
+    // Fill in a lane for each row in the block.  Blank lines don't
+    // count as rows.
+    int lanes = 0;
+    while ( lanes < ROW_BLOCK ) {
+      if ( ( end >= 0 && rec.pos >= end ) || !readRecord( fp, &rec ) ) {
+        more = false;
+        break;
+      }
+      if ( blankRecord( &rec ) )
+        continue;
+
+      for ( int s = 0; s < symbols->count; s++ ) {
+        if ( env[ s ] )
+          setText( &rows.cols[ s ], lanes, env[ s ] );
+        else
+          rows.cols[ s ].type[ lanes ] = VAL_UNDEF;
+      }
+      for ( int i = 0; i < rec.count && i < columns; i++ )
+        if ( slots[ i ] >= 0 )
+          setText( &rows.cols[ slots[ i ] ], lanes, rec.text + rec.start[ i ] );
+      lanes++;
+    }
+
+    if ( lanes == 0 )
+      break;
+    runBlock( &rows, lanes );
+
+    // Write what each row printed, in order, with its error after it.
+    for ( int i = 0; i < lanes; i++ ) {
+      if ( rows.out[ i ].len > 0 )
+        writeOutput( out, rows.out[ i ].text, rows.out[ i ].len );
+      rows.out[ i ].len = 0;
+      if ( rows.error[ i ] ) {
+        flushOutput( out );
+        fprintf( stderr, "Row %d: %s\n", row + i + 1, rows.error[ i ] );
+        free( rows.error[ i ] );
+        rows.error[ i ] = NULL;
+        status = EXIT_FAILURE;
+      }
+    }
+    row += lanes;
+  }
+
+  for ( int s = 0; s < symbols->count; s++ ) {
+    for ( int i = 0; i < ROW_BLOCK; i++ )
+      freeValue( &rows.cols[ s ].text[ i ] );
+    free( rows.cols[ s ].type );
+    free( rows.cols[ s ].num );
+    free( rows.cols[ s ].text );
+  }
+  for ( int i = 0; i < ROW_BLOCK; i++ )
+    free( rows.out[ i ].text );
+  free( rows.cols );
+  free( rows.out );
+  free( rows.error );
+  free( rows.x );
+  free( rows.y );
+  free( rows.groups );
+  free( env );
+  free( slots );
+  free( rec.start );
+  free( rec.text );
+  fclose( fp );
+  return status;
+}
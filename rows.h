@@ -0,0 +1,75 @@
+/**
+  @file rows.h
+  @author David Lovato, dalovato
+
+  Running one program once for every row of a CSV file, with all the
+  rows going through the code together.  The first line of the file
+  names variables, and each row after it gives their values for one
+  run.  Rows are run in blocks, one lane per row, and each variable is
+  stored as a column with a value for every lane, so an instruction is
+  a loop over the lanes instead of a trip through the dispatch loop for
+  each row.
+
+  Lanes that go different ways at a branch are split into separate
+  groups, and groups that reach the same instruction are merged again.
+  Each row's output is kept separately and written in the order of the
+  rows.  A runtime error only stops the row that had it.
+*/
+
+#ifndef _ROWS_H_
+#define _ROWS_H_
+
+#include "bytecode.h"
+#include "var.h"
+#include "output.h"
+
+/** Number of rows run together in one block. */
+#define ROW_BLOCK 1024
+
+/** Run compiled code once for each row of a CSV file.  Variables that
+    aren't in the file start out with their values from the
+    environment, like a normal run.  Everything the rows print goes to
+    the given output, in row order, and each runtime error goes to
+    standard error after that row's output, with its row number.
+    @param code Code to run.
+    @param symbols Symbol table for the code's variables.
+    @param path Name of the CSV file.
+    @param shared Shared counters for the atomic commands, which every
+    row uses.
+    @param out Output for everything the rows print.
+    @return EXIT_SUCCESS if every row ran without an error.
+*/
+int runRows( Code *code, SymbolTable *symbols, char const *path, int64_t *shared, Output *out );
+
+/** Run compiled code for just the rows in part of a CSV file, the same
+    way runRows() does.  The first line of the file still names the
+    variables.
+    @param code Code to run.
+    @param symbols Symbol table for the code's variables.
+    @param path Name of the CSV file.
+    @param start Offset in the file of the first row to run.  Anything
+    before the end of the first line means the first row.
+    @param end Offset just past the last row to run, or -1 to run to the
+    end of the file.
+    @param firstRow Number of rows before start, so errors get the
+    right row numbers.
+    @param shared Shared counters for the atomic commands.
+    @param out Output for everything the rows print.
+    @return EXIT_SUCCESS if every row ran without an error.
+*/
+int runRowRange( Code *code, SymbolTable *symbols, char const *path, long start, long end,
+                 int firstRow, int64_t *shared, Output *out );
+
+/** Split the rows of a CSV file into parts of about the same size, for
+    runRowRange().  Each boundary falls at the start of a row.
+    @param path Name of the CSV file.
+    @param parts Number of parts.
+    @param bounds Room for parts + 1 offsets.  Part i runs from
+    bounds[ i ] up to bounds[ i + 1 ].
+    @param firstRow Room for parts + 1 counts of the rows before each
+    boundary.
+    @return False if the file couldn't be opened.
+*/
+bool splitRows( char const *path, int parts, long *bounds, int *firstRow );
+
+#endif
@@ -0,0 +1,612 @@
+/**
+  This file contains daemon mode, and the client for it.
+  @file server.c
+  @author David Lovato, dalovato
+*/
+
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "program.h"
+#include "vm.h"
+#include "output.h"
+#include "cache.h"
+
+/** How many accepted connections can wait for a worker. */
+#define QUEUE_SIZE 256
+
+/** Size of a message header, a type byte and a 32-bit length. */
+#define HEADER_SIZE 5
+
+/** Size of the first buffer for reading a request. */
+#define REQUEST_CHUNK 4096
+
+/** A compiled script, shared by every run of it.  Runs only read the
+    code, so any number of workers can use it at once. */
+typedef struct {
+  /** Hash of the text it was compiled from, from hashSource().  A
+      modification time can't see an edit made in the same second. */
+  uint64_t hash;
+
+  /** The parsed script, which owns the symbols and string literals. */
+  Program prog;
+
+  /** The compiled script. */
+  Code code;
+
+  /** Number of runs using the script, plus one while it's in the
+      cache. */
+  int refs;
+} Script;
+
+/** Every script the server has compiled, by path. */
+static struct {
+  /** Lock for everything in the cache, and the reference counts. */
+  pthread_mutex_t lock;
+
+  /** Map from a script's path to its index in scripts. */
+  LabelMap index;
+
+  /** Latest compiled version of each script. */
+  Script **scripts;
+
+  /** Number of scripts. */
+  int count;
+
+  /** Capacity of the scripts array. */
+  int cap;
+} cache = { PTHREAD_MUTEX_INITIALIZER };
+
+/** Connections waiting for a worker, in a circular queue. */
+static struct {
+  /** Lock for the queue. */
+  pthread_mutex_t lock;
+
+  /** Signaled when a connection is added. */
+  pthread_cond_t ready;
+
+  /** Signaled when a connection is taken. */
+  pthread_cond_t space;
+
+  /** Socket for each connection. */
+  int fds[ QUEUE_SIZE ];
+
+  /** Index of the oldest connection. */
+  int head;
+
+  /** Number of connections waiting. */
+  int count;
+} queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+            PTHREAD_COND_INITIALIZER };
+
+/** One client's connection, for sending it output. */
+typedef struct {
+  /** Socket for the connection. */
+  int fd;
+
+  /** Set if a write failed, so we stop trying. */
+  bool failed;
+} Client;
+
+/**
+  This function will write a whole buffer to a socket, picking up where
+  it left off after a short write.
+  @param fd the socket to write to
+  @param buf the bytes to write
+  @param len the number of bytes
+  @return false if the write failed
+*/
+static bool writeFully( int fd, void const *buf, size_t len )
+{
+  char const *p = (char const *) buf;
+  while ( len > 0 ) {
+    ssize_t n = write( fd, p, len );
+    if ( n < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+  This function will read exactly the given number of bytes from a
+  socket.
+  @param fd the socket to read from
+  @param buf room for the bytes
+  @param len the number of bytes to read
+  @return false if the connection closed or the read failed first
+*/
+static bool readFully( int fd, void *buf, size_t len )
+{
+  char *p = (char *) buf;
+  while ( len > 0 ) {
+    ssize_t n = read( fd, p, len );
+    if ( n < 0 && errno == EINTR )
+      continue;
+    if ( n <= 0 )
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+  This function will send one message to a client.
+  @param fd the client's socket
+  @param type the kind of message
+  @param data the data for the message
+  @param len the length of the data, or the exit status for MSG_EXIT
+  @return false if the message couldn't be sent
+*/
+static bool sendMessage( int fd, char type, void const *data, uint32_t len )
+{
+  char header[ HEADER_SIZE ];
+  header[ 0 ] = type;
+  memcpy( header + 1, &len, sizeof( len ) );
+  return writeFully( fd, header, HEADER_SIZE ) &&
+    ( type == MSG_EXIT || writeFully( fd, data, len ) );
+}
+
+/**
+  This function will send a script's output to its client, as the
+  Output's write function.
+  @param data the Client to send to
+  @param str the text to send
+  @param len the number of bytes of text
+*/
+static void sendOutput( void *data, char const *str, size_t len )
+{
+  Client *client = (Client *) data;
+  if ( !client->failed && !sendMessage( client->fd, MSG_OUTPUT, str, len ) )
+    client->failed = true;
+}
+
+/**
+  This function will send a line of text to a client.
+  @param client the client to send to
+  @param type MSG_OUTPUT or MSG_ERROR
+  @param text the text to send, which gets a newline after it
+*/
+static void sendLine( Client *client, char type, char const *text )
+{
+  size_t len = strlen( text );
+  char *line = (char *) malloc( len + 2 );
+  memcpy( line, text, len );
+  strcpy( line + len, "\n" );
+  if ( !client->failed && !sendMessage( client->fd, type, line, len + 1 ) )
+    client->failed = true;
+  free( line );
+}
+
+/**
+  This function will drop one reference to a script, freeing it when
+  nothing uses it any more.  The cache must be locked.
+  @param script the script to release
+*/
+static void dropScript( Script *script )
+{
+  if ( --script->refs > 0 )
+    return;
+
+  freeCode( &script->code );
+  freeProgram( &script->prog );
+  free( script );
+}
+
+/**
+  This function will let go of a script after a run is done with it.
+  @param script the script to release
+*/
+static void releaseScript( Script *script )
+{
+  pthread_mutex_lock( &cache.lock );
+  dropScript( script );
+  pthread_mutex_unlock( &cache.lock );
+}
+
+/**
+  This function will parse and compile a script for the cache, closing
+  the parser when it's done.
+  @param ctx the context for the open script, which holds any error
+  @param hash the hash of the script's text
+  @return the new script, or NULL if it couldn't be loaded
+*/
+static Script *compileScript( ParserContext *ctx, uint64_t hash )
+{
+  Script *script = (Script *) malloc( sizeof( Script ) );
+  initProgram( &script->prog );
+  bool loaded = loadProgram( &script->prog, ctx ) && linkProgram( &script->prog, ctx );
+  closeParser( ctx );
+  if ( !loaded ) {
+    freeProgram( &script->prog );
+    free( script );
+    return NULL;
+  }
+
+  // Scripts are compiled the same way libnonde compiles them, keeping
+  // every variable's last value.
+  compileOptimized( &script->prog, &script->code, true );
+  convertLiterals( &script->code );
+
+  script->hash = hash;
+  return script;
+}
+
+/**
+  This function will get the compiled code for a script, compiling it
+  if it isn't in the cache or the file has changed since it was.
+  @param path the name of the script file
+  @param ctx the context for parsing, which holds any error
+  @param opened set to false if the file couldn't be opened
+  @return the script, which should be released after the run, or NULL
+  if there was an error
+*/
+static Script *getScript( char const *path, ParserContext *ctx, bool *opened )
+{
+  // The script is mapped anyway, so hashing the text is cheap, and it
+  // catches every edit.
+  *opened = openParser( ctx, path );
+  if ( !*opened )
+    return NULL;
+  uint64_t hash = hashSource( ctx->buf, ctx->size );
+
+  int len = strlen( path );
+  pthread_mutex_lock( &cache.lock );
+  int slot = findLabel( &cache.index, path, len );
+  if ( slot >= 0 ) {
+    Script *script = cache.scripts[ slot ];
+    if ( script->hash == hash ) {
+      script->refs++;
+      pthread_mutex_unlock( &cache.lock );
+      closeParser( ctx );
+      return script;
+    }
+  }
+  pthread_mutex_unlock( &cache.lock );
+
+  // Compile without holding the lock, so other scripts can still run.
+  // If two workers compile the same script at once, the last one wins.
+  Script *script = compileScript( ctx, hash );
+  if ( script == NULL )
+    return NULL;
+  script->refs = 2;
+
+  pthread_mutex_lock( &cache.lock );
+  slot = findLabel( &cache.index, path, len );
+  if ( slot < 0 ) {
+    if ( cache.count >= cache.cap ) {
+      cache.cap *= GROWTH_RATE;
+      cache.scripts = (Script **) realloc( cache.scripts, cache.cap * sizeof( Script * ) );
+    }
+    slot = cache.count++;
+    addLabel( &cache.index, path, len, slot );
+  } else
+    dropScript( cache.scripts[ slot ] );
+  cache.scripts[ slot ] = script;
+  pthread_mutex_unlock( &cache.lock );
+
+  return script;
+}
+
+/**
+  This function will read a whole request from a client.
+  @param fd the client's socket
+  @return the request, ending with an empty string, or NULL if the
+  client didn't send a complete one.  The caller should free it.
+*/
+static char *readRequest( int fd )
+{
+  size_t cap = REQUEST_CHUNK;
+  size_t len = 0;
+  char *buf = (char *) malloc( cap );
+
+  while ( true ) {
+    if ( len == cap ) {
+      if ( cap >= MAX_REQUEST )
+        break;
+      cap *= GROWTH_RATE;
+      buf = (char *) realloc( buf, cap );
+    }
+
+    ssize_t n = read( fd, buf + len, cap - len );
+    if ( n < 0 && errno == EINTR )
+      continue;
+    if ( n <= 0 )
+      break;
+
+    // Strings in the request are never empty, except the one at the
+    // end, so the request ends with the first pair of nulls.
+    size_t start = len > 0 ? len - 1 : 0;
+    len += n;
+    if ( buf[ 0 ] == '\0' )
+      break;
+    for ( size_t i = start; i + 1 < len; i++ )
+      if ( buf[ i ] == '\0' && buf[ i + 1 ] == '\0' )
+        return buf;
+  }
+
+  free( buf );
+  return NULL;
+}
+
+/**
+  This function will handle one request, sending the client everything
+  the script prints and its exit status.
+  @param fd the client's socket
+  @param out the worker's output buffer
+*/
+static void serveClient( int fd, Output *out )
+{
+  char *request = readRequest( fd );
+  if ( request == NULL )
+    return;
+
+  Client client = { fd, false };
+  char const *path = request;
+  ParserContext ctx;
+  bool opened;
+  Script *script = getScript( path, &ctx, &opened );
+  if ( script == NULL ) {
+    // Report it just like nonde would when run directly.
+    if ( !opened ) {
+      char *message = (char *) malloc( strlen( path ) + sizeof( "Can't open file: " ) );
+      sprintf( message, "Can't open file: %s", path );
+      sendLine( &client, MSG_ERROR, message );
+      free( message );
+    } else
+      sendLine( &client, ctx.status == PARSE_DUPLICATE_LABEL ? MSG_OUTPUT : MSG_ERROR,
+                ctx.message );
+    sendMessage( fd, MSG_EXIT, NULL, EXIT_FAILURE );
+    free( request );
+    return;
+  }
+
+  // Every run gets its own variables, starting with the client's
+  // bindings.
+  initOutput( out, sendOutput, &client );
+  VarStore vars;
+  initVars( &vars, &script->prog.symbols, out );
+  for ( char const *b = path + strlen( path ) + 1; *b; b += strlen( b ) + 1 ) {
+    char const *eq = strchr( b, '=' );
+    int slot = eq ? findLabel( &script->prog.symbols.index, b, eq - b ) : -1;
+    if ( slot >= 0 ) {
+      Value val;
+      initConst( &val, eq + 1 );
+      setValue( &vars, slot, &val );
+    }
+  }
+
+  bool ok = catchThreaded( &script->code, &vars );
+  flushOutput( out );
+  if ( !ok )
+    sendLine( &client, MSG_ERROR, out->error );
+  sendMessage( fd, MSG_EXIT, NULL, ok ? EXIT_SUCCESS : EXIT_FAILURE );
+
+  freeVars( &vars );
+  releaseScript( script );
+  free( request );
+}
+
+/**
+  This function is a worker thread.  It takes connections off the queue
+  and serves them, forever.
+  @param arg unused
+  @return never returns
+*/
+static void *worker( void *arg )
+{
+  // Each worker reuses one output buffer for all its runs.
+  Output *out = (Output *) malloc( sizeof( Output ) );
+
+  while ( true ) {
+    pthread_mutex_lock( &queue.lock );
+    while ( queue.count == 0 )
+      pthread_cond_wait( &queue.ready, &queue.lock );
+    int fd = queue.fds[ queue.head ];
+    queue.head = ( queue.head + 1 ) % QUEUE_SIZE;
+    queue.count--;
+    pthread_cond_signal( &queue.space );
+    pthread_mutex_unlock( &queue.lock );
+
+    serveClient( fd, out );
+    close( fd );
+  }
+
+  return NULL;
+}
+
+/**
+  This function will fill in the address for a socket path.
+  @param addr the address to fill in
+  @param path the name of the socket
+  @return false if the name is too long
+*/
+static bool socketAddress( struct sockaddr_un *addr, char const *path )
+{
+  memset( addr, 0, sizeof( *addr ) );
+  addr->sun_family = AF_UNIX;
+  if ( strlen( path ) >= sizeof( addr->sun_path ) )
+    return false;
+  strcpy( addr->sun_path, path );
+  return true;
+}
+
+/**
+  This function will make a socket listening at the given path.  If
+  something's already there, it's only replaced if it's a socket that
+  nobody is listening on.
+  @param path the name of the socket
+  @return the socket, or -1 if there's an error
+*/
+static int listenOn( char const *path )
+{
+  struct sockaddr_un addr;
+  if ( !socketAddress( &addr, path ) )
+    return -1;
+
+  int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( fd < 0 )
+    return -1;
+
+  if ( bind( fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ) {
+    // See if it's left over from a server that's gone.
+    int probe = errno == EADDRINUSE ? socket( AF_UNIX, SOCK_STREAM, 0 ) : -1;
+    bool stale = probe >= 0 &&
+      connect( probe, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 &&
+      errno == ECONNREFUSED;
+    if ( probe >= 0 )
+      close( probe );
+
+    if ( !stale || unlink( path ) != 0 ||
+         bind( fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ) {
+      close( fd );
+      return -1;
+    }
+  }
+
+  if ( listen( fd, SOMAXCONN ) != 0 ) {
+    close( fd );
+    return -1;
+  }
+  return fd;
+}
+
+int serve( char const *path, int workers )
+{
+  int fd = listenOn( path );
+  if ( fd < 0 ) {
+    fprintf( stderr, "Can't listen on socket: %s\n", path );
+    return EXIT_FAILURE;
+  }
+
+  // A client that goes away mid-run shouldn't take the server with it.
+  signal( SIGPIPE, SIG_IGN );
+
+  initMap( &cache.index );
+  cache.count = 0;
+  cache.cap = INITIAL_CAPACITY;
+  cache.scripts = (Script **) malloc( cache.cap * sizeof( Script * ) );
+
+  int started = 0;
+  for ( int i = 0; i < workers; i++ ) {
+    pthread_t thread;
+    if ( pthread_create( &thread, NULL, worker, NULL ) == 0 ) {
+      pthread_detach( thread );
+      started++;
+    }
+  }
+  if ( started == 0 ) {
+    fprintf( stderr, "Can't start worker threads\n" );
+    return EXIT_FAILURE;
+  }
+
+  while ( true ) {
+    int client = accept( fd, NULL, NULL );
+    if ( client < 0 ) {
+      if ( errno == EINTR || errno == ECONNABORTED )
+        continue;
+      fprintf( stderr, "Can't accept connections: %s\n", strerror( errno ) );
+      return EXIT_FAILURE;
+    }
+
+    pthread_mutex_lock( &queue.lock );
+    while ( queue.count == QUEUE_SIZE )
+      pthread_cond_wait( &queue.space, &queue.lock );
+    queue.fds[ ( queue.head + queue.count ) % QUEUE_SIZE ] = client;
+    queue.count++;
+    pthread_cond_signal( &queue.ready );
+    pthread_mutex_unlock( &queue.lock );
+  }
+}
+
+/**
+  This function will copy the data for a message from the server to a
+  file descriptor.
+  @param fd the server's socket
+  @param dest where to copy the data
+  @param len the length of the data
+  @return false if the connection closed first
+*/
+static bool copyMessage( int fd, int dest, uint32_t len )
+{
+  char buf[ REQUEST_CHUNK ];
+  while ( len > 0 ) {
+    size_t n = len < sizeof( buf ) ? len : sizeof( buf );
+    if ( !readFully( fd, buf, n ) )
+      return false;
+    writeFully( dest, buf, n );
+    len -= n;
+  }
+  return true;
+}
+
+int runRemote( char const *path, char const *script )
+{
+  extern char **environ;
+
+  struct sockaddr_un addr;
+  int fd = socketAddress( &addr, path ) ? socket( AF_UNIX, SOCK_STREAM, 0 ) : -1;
+  if ( fd < 0 || connect( fd, (struct sockaddr *) &addr, sizeof( addr ) ) != 0 ) {
+    fprintf( stderr, "Can't connect to server: %s\n", path );
+    if ( fd >= 0 )
+      close( fd );
+    return EXIT_FAILURE;
+  }
+
+  // The server has its own working directory, so send a full path.
+  char cwd[ REQUEST_CHUNK ] = "";
+  if ( script[ 0 ] != '/' && getcwd( cwd, sizeof( cwd ) - 1 ) )
+    strcat( cwd, "/" );
+
+  // Build the request, with the whole environment as the bindings.
+  size_t len = strlen( cwd ) + strlen( script ) + 2;
+  for ( char **e = environ; *e; e++ )
+    len += strlen( *e ) + 1;
+  char *request = (char *) malloc( len );
+  char *p = request;
+  p += sprintf( p, "%s%s", cwd, script ) + 1;
+  for ( char **e = environ; *e; e++ )
+    if ( **e ) {
+      strcpy( p, *e );
+      p += strlen( *e ) + 1;
+    }
+  *p++ = '\0';
+
+  bool sent = writeFully( fd, request, p - request );
+  free( request );
+
+  // Pass along output until we get the exit status.
+  char header[ HEADER_SIZE ];
+  while ( sent && readFully( fd, header, HEADER_SIZE ) ) {
+    uint32_t n;
+    memcpy( &n, header + 1, sizeof( n ) );
+    if ( header[ 0 ] == MSG_EXIT ) {
+      close( fd );
+      return n;
+    }
+
+    int dest = header[ 0 ] == MSG_ERROR ? STDERR_FILENO : STDOUT_FILENO;
+    if ( !copyMessage( fd, dest, n ) )
+      break;
+  }
+
+  fprintf( stderr, "Lost connection to server: %s\n", path );
+  close( fd );
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,52 @@
+/**
+  @file server.h
+  @author David Lovato, dalovato
+
+  Daemon mode, for running scripts without starting a new process each
+  time.  The server listens on a UNIX socket and keeps every script it
+  runs compiled in memory, keyed by its path and a hash of its text.  A
+  pool of worker threads takes connections, and each run gets its own
+  variables and output.
+
+  A client sends the script's path and its variable bindings, each as
+  a null-terminated string, followed by an empty string.  The server
+  sends back a series of messages, each a type byte and a 32-bit
+  length in the machine's byte order, with the length giving the
+  size of the data that follows.  Output and error text come back as
+  they're written, then an exit message carries the exit status in its
+  length field, with no data.
+*/
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+/** Message with text the script printed. */
+#define MSG_OUTPUT 'O'
+
+/** Message with text for standard error. */
+#define MSG_ERROR 'E'
+
+/** Last message, with the exit status. */
+#define MSG_EXIT 'X'
+
+/** Longest request the server will read. */
+#define MAX_REQUEST ( 1 << 20 )
+
+/** Serve script runs on a UNIX socket until the process is killed.  A
+    stale socket left at the path by an earlier server is replaced.
+    @param path Name of the socket.
+    @param workers Number of worker threads.
+    @return Exit status, if the server couldn't start.
+*/
+int serve( char const *path, int workers );
+
+/** Run a script on a server, with this process's environment as the
+    variable bindings, the same as if it ran here.  Output and errors go
+    to standard output and standard error.
+    @param path Name of the server's socket.
+    @param script Name of the script to run.
+    @return Exit status of the script.
+*/
+int runRemote( char const *path, char const *script );
+
+#endif
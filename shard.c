@@ -0,0 +1,250 @@
+/**
+  This file contains sharded execution, which runs the rows of a CSV
+  file in forked processes.
+  @file shard.c
+  @author David Lovato, dalovato
+*/
+
+#include "shard.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "rows.h"
+
+/** Size of the buffer for reading from a shard. */
+#define SHARD_CHUNK 65536
+
+/** Which of a shard's streams a pipe carries. */
+enum { SHARD_OUT, SHARD_ERR, SHARD_STREAMS };
+
+/** One child process and what it has sent back. */
+typedef struct {
+  /** Process ID, or -1 if it couldn't be started. */
+  pid_t pid;
+
+  /** Read end of the pipe for each stream, or -1 once it's closed. */
+  int fd[ SHARD_STREAMS ];
+
+  /** Text from each stream that's waiting for earlier shards. */
+  TextBuffer held[ SHARD_STREAMS ];
+} Shard;
+
+/**
+  This function will write a whole buffer to standard error, for text
+  from a shard's error stream.
+  @param str the text to write
+  @param len the number of bytes of text
+*/
+static void writeError( char const *str, size_t len )
+{
+  while ( len > 0 ) {
+    ssize_t n = write( STDERR_FILENO, str, len );
+    if ( n < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      return;
+    }
+    str += n;
+    len -= n;
+  }
+}
+
+/**
+  This function will pass along text from one of a shard's streams.
+  @param out output for the standard output stream
+  @param stream SHARD_OUT or SHARD_ERR
+  @param str the text
+  @param len the number of bytes of text
+*/
+static void passText( Output *out, int stream, char const *str, size_t len )
+{
+  if ( stream == SHARD_OUT )
+    writeOutput( out, str, len );
+  else {
+    // Keep what the shard printed before the error ahead of it.
+    flushOutput( out );
+    writeError( str, len );
+  }
+}
+
+/**
+  This function will run one shard's chunk of the rows in a child
+  process, with its standard output and error going to the given pipes.
+  It never returns.
+  @param code the code to run
+  @param symbols the code's symbol table
+  @param path the name of the CSV file
+  @param start offset of the chunk
+  @param end offset just past the chunk
+  @param firstRow number of rows before the chunk
+  @param shared the shared counters
+  @param pipes write end of the pipe for each stream
+*/
+static void runChild( Code *code, SymbolTable *symbols, char const *path, long start,
+                      long end, int firstRow, int64_t *shared, int const *pipes )
+{
+  dup2( pipes[ SHARD_OUT ], STDOUT_FILENO );
+  dup2( pipes[ SHARD_ERR ], STDERR_FILENO );
+  close( pipes[ SHARD_OUT ] );
+  close( pipes[ SHARD_ERR ] );
+
+  // The parent's Output might belong to a writer thread that didn't come
+  // along with the fork, so the child gets its own.
+  Output *out = (Output *) malloc( sizeof( Output ) );
+  initOutput( out, NULL, NULL );
+  int status = runRowRange( code, symbols, path, start, end, firstRow, shared, out );
+  finishOutput( out );
+  fflush( stderr );
+  _exit( status );
+}
+
+int runShards( Code *code, SymbolTable *symbols, char const *path, int shards, int64_t *shared,
+               Output *out )
+{
+  long *bounds = (long *) malloc( ( shards + 1 ) * sizeof( long ) );
+  int *firstRow = (int *) malloc( ( shards + 1 ) * sizeof( int ) );
+  if ( !splitRows( path, shards, bounds, firstRow ) ) {
+    fprintf( stderr, "Can't open file: %s\n", path );
+    free( firstRow );
+    free( bounds );
+    return EXIT_FAILURE;
+  }
+
+  // Anything buffered now would be written again by every child.
+  flushOutput( out );
+  fflush( stdout );
+  fflush( stderr );
+
+  int status = EXIT_SUCCESS;
+  Shard *shard = (Shard *) calloc( shards, sizeof( Shard ) );
+  for ( int i = 0; i < shards; i++ ) {
+    int pipes[ SHARD_STREAMS ][ 2 ];
+    shard[ i ].pid = -1;
+    shard[ i ].fd[ SHARD_OUT ] = shard[ i ].fd[ SHARD_ERR ] = -1;
+    if ( pipe( pipes[ SHARD_OUT ] ) != 0 )
+      continue;
+    if ( pipe( pipes[ SHARD_ERR ] ) != 0 ) {
+      close( pipes[ SHARD_OUT ][ 0 ] );
+      close( pipes[ SHARD_OUT ][ 1 ] );
+      continue;
+    }
+
+    shard[ i ].pid = fork();
+    if ( shard[ i ].pid == 0 ) {
+      // The child doesn't need any of the pipes from earlier shards.
+      for ( int j = 0; j < i; j++ )
+        for ( int s = 0; s < SHARD_STREAMS; s++ )
+          if ( shard[ j ].fd[ s ] >= 0 )
+            close( shard[ j ].fd[ s ] );
+      close( pipes[ SHARD_OUT ][ 0 ] );
+      close( pipes[ SHARD_ERR ][ 0 ] );
+      int ends[ SHARD_STREAMS ] = { pipes[ SHARD_OUT ][ 1 ], pipes[ SHARD_ERR ][ 1 ] };
+      runChild( code, symbols, path, bounds[ i ], bounds[ i + 1 ], firstRow[ i ], shared,
+                ends );
+    }
+
+    for ( int s = 0; s < SHARD_STREAMS; s++ ) {
+      close( pipes[ s ][ 1 ] );
+      if ( shard[ i ].pid > 0 )
+        shard[ i ].fd[ s ] = pipes[ s ][ 0 ];
+      else
+        close( pipes[ s ][ 0 ] );
+    }
+  }
+
+  // Read from every shard at once, so none of them blocks on a full
+  // pipe.  Text from the earliest shard that isn't finished goes right
+  // out, and everything else waits its turn.
+  struct pollfd *polls = (struct pollfd *) malloc( shards * SHARD_STREAMS * sizeof( struct pollfd ) );
+  char *buf = (char *) malloc( SHARD_CHUNK );
+  int current = 0;
+  while ( true ) {
+    // Move on past every shard that's done, writing what they held.
+    while ( current < shards && shard[ current ].fd[ SHARD_OUT ] < 0 &&
+            shard[ current ].fd[ SHARD_ERR ] < 0 ) {
+      if ( ++current < shards )
+        for ( int s = 0; s < SHARD_STREAMS; s++ ) {
+          TextBuffer *held = &shard[ current ].held[ s ];
+          if ( held->len > 0 )
+            passText( out, s, held->text, held->len );
+          free( held->text );
+          held->text = NULL;
+          held->len = 0;
+        }
+    }
+    if ( current >= shards )
+      break;
+
+    int count = 0;
+    for ( int i = current; i < shards; i++ )
+      for ( int s = 0; s < SHARD_STREAMS; s++ )
+        if ( shard[ i ].fd[ s ] >= 0 ) {
+          polls[ count ].fd = shard[ i ].fd[ s ];
+          polls[ count ].events = POLLIN;
+          count++;
+        }
+
+    if ( poll( polls, count, -1 ) < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      break;
+    }
+
+    count = 0;
+    for ( int i = current; i < shards; i++ )
+      for ( int s = 0; s < SHARD_STREAMS; s++ ) {
+        if ( shard[ i ].fd[ s ] < 0 )
+          continue;
+        if ( polls[ count++ ].revents == 0 )
+          continue;
+
+        ssize_t n = read( shard[ i ].fd[ s ], buf, SHARD_CHUNK );
+        if ( n < 0 && errno == EINTR )
+          continue;
+        if ( n <= 0 ) {
+          close( shard[ i ].fd[ s ] );
+          shard[ i ].fd[ s ] = -1;
+        } else if ( i == current )
+          passText( out, s, buf, n );
+        else
+          appendText( &shard[ i ].held[ s ], buf, n );
+      }
+  }
+
+  // A shard that didn't run, or didn't finish, is an error.
+  for ( int i = 0; i < shards; i++ ) {
+    int result;
+    if ( shard[ i ].pid < 0 ) {
+      flushOutput( out );
+      fprintf( stderr, "Can't start shard %d\n", i + 1 );
+      status = EXIT_FAILURE;
+    } else if ( waitpid( shard[ i ].pid, &result, 0 ) == shard[ i ].pid ) {
+      if ( WIFSIGNALED( result ) ) {
+        flushOutput( out );
+        fprintf( stderr, "Shard %d stopped by signal %d\n", i + 1, WTERMSIG( result ) );
+        status = EXIT_FAILURE;
+      } else if ( WEXITSTATUS( result ) != EXIT_SUCCESS )
+        status = EXIT_FAILURE;
+    }
+
+    for ( int s = 0; s < SHARD_STREAMS; s++ ) {
+      if ( shard[ i ].fd[ s ] >= 0 )
+        close( shard[ i ].fd[ s ] );
+      free( shard[ i ].held[ s ].text );
+    }
+  }
+
+  free( buf );
+  free( polls );
+  free( shard );
+  free( firstRow );
+  free( bounds );
+  return status;
+}
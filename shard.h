@@ -0,0 +1,41 @@
+/**
+  @file shard.h
+  @author David Lovato, dalovato
+
+  Running the rows of a CSV file in several processes at once.  The
+  rows are split into one chunk per shard, and each shard is a forked
+  child that runs its chunk with runRowRange(), so nothing in the
+  interpreter has to be shared between threads.  The compiled code is
+  made before the fork, so every child starts with its own copy.  The
+  only thing the shards share is the counters for the atomic commands,
+  which are mapped into every child.
+
+  Each child's standard output and standard error come back through
+  pipes.  The parent passes along the first chunk's text as it arrives
+  and holds on to the rest, so each stream comes out in chunk order, the
+  same as if the rows had run in one process.
+*/
+
+#ifndef _SHARD_H_
+#define _SHARD_H_
+
+#include "bytecode.h"
+#include "var.h"
+#include "output.h"
+
+/** Run compiled code once for each row of a CSV file, with the rows
+    split across several processes.
+    @param code Code to run.
+    @param symbols Symbol table for the code's variables.
+    @param path Name of the CSV file.
+    @param shards Number of processes to run.
+    @param shared Shared counters for the atomic commands.  They need to
+    be in memory that forked processes share, for the shards to see
+    each other's updates.
+    @param out Output for everything the rows print.
+    @return EXIT_SUCCESS if every shard ran every row without an error.
+*/
+int runShards( Code *code, SymbolTable *symbols, char const *path, int shards, int64_t *shared,
+               Output *out );
+
+#endif
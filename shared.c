@@ -0,0 +1,66 @@
+/**
+  This file contains storage for the shared counters used by the
+  atomic commands.
+  @file shared.c
+  @author David Lovato, dalovato
+*/
+
+#include "shared.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+void openShared( SharedCounters *counters, int count, bool processes )
+{
+  counters->count = count;
+  size_t size = ( count ? count : 1 ) * SHARED_STRIDE * sizeof( int64_t );
+
+  // Mapping /dev/zero shared gives zeroed memory that forked children
+  // keep sharing with us, without needing anything outside POSIX.
+  counters->mapped = false;
+  if ( processes ) {
+    int fd = open( "/dev/zero", O_RDWR );
+    if ( fd >= 0 ) {
+      void *mem = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+      close( fd );
+      if ( mem != MAP_FAILED ) {
+        counters->slots = (int64_t *) mem;
+        counters->mapped = true;
+        return;
+      }
+    }
+  }
+
+  counters->slots = (int64_t *) calloc( 1, size );
+}
+
+void closeShared( SharedCounters *counters )
+{
+  if ( counters->mapped )
+    munmap( counters->slots, ( counters->count ? counters->count : 1 ) * SHARED_STRIDE *
+            sizeof( int64_t ) );
+  else
+    free( counters->slots );
+}
+
+void printShared( Code const *code, SymbolTable const *symbols, int64_t *shared, FILE *fp )
+{
+  // Each counter goes out once, in the order it's first used.
+  bool *printed = (bool *) calloc( symbols->count ? symbols->count : 1, sizeof( bool ) );
+  for ( int pc = 0; pc < code->count; pc++ ) {
+    Instr const *in = &code->instr[ pc ];
+    if ( in->op != OP_ATOMIC_ADD && in->op != OP_ATOMIC_MAX && in->op != OP_CAS )
+      continue;
+    if ( printed[ in->b ] )
+      continue;
+    printed[ in->b ] = true;
+
+    fprintf( fp, "%s = %" PRId64 "\n", symbols->names[ in->b ],
+             __atomic_load_n( SHARED_SLOT( shared, in->b ), __ATOMIC_SEQ_CST ) );
+  }
+  free( printed );
+}
@@ -0,0 +1,112 @@
+/**
+  @file shared.h
+  @author David Lovato, dalovato
+
+  Shared counters for the atomic commands.  Counters have their own
+  namespace: a counter is named like a variable and uses that
+  variable's slot, but it's stored apart from the variables, so a
+  counter and a variable with the same name don't affect each other.
+  Every counter is a 64-bit integer that starts at zero.
+
+  Everything that runs at the same time as part of one program sees the
+  same counters.  That covers tasks, which get their variables copied
+  but share counters with their parent, and forked shards, since the
+  counters can be kept in memory that's mapped into every process.
+  Counters are only changed with lock-free atomic instructions, and each
+  one sits on its own cache line, so workers updating different counters
+  never slow each other down.
+*/
+
+#ifndef _SHARED_H_
+#define _SHARED_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "bytecode.h"
+#include "var.h"
+
+/** Number of int64_t values between counters, a cache line apart. */
+#define SHARED_STRIDE 8
+
+/** Address of the counter for the given slot.
+    @param shared Array of counters.
+    @param slot Slot of the counter.
+*/
+#define SHARED_SLOT( shared, slot ) ( ( shared ) + (size_t) ( slot ) * SHARED_STRIDE )
+
+/** Storage for a program's counters. */
+typedef struct {
+  /** The counters, SHARED_STRIDE values apart. */
+  int64_t *slots;
+
+  /** Number of counters. */
+  int count;
+
+  /** True if the storage is shared with processes forked after it was
+      made, rather than just with threads. */
+  bool mapped;
+} SharedCounters;
+
+/** Make storage for counters, all set to zero.
+    @param counters Address of the structure to initialize.
+    @param count Number of counters, normally one for each variable slot.
+    @param processes True if the counters have to be shared with
+    forked processes, not just with other threads.  If the memory for
+    that can't be mapped, the counters are only shared between threads.
+*/
+void openShared( SharedCounters *counters, int count, bool processes );
+
+/** Free the storage for a set of counters.
+    @param counters Counters to free.
+*/
+void closeShared( SharedCounters *counters );
+
+/** Add to a counter.
+    @param counter Counter to change.
+    @param n Amount to add.
+    @return The counter's new value.
+*/
+static inline int64_t sharedAdd( int64_t *counter, int64_t n )
+{
+  // Wrap around like the add command does, instead of overflowing.
+  return (int64_t) __atomic_add_fetch( (uint64_t *) counter, (uint64_t) n, __ATOMIC_SEQ_CST );
+}
+
+/** Raise a counter to a value, if it's lower.
+    @param counter Counter to change.
+    @param n Value the counter should be at least.
+    @return The counter's new value.
+*/
+static inline int64_t sharedMax( int64_t *counter, int64_t n )
+{
+  int64_t old = __atomic_load_n( counter, __ATOMIC_SEQ_CST );
+  while ( old < n && !__atomic_compare_exchange_n( counter, &old, n, false, __ATOMIC_SEQ_CST,
+                                                   __ATOMIC_SEQ_CST ) )
+    ;
+  return old < n ? n : old;
+}
+
+/** Set a counter to a new value, but only if it has the expected one.
+    @param counter Counter to change.
+    @param expected Value the counter has to have.
+    @param n New value for the counter.
+    @return The counter's value before, which is the expected value if
+    the counter was changed.
+*/
+static inline int64_t sharedCas( int64_t *counter, int64_t expected, int64_t n )
+{
+  __atomic_compare_exchange_n( counter, &expected, n, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+  return expected;
+}
+
+/** Print the name and value of every counter the code uses, one per
+    line.
+    @param code Code that ran.
+    @param symbols Symbol table for the code, for the names.
+    @param shared The counters.
+    @param fp Stream to print to.
+*/
+void printShared( Code const *code, SymbolTable const *symbols, int64_t *shared, FILE *fp );
+
+#endif
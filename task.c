@@ -0,0 +1,494 @@
+/**
+  This file contains tasks for spawn and join, and the work-stealing
+  pool of threads that runs them.
+  @file task.c
+  @author David Lovato, dalovato
+*/
+
+#include "task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "output.h"
+#include "shared.h"
+
+/** Size of a cache line, so each worker's queue can sit on its own. */
+#define CACHE_LINE 64
+
+#define LOAD( x ) __atomic_load_n( &( x ), __ATOMIC_SEQ_CST )
+#define STORE( x, v ) __atomic_store_n( &( x ), ( v ), __ATOMIC_SEQ_CST )
+#define ADD( x, v ) __atomic_add_fetch( &( x ), ( v ), __ATOMIC_SEQ_CST )
+
+/** A program that's running, either the whole program or one task. */
+typedef struct Task {
+  /** The program, and the function that runs it. */
+  void *program;
+  TaskRunner run;
+
+  /** Instruction the task starts at. */
+  int pc;
+
+  /** Value of every variable when the task was spawned.  Anything the
+      task ends up with that's different was changed by the task. */
+  Value *start;
+
+  /** The task's own variables, made when it starts running. */
+  VarStore vars;
+
+  /** Worker whose queue the task's own tasks go on. */
+  int worker;
+
+  /** Tasks this one spawned since its last join, in order. */
+  struct Task *first;
+  struct Task *last;
+
+  /** Next task spawned by the same parent. */
+  struct Task *next;
+
+  /** Everything the task printed. */
+  TextBuffer text;
+
+  /** Message for the runtime error that stopped the task, or NULL. */
+  char *error;
+
+  /** Set once the task has finished, and its parent can merge it. */
+  int done;
+} Task;
+
+/** Tasks queued by one worker.  The worker takes tasks from the end
+    where it adds them, and other workers steal from the front. */
+typedef struct {
+  /** Lock for everything in the queue. */
+  pthread_mutex_t lock;
+
+  /** The queued tasks are task[ head ] up to task[ tail - 1 ]. */
+  Task **task;
+  int head;
+  int tail;
+
+  /** Capacity of the task array. */
+  int cap;
+
+  /** Keep every worker's queue on its own cache line. */
+  char pad[ CACHE_LINE ];
+} Queue;
+
+/** The threads that run tasks, shared by every running program. */
+static struct {
+  /** Number of workers, counting the threads that aren't in the pool. */
+  int workers;
+
+  /** Queue for each worker.  Threads outside the pool all share the
+      first one. */
+  Queue *queue;
+
+  /** Number of tasks in all the queues. */
+  int queued;
+
+  /** Number of threads waiting on the wake condition. */
+  int sleepers;
+
+  /** Lock and condition for threads with nothing to do. */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+
+  /** Starts the pool the first time a task is spawned. */
+  pthread_once_t once;
+} pool = { 1, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+           PTHREAD_ONCE_INIT };
+
+/** What's needed to run the whole program under catchError(). */
+typedef struct {
+  /** The program, and the function that runs it. */
+  void *program;
+  TaskRunner run;
+
+  /** Storage for the program's variables. */
+  VarStore *vars;
+} RootRun;
+
+static void runTask( Task *task, int worker );
+
+/**
+  This function will wake every thread that's waiting for something to
+  do, if there are any.
+*/
+static void wakeWorkers( void )
+{
+  if ( LOAD( pool.sleepers ) > 0 ) {
+    pthread_mutex_lock( &pool.lock );
+    pthread_cond_broadcast( &pool.wake );
+    pthread_mutex_unlock( &pool.lock );
+  }
+}
+
+/**
+  This function will wait until there's a task in some queue, or until
+  the given task is done.  Whatever adds a task or finishes one checks
+  the sleepers count after making its change, and this checks for the
+  change after counting itself as a sleeper, so one of the two always
+  sees the other.
+  @param task the task to wait for, or NULL to just wait for work
+*/
+static void waitForWork( Task *task )
+{
+  pthread_mutex_lock( &pool.lock );
+  ADD( pool.sleepers, 1 );
+  while ( LOAD( pool.queued ) == 0 && !( task && LOAD( task->done ) ) )
+    pthread_cond_wait( &pool.wake, &pool.lock );
+  ADD( pool.sleepers, -1 );
+  pthread_mutex_unlock( &pool.lock );
+}
+
+/**
+  This function will add a task to the end of a queue.
+  @param queue the queue to add to
+  @param task the task to add
+*/
+static void pushTask( Queue *queue, Task *task )
+{
+  pthread_mutex_lock( &queue->lock );
+  if ( queue->tail >= queue->cap ) {
+    // Slide everything down to the front first, then grow if it's
+    // still full.
+    if ( queue->head > 0 ) {
+      memmove( queue->task, queue->task + queue->head,
+               ( queue->tail - queue->head ) * sizeof( Task * ) );
+      queue->tail -= queue->head;
+      queue->head = 0;
+    }
+    if ( queue->tail >= queue->cap ) {
+      queue->cap = queue->cap ? queue->cap * GROWTH_RATE : INITIAL_CAPACITY;
+      queue->task = (Task **) realloc( queue->task, queue->cap * sizeof( Task * ) );
+    }
+  }
+  queue->task[ queue->tail++ ] = task;
+  pthread_mutex_unlock( &queue->lock );
+
+  ADD( pool.queued, 1 );
+  wakeWorkers();
+}
+
+/**
+  This function will remove a task from one end of a queue.
+  @param queue the queue to take from
+  @param newest true to take the task that was added last, false for the
+  one that was added first
+  @return the task, or NULL if the queue is empty
+*/
+static Task *popTask( Queue *queue, bool newest )
+{
+  Task *task = NULL;
+  pthread_mutex_lock( &queue->lock );
+  if ( queue->head < queue->tail ) {
+    task = newest ? queue->task[ --queue->tail ] : queue->task[ queue->head++ ];
+    if ( queue->head == queue->tail )
+      queue->head = queue->tail = 0;
+  }
+  pthread_mutex_unlock( &queue->lock );
+
+  if ( task )
+    ADD( pool.queued, -1 );
+  return task;
+}
+
+/**
+  This function will find a task for a worker to run, from its own queue
+  if there's one there, or else from one of the others.
+  @param worker index of the worker
+  @return the task, or NULL if every queue is empty
+*/
+static Task *takeTask( int worker )
+{
+  if ( LOAD( pool.queued ) == 0 )
+    return NULL;
+
+  Task *task = popTask( &pool.queue[ worker ], true );
+  for ( int i = 1; task == NULL && i < pool.workers; i++ )
+    task = popTask( &pool.queue[ ( worker + i ) % pool.workers ], false );
+  return task;
+}
+
+/**
+  This function will run tasks for one of the pool's threads, forever.
+  @param arg the worker's index
+  @return never returns
+*/
+static void *workerThread( void *arg )
+{
+  int worker = (int) (intptr_t) arg;
+  while ( true ) {
+    Task *task = takeTask( worker );
+    if ( task )
+      runTask( task, worker );
+    else
+      waitForWork( NULL );
+  }
+  return NULL;
+}
+
+/**
+  This function will make the queues and start the pool's threads.  A
+  thread that doesn't start just leaves its queue to be emptied by the
+  others.
+*/
+static void startPool( void )
+{
+  pool.queue = (Queue *) calloc( pool.workers, sizeof( Queue ) );
+  for ( int i = 0; i < pool.workers; i++ )
+    pthread_mutex_init( &pool.queue[ i ].lock, NULL );
+
+  for ( int i = 1; i < pool.workers; i++ ) {
+    pthread_t thread;
+    if ( pthread_create( &thread, NULL, workerThread, (void *) (intptr_t) i ) == 0 )
+      pthread_detach( thread );
+  }
+}
+
+/**
+  This function will wait for a task to finish, running other tasks
+  while it waits.
+  @param task the task to wait for
+  @param worker index of the worker that's waiting
+*/
+static void waitTask( Task *task, int worker )
+{
+  while ( !LOAD( task->done ) ) {
+    Task *other = takeTask( worker );
+    if ( other )
+      runTask( other, worker );
+    else
+      waitForWork( task );
+  }
+}
+
+/**
+  This function will free a task that's finished.
+  @param task the task to free
+*/
+static void freeTask( Task *task )
+{
+  for ( int i = 0; i < task->vars.count; i++ )
+    freeValue( &task->start[ i ] );
+  free( task->start );
+  freeVars( &task->vars );
+  free( task->text.text );
+  free( task->error );
+  free( task );
+}
+
+/**
+  This function will wait for every task a task spawned since its last
+  join and throw them away, after the task stopped with an error.
+  @param parent the task that spawned them
+*/
+static void abandonTasks( Task *parent )
+{
+  Task *task = parent->first;
+  parent->first = parent->last = NULL;
+  while ( task ) {
+    Task *next = task->next;
+    waitTask( task, parent->worker );
+    freeTask( task );
+    task = next;
+  }
+}
+
+/**
+  This function will return true if two values are the same.
+  @param a one value
+  @param b the other value
+  @return true if they have the same type and the same value
+*/
+static bool sameValue( Value const *a, Value const *b )
+{
+  if ( a->type != b->type )
+    return false;
+  if ( a->type == VAL_STR )
+    return strcmp( a->str, b->str ) == 0;
+  return a->type == VAL_UNDEF || a->num == b->num;
+}
+
+/**
+  This function will run a task's code, then join the tasks it didn't
+  join itself, for catchError().
+  @param arg the task to run
+*/
+static void runBody( void *arg )
+{
+  Task *task = (Task *) arg;
+  task->run( task->program, &task->vars, task->pc );
+  joinTasks( &task->vars );
+}
+
+/**
+  This function will run a task to the end and mark it as done.
+  @param task the task to run
+  @param worker index of the worker running it
+*/
+static void runTask( Task *task, int worker )
+{
+  // The output only lives while the task runs.  Its text is kept
+  // until the parent joins.
+  Output *out = (Output *) malloc( sizeof( Output ) );
+  initOutput( out, appendText, &task->text );
+  task->vars.out = out;
+  for ( int i = 0; i < task->vars.count; i++ )
+    copyValue( &task->vars.vals[ i ], &task->start[ i ] );
+  task->vars.task = task;
+  task->worker = worker;
+
+  if ( !catchError( out, runBody, task ) ) {
+    size_t len = strlen( out->error );
+    task->error = (char *) malloc( len + 1 );
+    memcpy( task->error, out->error, len + 1 );
+    abandonTasks( task );
+  }
+
+  flushOutput( out );
+  free( out );
+  task->vars.out = NULL;
+
+  // The parent can free the task as soon as it sees this.
+  STORE( task->done, 1 );
+  wakeWorkers();
+}
+
+void setTaskWorkers( int count )
+{
+  pool.workers = count > 0 ? count : 1;
+}
+
+/**
+  This function will run the whole program, then join its tasks, for
+  catchError().
+  @param arg the RootRun to run
+*/
+static void runRoot( void *arg )
+{
+  RootRun *root = (RootRun *) arg;
+  root->run( root->program, root->vars, 0 );
+  joinTasks( root->vars );
+}
+
+void runTasks( void *program, VarStore *vars, TaskRunner run )
+{
+  // The program itself is a task with nothing to merge into, running on
+  // the shared queue.
+  Task self;
+  memset( &self, 0, sizeof( self ) );
+  self.program = program;
+  self.run = run;
+  vars->task = &self;
+
+  // Without counters from the caller, the program's tasks still share
+  // some for this run.
+  SharedCounters counters;
+  bool ownCounters = vars->shared == NULL;
+  if ( ownCounters ) {
+    openShared( &counters, vars->count, false );
+    vars->shared = counters.slots;
+  }
+
+  RootRun root = { program, run, vars };
+  bool ok = catchError( vars->out, runRoot, &root );
+  if ( !ok )
+    abandonTasks( &self );
+  vars->task = NULL;
+  if ( ownCounters ) {
+    closeShared( &counters );
+    vars->shared = NULL;
+  }
+  if ( !ok )
+    raiseError( vars->out );
+}
+
+void spawnTask( VarStore *vars, int pc )
+{
+  pthread_once( &pool.once, startPool );
+  Task *parent = vars->task;
+
+  Task *task = (Task *) calloc( 1, sizeof( Task ) );
+  task->program = parent->program;
+  task->run = parent->run;
+  task->pc = pc;
+  initVars( &task->vars, vars->symbols, NULL );
+  task->vars.shared = vars->shared;
+  task->start = (Value *) malloc( ( vars->count ? vars->count : 1 ) * sizeof( Value ) );
+  for ( int i = 0; i < vars->count; i++ ) {
+    task->start[ i ].str = NULL;
+    task->start[ i ].cap = 0;
+    copyValue( &task->start[ i ], &vars->vals[ i ] );
+  }
+
+  if ( parent->last )
+    parent->last->next = task;
+  else
+    parent->first = task;
+  parent->last = task;
+
+  pushTask( &pool.queue[ parent->worker ], task );
+}
+
+void joinTasks( VarStore *vars )
+{
+  Task *parent = vars->task;
+  Task *first = parent->first;
+  parent->first = parent->last = NULL;
+
+  // Everything has to finish before anything is merged, so a task
+  // that fails doesn't leave later ones running.
+  for ( Task *task = first; task; task = task->next )
+    waitTask( task, parent->worker );
+
+  char message[ MAX_RUNTIME_ERROR + 1 ] = "";
+  bool failed = false;
+  while ( first ) {
+    Task *task = first;
+    first = task->next;
+
+    // Nothing after a task that failed gets merged.
+    if ( !failed ) {
+      if ( task->text.len )
+        writeOutput( vars->out, task->text.text, task->text.len );
+      if ( task->error ) {
+        snprintf( message, sizeof( message ), "%s", task->error );
+        failed = true;
+      } else {
+        for ( int i = 0; i < vars->count; i++ )
+          if ( !sameValue( &task->vars.vals[ i ], &task->start[ i ] ) )
+            copyValue( &vars->vals[ i ], &task->vars.vals[ i ] );
+      }
+    }
+    freeTask( task );
+  }
+
+  if ( failed )
+    runtimeError( vars->out, "%s", message );
+}
+
+void swapTasks( VarStore *vars, TaskList *list )
+{
+  Task *parent = vars->task;
+  TaskList held = { parent->first, parent->last };
+  parent->first = list->first;
+  parent->last = list->last;
+  *list = held;
+}
+
+void keepTasks( VarStore *vars, TaskList *list )
+{
+  Task *parent = vars->task;
+  if ( list->first == NULL )
+    return;
+  if ( parent->last )
+    parent->last->next = list->first;
+  else
+    parent->first = list->first;
+  parent->last = list->last;
+  list->first = list->last = NULL;
+}
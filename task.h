@@ -0,0 +1,97 @@
+/**
+  @file task.h
+  @author David Lovato, dalovato
+
+  Tasks started by the spawn command, and the pool of threads that runs
+  them.  A task runs the program from a label until it falls off the
+  end.  It gets its own copy of the variables as they were when it was
+  spawned, and its own output, so nothing it does can be seen by the
+  rest of the program until the code that spawned it joins.
+
+  Join waits for every task spawned since the last join, then merges
+  them in the order they were spawned.  Each task's output is added to
+  the parent's, and every variable the task changed takes the task's
+  value, so if two tasks change the same variable, the one spawned later
+  wins.  If a task stops with a runtime error, the tasks before it are
+  merged, its output up to the error is added, and then the error is
+  reported at the join.  A task joins its own tasks before it ends, and
+  so does the whole program.
+
+  Tasks are queued on a pool of worker threads.  Each worker takes the
+  newest task from its own queue, and a worker with nothing to do steals
+  the oldest task from another queue.  A thread waiting at a join runs
+  queued tasks while it waits, so with no worker threads at all, tasks
+  just run one after another at the join.
+*/
+
+#ifndef _TASK_H_
+#define _TASK_H_
+
+#include "var.h"
+
+/** Function that runs a program from a given instruction until it falls
+    off the end, for whichever engine is running it.
+    @param program The program, in whatever form the engine uses.
+    @param vars Storage for the variables of the task running it.
+    @param pc Index of the instruction to start at.
+*/
+typedef void (*TaskRunner)( void *program, VarStore *vars, int pc );
+
+/** Tasks spawned since the last join, kept aside for code that isn't
+    running right now. */
+typedef struct {
+  /** The tasks, in the order they were spawned. */
+  struct Task *first;
+  struct Task *last;
+} TaskList;
+
+/** Choose how many threads run tasks, counting the thread that runs
+    the program.  The threads are started the first time a task is
+    spawned, so this has to be called before that.  The default is one,
+    which runs every task at its join.
+    @param count Number of threads.
+*/
+void setTaskWorkers( int count );
+
+/** Run a program from its first instruction, then join any tasks it
+    didn't join itself.  Runtime errors are reported the same way the
+    runner reports them, after every task has stopped.  If the variables
+    don't come with shared counters, the program gets its own for this
+    run.
+    @param program The program to run.
+    @param vars Storage for the program's variables.
+    @param run Function that runs the program.
+*/
+void runTasks( void *program, VarStore *vars, TaskRunner run );
+
+/** Start a task running the current program from the given instruction,
+    with a copy of the current variables.
+    @param vars Variables of the code that's spawning the task.
+    @param pc Index of the instruction the task starts at.
+*/
+void spawnTask( VarStore *vars, int pc );
+
+/** Wait for every task spawned since the last join and merge them into
+    the current variables and output.  This reports the first runtime
+    error from any of them.
+    @param vars Variables of the code that spawned the tasks.
+*/
+void joinTasks( VarStore *vars );
+
+/** Trade the tasks spawned since the last join for the ones in a list.
+    Coroutines use this so each one joins only the tasks it spawned.
+    @param vars Variables of the code that spawned the tasks.
+    @param list Tasks to put in their place, which gets the ones that
+    were there.
+*/
+void swapTasks( VarStore *vars, TaskList *list );
+
+/** Add a list of tasks after the ones spawned since the last join, and
+    leave the list empty.  After a runtime error, this hands tasks that
+    will never be joined to the code that cleans up after the error.
+    @param vars Variables of the code that spawned the tasks.
+    @param list Tasks to add.
+*/
+void keepTasks( VarStore *vars, TaskList *list );
+
+#endif
@@ -0,0 +1,109 @@
+#!/bin/bash
+# Run every script-NN.txt test under each engine, with the JIT, and from
+# a compiled cache file, and check the output against expected-NN.txt or expected-stderr-NN.txt.
+# Then check the other ways of running scripts against their own
+# expected files.
+# @author David Lovato, dalovato
+
+export MESSAGE="Hello World"
+status=0
+
+for script in script-*.txt; do
+  num=${script#script-}
+  num=${num%.txt}
+
+  for opts in "--engine=objects" "--engine=switch" "--engine=threaded" \
+              "--no-optimize" "--jit" "--output-thread" "--compile"; do
+    # For --compile, save the compiled script, then run it from there.
+    # Scripts with errors don't get a compiled file, so they're parsed.
+    if [ "$opts" = "--compile" ]; then
+      ./nonde --compile $script > /dev/null 2>&1
+      ./nonde $script > output.txt 2> stderr.txt
+      code=$?
+      rm -f $script.ndc
+    else
+      ./nonde $opts $script > output.txt 2> stderr.txt
+      code=$?
+    fi
+
+    if [ -f expected-$num.txt ]; then
+      if [ $code -ne 0 ] || ! cmp -s output.txt expected-$num.txt; then
+        echo "FAIL: $script with $opts"
+        status=1
+      fi
+    elif [ -f expected-stderr-$num.txt ]; then
+      if [ $code -eq 0 ] || ! cmp -s stderr.txt expected-stderr-$num.txt; then
+        echo "FAIL: $script with $opts"
+        status=1
+      fi
+    fi
+  done
+done
+
+# A program linked against libnonde.a, for what an embedding host sees.
+./libtest > output.txt 2> stderr.txt
+if [ $? -ne 0 ] || ! cmp -s output.txt expected-lib.txt; then
+  echo "FAIL: libtest"
+  status=1
+fi
+
+# A round trip through a server, which has to keep serving after a
+# division that traps on the hardware, and after a runtime error.
+sock=test-serve.sock
+./nonde --serve $sock 2> /dev/null &
+server=$!
+for i in $(seq 50); do
+  [ -S $sock ] && break
+  sleep 0.1
+done
+for xy in "7 2" "-9223372036854775808 -1" "9 0" "7 -1"; do
+  set -- $xy
+  x=$1 y=$2 ./nonde --connect $sock serve-script.txt 2>&1
+  echo "status $?"
+done > output.txt
+
+# Editing a script has to be seen on the next run, even when the edit
+# keeps the size and lands in the same second.
+echo 'print "A\n";' > test-serve-edit.txt
+./nonde --connect $sock test-serve-edit.txt >> output.txt 2>&1
+echo 'print "B\n";' > test-serve-edit.txt
+./nonde --connect $sock test-serve-edit.txt >> output.txt 2>&1
+rm -f test-serve-edit.txt
+kill $server
+wait $server 2> /dev/null
+rm -f $sock
+if ! cmp -s output.txt expected-serve.txt; then
+  echo "FAIL: --serve"
+  status=1
+fi
+
+# A batch with a script that's missing, on more than one worker.  Times
+# change from run to run, so they're left out.
+./nonde --batch batch-manifest.txt --workers=2 2>&1 | sed 's/[0-9.]* ms/N ms/' > output.txt
+if [ ${PIPESTATUS[0]} -ne 1 ] || ! cmp -s output.txt expected-batch.txt; then
+  echo "FAIL: --batch"
+  status=1
+fi
+
+# One script over every row of a file, with rows that branch apart and
+# one that stops with an error.
+./nonde --rows rows-input.csv rows-script.txt > output.txt 2> stderr.txt
+if [ $? -ne 1 ] || ! cmp -s output.txt expected-rows.txt ||
+   ! cmp -s stderr.txt expected-stderr-rows.txt; then
+  echo "FAIL: --rows"
+  status=1
+fi
+
+# The same rows split across shards have to come out exactly the same,
+# error and all.
+./nonde --rows rows-input.csv --shards=3 rows-script.txt > output.txt 2> stderr.txt
+if [ $? -ne 1 ] || ! cmp -s output.txt expected-rows.txt ||
+   ! cmp -s stderr.txt expected-stderr-rows.txt; then
+  echo "FAIL: --shards"
+  status=1
+fi
+
+if [ $status -eq 0 ]; then
+  echo "All tests passed"
+fi
+exit $status
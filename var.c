@@ -0,0 +1,223 @@
+/**
+  This file contains the symbol table and variable storage.
+  @file var.c
+  @author David Lovato, dalovato
+*/
+
+#include "var.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+void initSymbols( SymbolTable *symbols )
+{
+  initMap( &symbols->index );
+  symbols->count = 0;
+  symbols->cap = INITIAL_CAPACITY;
+  symbols->names = (char **) malloc( symbols->cap * sizeof( char * ) );
+}
+
+int internSymbol( SymbolTable *symbols, char const *name, int len )
+{
+  int slot = findLabel( &symbols->index, name, len );
+  if ( slot != -1 )
+    return slot;
+
+  // First time we've seen this name, give it the next slot.
+  if ( symbols->count >= symbols->cap ) {
+    symbols->cap *= GROWTH_RATE;
+    symbols->names = (char **) realloc( symbols->names, symbols->cap * sizeof( char * ) );
+  }
+
+  slot = symbols->count++;
+  symbols->names[ slot ] = (char *) malloc( len + 1 );
+  memcpy( symbols->names[ slot ], name, len );
+  symbols->names[ slot ][ len ] = '\0';
+  addLabel( &symbols->index, name, len, slot );
+
+  return slot;
+}
+
+void freeSymbols( SymbolTable *symbols )
+{
+  for ( int i = 0; i < symbols->count; i++ )
+    free( symbols->names[ i ] );
+  free( symbols->names );
+  freeMap( &symbols->index );
+}
+
+/**
+  This function will copy text into a value's buffer, growing the buffer
+  only if the text won't fit.
+  @param val the value to store the text in
+  @param str the text to store
+*/
+static void storeText( Value *val, char const *str )
+{
+  int len = strlen( str );
+  if ( len + 1 > val->cap ) {
+    if ( val->cap )
+      free( val->str );
+    val->cap = len + 1;
+    val->str = (char *) malloc( val->cap );
+  }
+
+  memcpy( val->str, str, len + 1 );
+  val->type = VAL_STR;
+  val->numState = NUM_UNKNOWN;
+}
+
+void initText( Value *val, char const *str )
+{
+  val->str = NULL;
+  val->cap = 0;
+  storeText( val, str );
+}
+
+void initConst( Value *val, char const *str )
+{
+  val->str = (char *) str;
+  val->cap = 0;
+  val->type = VAL_STR;
+  val->numState = NUM_UNKNOWN;
+}
+
+bool toNumber( Value *val, int64_t *num )
+{
+  switch ( val->type ) {
+  case VAL_INT:
+    *num = val->num;
+    return true;
+  case VAL_BOOL:
+    // True is "1", but false is the empty string, which isn't a number.
+    *num = val->num;
+    return val->num != 0;
+  case VAL_STR:
+    // Convert the string the first time it's used as a number, then
+    // remember the result.
+    if ( val->numState == NUM_UNKNOWN ) {
+      char *end;
+      val->num = strtoll( val->str, &end, 10 );
+      val->numState = end == val->str ? NUM_INVALID : NUM_VALID;
+    }
+    *num = val->num;
+    return val->numState == NUM_VALID;
+  default:
+    return false;
+  }
+}
+
+char const *toText( Value const *val, char *buf )
+{
+  switch ( val->type ) {
+  case VAL_INT:
+    sprintf( buf, "%" PRId64, val->num );
+    return buf;
+  case VAL_BOOL:
+    return val->num ? "1" : "";
+  case VAL_STR:
+    return val->str;
+  default:
+    return "";
+  }
+}
+
+bool isTrue( Value const *val )
+{
+  switch ( val->type ) {
+  case VAL_INT:
+    return true;
+  case VAL_BOOL:
+    return val->num != 0;
+  case VAL_STR:
+    return val->str[ 0 ] != '\0';
+  default:
+    return false;
+  }
+}
+
+void freeValue( Value *val )
+{
+  if ( val->cap )
+    free( val->str );
+}
+
+void initVars( VarStore *vars, SymbolTable const *symbols, struct Output *out )
+{
+  vars->count = symbols->count;
+  vars->symbols = symbols;
+  vars->out = out;
+  vars->task = NULL;
+  vars->shared = NULL;
+  vars->sched = NULL;
+  vars->vals = (Value *) malloc( ( vars->count ? vars->count : 1 ) * sizeof( Value ) );
+
+  for ( int i = 0; i < vars->count; i++ ) {
+    vars->vals[ i ].type = VAL_UNDEF;
+    vars->vals[ i ].str = NULL;
+    vars->vals[ i ].cap = 0;
+  }
+}
+
+void importEnvironment( VarStore *vars )
+{
+  // This is the only place we look at the environment.  Variables we
+  // inherit are copied in once, then everything runs out of the table.
+  for ( int i = 0; i < vars->count; i++ ) {
+    char const *env = getenv( vars->symbols->names[ i ] );
+    if ( env )
+      storeText( &vars->vals[ i ], env );
+  }
+}
+
+Value *getVar( VarStore *vars, int slot )
+{
+  return &vars->vals[ slot ];
+}
+
+void setInt( VarStore *vars, int slot, int64_t num )
+{
+  vars->vals[ slot ].type = VAL_INT;
+  vars->vals[ slot ].num = num;
+}
+
+void setBool( VarStore *vars, int slot, bool b )
+{
+  vars->vals[ slot ].type = VAL_BOOL;
+  vars->vals[ slot ].num = b;
+}
+
+void setValue( VarStore *vars, int slot, Value const *val )
+{
+  copyValue( &vars->vals[ slot ], val );
+}
+
+void copyValue( Value *dest, Value const *val )
+{
+  if ( dest == val )
+    return;
+
+  if ( val->type == VAL_STR ) {
+    storeText( dest, val->str );
+
+    // The copy can keep the number we already converted.
+    dest->numState = val->numState;
+    dest->num = val->num;
+  } else {
+    dest->type = val->type;
+    dest->num = val->num;
+  }
+}
+
+char const *varName( VarStore *vars, int slot )
+{
+  return vars->symbols->names[ slot ];
+}
+
+void freeVars( VarStore *vars )
+{
+  for ( int i = 0; i < vars->count; i++ )
+    freeValue( &vars->vals[ i ] );
+  free( vars->vals );
+}
@@ -0,0 +1,238 @@
+/**
+  @file var.h
+  @author David Lovato, dalovato
+
+  Interpreter-owned storage for variables.  Variable names are interned
+  into a SymbolTable while the program is parsed, so commands can refer
+  to their operands by slot index, and values are kept in a dense array
+  indexed by that slot.  Values are typed, so integers stay in binary
+  until something needs their text.
+*/
+
+#ifndef _VAR_H_
+#define _VAR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "label.h"
+
+/** Table of all the variable names used by a program.  Each name gets
+    a small integer slot the first time it's seen. */
+typedef struct {
+  /** Map from a variable name to its slot. */
+  LabelMap index;
+
+  /** Name of the variable in each slot. */
+  char **names;
+
+  /** Number of slots in use. */
+  int count;
+
+  /** Capacity of the names array. */
+  int cap;
+} SymbolTable;
+
+/** Kinds of value a variable can hold. */
+typedef enum {
+  /** The variable hasn't been given a value. */
+  VAL_UNDEF,
+
+  /** An integer, kept in binary until someone needs its text. */
+  VAL_INT,
+
+  /** The result of a comparison, "1" for true and "" for false. */
+  VAL_BOOL,
+
+  /** Arbitrary text, from a literal or the environment. */
+  VAL_STR
+} ValueType;
+
+/** States for the cached numeric value of a string. */
+typedef enum {
+  /** The string hasn't been converted to a number yet. */
+  NUM_UNKNOWN,
+
+  /** The string was converted, and num holds the result. */
+  NUM_VALID,
+
+  /** The string was converted, and it isn't a valid number. */
+  NUM_INVALID
+} NumState;
+
+/** Enough room for the text of any 64-bit integer, plus a null. */
+#define NUMBER_LEN 21
+
+/** A typed value, held by a variable or a literal operand. */
+typedef struct {
+  /** Kind of value this is. */
+  ValueType type;
+
+  /** For VAL_STR, whether num holds the string converted to a number. */
+  NumState numState;
+
+  /** Value of a VAL_INT or VAL_BOOL, or the converted value of a string. */
+  int64_t num;
+
+  /** Text of a VAL_STR.  The buffer is kept when the value changes
+      type, so it can be reused by the next string assignment. */
+  char *str;
+
+  /** Capacity of the str buffer, or zero if the value doesn't own
+      str. */
+  int cap;
+} Value;
+
+/** Values for all the variables in a running program. */
+typedef struct {
+  /** Value for each slot in the symbol table. */
+  Value *vals;
+
+  /** Number of slots. */
+  int count;
+
+  /** Symbol table the slots came from, for error messages. */
+  SymbolTable const *symbols;
+
+  /** Where the program's output and runtime errors go. */
+  struct Output *out;
+
+  /** Task these variables belong to, for spawn and join, or NULL if
+      nothing's running with them. */
+  struct Task *task;
+
+  /** Shared counters for the atomic commands, SHARED_STRIDE values
+      apart, or NULL if nothing's running with them.  The store doesn't
+      own them. */
+  int64_t *shared;
+
+  /** Run queue for coroutines started by go, or NULL if nothing's
+      running with these variables. */
+  struct Scheduler *sched;
+} VarStore;
+
+/** Initialize an empty symbol table.
+    @param symbols Address of the table to initialize.
+*/
+void initSymbols( SymbolTable *symbols );
+
+/** Return the slot for the given variable name, giving it a new slot if
+    it hasn't been seen before.
+    @param symbols Table to look the name up in.
+    @param name Name of the variable.  It doesn't need to be null
+    terminated.
+    @param len Length of the name.
+    @return Slot index for the variable.
+*/
+int internSymbol( SymbolTable *symbols, char const *name, int len );
+
+/** Free the memory used by a symbol table.
+    @param symbols Table to free.
+*/
+void freeSymbols( SymbolTable *symbols );
+
+/** Make storage for every variable in the given symbol table.  They
+    all start out undefined.
+    @param vars Address of the store to initialize.
+    @param symbols Symbol table for the program that will run.
+    @param out Output for the program that will run.
+*/
+void initVars( VarStore *vars, SymbolTable const *symbols, struct Output *out );
+
+/** Give any variable that's also in the process environment that
+    value, the way a script run from the command line inherits them.
+    @param vars Store to modify.
+*/
+void importEnvironment( VarStore *vars );
+
+/** Return the value of a variable.
+    @param vars Store to read from.
+    @param slot Slot of the variable.
+    @return Value of the variable, with type VAL_UNDEF if it's undefined.
+*/
+Value *getVar( VarStore *vars, int slot );
+
+/** Give a variable an integer value.
+    @param vars Store to modify.
+    @param slot Slot of the variable.
+    @param num New value for the variable.
+*/
+void setInt( VarStore *vars, int slot, int64_t num );
+
+/** Give a variable a true or false value.
+    @param vars Store to modify.
+    @param slot Slot of the variable.
+    @param b New value for the variable.
+*/
+void setBool( VarStore *vars, int slot, bool b );
+
+/** Give a variable a copy of another value.  A string is copied into
+    the variable's own buffer, which is reused if it's big enough, so
+    repeated assignment doesn't allocate.
+    @param vars Store to modify.
+    @param slot Slot of the variable.
+    @param val New value for the variable.
+*/
+void setValue( VarStore *vars, int slot, Value const *val );
+
+/** Copy a value into another one, the same way setValue() does.
+    @param dest Value to change, which must own its text or have none.
+    @param val Value to copy.
+*/
+void copyValue( Value *dest, Value const *val );
+
+/** Initialize a value to hold a copy of the given text.
+    @param val Value to initialize.
+    @param str Text for the value.
+*/
+void initText( Value *val, char const *str );
+
+/** Initialize a value to hold text that's owned by someone else, like a
+    string in an arena.  The text isn't copied, and it isn't freed with
+    the value, so it must outlive it.  A value like this should never be
+    the destination of an assignment.
+    @param val Value to initialize.
+    @param str Text for the value.
+*/
+void initConst( Value *val, char const *str );
+
+/** Get the numeric value of a value.  A string is only converted the
+    first time this is called on it; the result is cached after that.
+    @param val Value to convert.
+    @param num Storage for the result.
+    @return True if the value is a valid number.
+*/
+bool toNumber( Value *val, int64_t *num );
+
+/** Get the text of a value.
+    @param val Value to get the text of.
+    @param buf Room for NUMBER_LEN characters, in case a number has to
+    be formatted.
+    @return Text of the value.
+*/
+char const *toText( Value const *val, char *buf );
+
+/** Return true if a value counts as true for an if command, meaning
+    its text isn't empty.
+    @param val Value to test.
+    @return True if the value is true.
+*/
+bool isTrue( Value const *val );
+
+/** Free any memory held by a value.
+    @param val Value to free.
+*/
+void freeValue( Value *val );
+
+/** Return the name of the variable in the given slot.
+    @param vars Store the slot belongs to.
+    @param slot Slot of the variable.
+    @return Name of the variable.
+*/
+char const *varName( VarStore *vars, int slot );
+
+/** Free the memory used by a variable store.
+    @param vars Store to free.
+*/
+void freeVars( VarStore *vars );
+
+#endif
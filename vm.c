@@ -0,0 +1,575 @@
+/**
+  This file contains the bytecode interpreter, a single loop that
+  dispatches on each instruction's opcode.
+  @file vm.c
+  @author David Lovato, dalovato
+*/
+
+#include "vm.h"
+#include "output.h"
+#include "task.h"
+#include "coroutine.h"
+#include "shared.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+  This function will return the value for an operand, reporting a
+  runtime error if it's an undefined variable.
+  @param code the code being run
+  @param vars the variables for the running program
+  @param x the operand, a variable slot or a literal
+  @param pc index of the instruction, for error messages
+  @return the value of the operand
+*/
+static inline Value *fetch( Code *code, VarStore *vars, int x, int pc )
+{
+  if ( IS_LITERAL( x ) )
+    return &code->lits[ LITERAL_INDEX( x ) ];
+
+  Value *val = &vars->vals[ x ];
+  if ( val->type == VAL_UNDEF ) {
+    runtimeError( vars->out, "Undefined variable: %s (line %d)", varName( vars, x ),
+                  code->lines[ pc ] );
+  }
+  return val;
+}
+
+/**
+  This function will return the numeric value of an operand, reporting a
+  runtime error if it isn't a valid number.
+  @param code the code being run
+  @param vars the variables for the running program
+  @param x the operand, a variable slot or a literal
+  @param pc index of the instruction, for error messages
+  @return the value of the operand as a number
+*/
+static inline int64_t number( Code *code, VarStore *vars, int x, int pc )
+{
+  Value *val = fetch( code, vars, x, pc );
+
+  // Integers are the common case, so check for them before calling out.
+  if ( val->type == VAL_INT )
+    return val->num;
+
+  int64_t num;
+  if ( !toNumber( val, &num ) ) {
+    runtimeError( vars->out, "Invalid number (line %d)", code->lines[ pc ] );
+  }
+  return num;
+}
+
+/**
+  This function will report a runtime error if a divisor is zero.
+  @param code the code being run
+  @param vars the variables for the running program
+  @param divisor the value to check
+  @param pc index of the instruction, for error messages
+*/
+static inline void checkDivisor( Code *code, VarStore *vars, int64_t divisor, int pc )
+{
+  if ( divisor == 0 ) {
+    runtimeError( vars->out, "Divide by zero (line %d)", code->lines[ pc ] );
+  }
+}
+
+/**
+  This function will divide two numbers that have already been checked
+  with checkDivisor().  Dividing INT64_MIN by -1 traps on the hardware,
+  so -1 negates instead, and wraps like the other arithmetic.
+  @param x the number to divide
+  @param y the number to divide by
+  @return the quotient
+*/
+static inline int64_t divide( int64_t x, int64_t y )
+{
+  return y == -1 ? (int64_t) ( 0 - (uint64_t) x ) : x / y;
+}
+
+/**
+  This function will find the remainder from dividing two numbers that
+  have already been checked with checkDivisor().  Like divide(), it
+  steers clear of INT64_MIN % -1, which traps too.
+  @param x the number to divide
+  @param y the number to divide by
+  @return the remainder
+*/
+static inline int64_t modulo( int64_t x, int64_t y )
+{
+  return y == -1 ? 0 : x % y;
+}
+
+/**
+  This function will run an OP_INC instruction, adding a constant to a
+  variable in place.
+  @param code the code being run
+  @param vars the variables for the running program
+  @param in the instruction
+  @param pc index of the instruction, for error messages
+*/
+static inline void increment( Code *code, VarStore *vars, Instr *in, int pc )
+{
+  // Wrap on overflow, the same way constant folding does.
+  Value *val = &vars->vals[ in->a ];
+  if ( val->type == VAL_INT )
+    val->num = (int64_t) ( (uint64_t) val->num + (uint64_t) in->c );
+  else
+    setInt( vars, in->a,
+            (int64_t) ( (uint64_t) number( code, vars, in->a, pc ) + (uint64_t) in->c ) );
+}
+
+/**
+  This function will run the instruction at pc.
+  @param code the code being run
+  @param vars the variables for the running program
+  @param pc index of the instruction to run
+  @return index of the next instruction to run
+*/
+static inline int step( Code *code, VarStore *vars, int pc )
+{
+  Instr *in = &code->instr[ pc ];
+
+  // Room to format a value, if print needs a number's text.
+  char buf[ NUMBER_LEN ];
+
+  switch ( in->op ) {
+  case OP_PRINT:
+    printOutput( vars->out, toText( fetch( code, vars, in->a, pc ), buf ) );
+    return pc + 1;
+
+  case OP_SET:
+    setValue( vars, in->a, fetch( code, vars, in->b, pc ) );
+    return pc + 1;
+
+  // Arithmetic is done unsigned, so overflow wraps the same way it does
+  // when it's folded instead of being undefined.
+  case OP_ADD: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    setInt( vars, in->a, (int64_t) ( (uint64_t) x + (uint64_t) y ) );
+    return pc + 1;
+  }
+
+  case OP_SUB: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    setInt( vars, in->a, (int64_t) ( (uint64_t) x - (uint64_t) y ) );
+    return pc + 1;
+  }
+
+  case OP_MULT: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    setInt( vars, in->a, (int64_t) ( (uint64_t) x * (uint64_t) y ) );
+    return pc + 1;
+  }
+
+  case OP_DIV: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    checkDivisor( code, vars, y, pc );
+    setInt( vars, in->a, divide( x, y ) );
+    return pc + 1;
+  }
+
+  case OP_MOD: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    checkDivisor( code, vars, y, pc );
+    setInt( vars, in->a, modulo( x, y ) );
+    return pc + 1;
+  }
+
+  case OP_EQ: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    setBool( vars, in->a, x == y );
+    return pc + 1;
+  }
+
+  case OP_LESS: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    setBool( vars, in->a, x < y );
+    return pc + 1;
+  }
+
+  case OP_GOTO:
+    return in->a;
+
+  case OP_IF:
+    return isTrue( fetch( code, vars, in->a, pc ) ) ? in->b : pc + 1;
+
+  case OP_SPAWN:
+    spawnTask( vars, in->a );
+    return pc + 1;
+
+  case OP_JOIN:
+    joinTasks( vars );
+    return pc + 1;
+
+  case OP_GO:
+    startCoroutine( vars, in->a );
+    return pc + 1;
+
+  case OP_YIELD:
+    return YIELD_AT( pc + 1 );
+
+  case OP_ATOMIC_ADD:
+    setInt( vars, in->a, sharedAdd( SHARED_SLOT( vars->shared, in->b ),
+                                    number( code, vars, in->c, pc ) ) );
+    return pc + 1;
+
+  case OP_ATOMIC_MAX:
+    setInt( vars, in->a, sharedMax( SHARED_SLOT( vars->shared, in->b ),
+                                    number( code, vars, in->c, pc ) ) );
+    return pc + 1;
+
+  case OP_CAS: {
+    int64_t x = number( code, vars, in->a, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    setInt( vars, in->a, sharedCas( SHARED_SLOT( vars->shared, in->b ), x, y ) );
+    return pc + 1;
+  }
+
+  case OP_INC:
+    increment( code, vars, in, pc );
+    return pc + 1;
+
+  case OP_LESS_IF: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    setBool( vars, in->a, x < y );
+    return x < y ? in[ 1 ].b : pc + 2;
+  }
+
+  case OP_EQ_IF: {
+    int64_t x = number( code, vars, in->b, pc );
+    int64_t y = number( code, vars, in->c, pc );
+    setBool( vars, in->a, x == y );
+    return x == y ? in[ 1 ].b : pc + 2;
+  }
+  }
+
+  // Never reached.
+  return pc + 1;
+}
+
+void convertLiterals( Code *code )
+{
+  for ( int i = 0; i < code->litCount; i++ ) {
+    int64_t num;
+    toNumber( &code->lits[ i ], &num );
+  }
+}
+
+/**
+  This function will run code in the dispatch loop from the given
+  instruction until it yields or falls off the end, as a SliceRunner.
+  @param program the code to run
+  @param vars the variables for the running coroutine
+  @param pc index of the instruction to start at
+  @return YIELD_AT() the next instruction, or the instruction count
+*/
+static int runCodeSlice( void *program, VarStore *vars, int pc )
+{
+  Code *code = (Code *) program;
+
+  // A yield comes back negative, so one unsigned test catches both ways
+  // out of the loop.
+  while ( (unsigned) pc < (unsigned) code->count )
+    pc = step( code, vars, pc );
+  return pc;
+}
+
+/**
+  This function will run code in the dispatch loop from the given
+  instruction, along with any coroutines it starts, as a TaskRunner.
+  @param program the code to run
+  @param vars the variables for the running program
+  @param pc index of the instruction to start at
+*/
+static void runCodeFrom( void *program, VarStore *vars, int pc )
+{
+  runCoroutines( program, (Code *) program, vars, pc, runCodeSlice );
+}
+
+void runCode( Code *code, VarStore *vars )
+{
+  convertLiterals( code );
+  runTasks( code, vars, runCodeFrom );
+}
+
+int stepCode( Code *code, VarStore *vars, int pc )
+{
+  return step( code, vars, pc );
+}
+
+#ifdef HAVE_COMPUTED_GOTO
+
+/** What the threaded loop needs, so it can run under catchError(). */
+typedef struct {
+  /** Code to run. */
+  Code *code;
+
+  /** Storage for the program's variables. */
+  VarStore *vars;
+
+  /** Instruction to start at. */
+  int pc;
+
+  /** Handler address for each instruction, freed by the caller. */
+  void **thread;
+} ThreadedRun;
+
+/**
+  This function will run the code from the given instruction until it
+  yields or falls off the end, threading it first if that hasn't been
+  done yet.  The thread is kept for the next time a coroutine resumes.
+  @param run the code, and its thread
+  @param vars the variables for the running coroutine
+  @param pc index of the instruction to start at
+  @return YIELD_AT() the next instruction, or the instruction count
+*/
+static int threadedLoop( ThreadedRun *run, VarStore *vars, int pc )
+{
+  Code *code = run->code;
+
+  // Handler for each opcode, in the same order as the Opcode enum.
+  static void *handlers[ OP_COUNT ] = {
+    &&do_print, &&do_set, &&do_add, &&do_sub, &&do_mult, &&do_div,
+    &&do_mod, &&do_eq, &&do_less, &&do_goto, &&do_if, &&do_spawn,
+    &&do_join, &&do_go, &&do_yield, &&do_atomic_add, &&do_atomic_max,
+    &&do_cas, &&do_inc, &&do_less_if, &&do_eq_if
+  };
+
+  // Thread the code, with one extra entry so falling off the end
+  // dispatches to the exit.
+  void **thread = run->thread;
+  if ( thread == NULL ) {
+    thread = (void **) malloc( ( code->count + 1 ) * sizeof( void * ) );
+    run->thread = thread;
+    for ( int i = 0; i < code->count; i++ )
+      thread[ i ] = handlers[ code->instr[ i ].op ];
+    thread[ code->count ] = &&done;
+  }
+
+  // Room to format a value, if print needs a number's text.
+  char buf[ NUMBER_LEN ];
+
+  Instr *in;
+  int64_t x, y;
+
+// Jump to the handler for the instruction at pc.
+#define DISPATCH() do { in = &code->instr[ pc ]; goto *thread[ pc ]; } while ( 0 )
+
+// Evaluate the two value operands of a binary instruction.
+#define OPERANDS() do { x = number( code, vars, in->b, pc ); \
+                        y = number( code, vars, in->c, pc ); } while ( 0 )
+
+  DISPATCH();
+
+ do_print:
+  printOutput( vars->out, toText( fetch( code, vars, in->a, pc ), buf ) );
+  pc++;
+  DISPATCH();
+
+ do_set:
+  setValue( vars, in->a, fetch( code, vars, in->b, pc ) );
+  pc++;
+  DISPATCH();
+
+ do_add:
+  OPERANDS();
+  setInt( vars, in->a, (int64_t) ( (uint64_t) x + (uint64_t) y ) );
+  pc++;
+  DISPATCH();
+
+ do_sub:
+  OPERANDS();
+  setInt( vars, in->a, (int64_t) ( (uint64_t) x - (uint64_t) y ) );
+  pc++;
+  DISPATCH();
+
+ do_mult:
+  OPERANDS();
+  setInt( vars, in->a, (int64_t) ( (uint64_t) x * (uint64_t) y ) );
+  pc++;
+  DISPATCH();
+
+ do_div:
+  OPERANDS();
+  checkDivisor( code, vars, y, pc );
+  setInt( vars, in->a, divide( x, y ) );
+  pc++;
+  DISPATCH();
+
+ do_mod:
+  OPERANDS();
+  checkDivisor( code, vars, y, pc );
+  setInt( vars, in->a, modulo( x, y ) );
+  pc++;
+  DISPATCH();
+
+ do_eq:
+  OPERANDS();
+  setBool( vars, in->a, x == y );
+  pc++;
+  DISPATCH();
+
+ do_less:
+  OPERANDS();
+  setBool( vars, in->a, x < y );
+  pc++;
+  DISPATCH();
+
+ do_goto:
+  pc = in->a;
+  DISPATCH();
+
+ do_if:
+  pc = isTrue( fetch( code, vars, in->a, pc ) ) ? in->b : pc + 1;
+  DISPATCH();
+
+ do_spawn:
+  spawnTask( vars, in->a );
+  pc++;
+  DISPATCH();
+
+ do_join:
+  joinTasks( vars );
+  pc++;
+  DISPATCH();
+
+ do_go:
+  startCoroutine( vars, in->a );
+  pc++;
+  DISPATCH();
+
+ do_yield:
+  return YIELD_AT( pc + 1 );
+
+ do_atomic_add:
+  x = number( code, vars, in->c, pc );
+  setInt( vars, in->a, sharedAdd( SHARED_SLOT( vars->shared, in->b ), x ) );
+  pc++;
+  DISPATCH();
+
+ do_atomic_max:
+  x = number( code, vars, in->c, pc );
+  setInt( vars, in->a, sharedMax( SHARED_SLOT( vars->shared, in->b ), x ) );
+  pc++;
+  DISPATCH();
+
+ do_cas:
+  x = number( code, vars, in->a, pc );
+  y = number( code, vars, in->c, pc );
+  setInt( vars, in->a, sharedCas( SHARED_SLOT( vars->shared, in->b ), x, y ) );
+  pc++;
+  DISPATCH();
+
+ do_inc:
+  increment( code, vars, in, pc );
+  pc++;
+  DISPATCH();
+
+ do_less_if:
+  OPERANDS();
+  setBool( vars, in->a, x < y );
+  pc = x < y ? in[ 1 ].b : pc + 2;
+  DISPATCH();
+
+ do_eq_if:
+  OPERANDS();
+  setBool( vars, in->a, x == y );
+  pc = x == y ? in[ 1 ].b : pc + 2;
+  DISPATCH();
+
+#undef DISPATCH
+#undef OPERANDS
+
+ done:
+  return code->count;
+}
+
+/**
+  This function will run one slice of a coroutine with threaded
+  dispatch, as a SliceRunner.
+  @param program the ThreadedRun for the code
+  @param vars the variables for the running coroutine
+  @param pc index of the instruction to start at
+  @return YIELD_AT() the next instruction, or the instruction count
+*/
+static int runThreadedSlice( void *program, VarStore *vars, int pc )
+{
+  return threadedLoop( (ThreadedRun *) program, vars, pc );
+}
+
+/**
+  This function will run the coroutines for a ThreadedRun, for
+  catchError().
+  @param arg the ThreadedRun to run
+*/
+static void runThreadedCoroutines( void *arg )
+{
+  ThreadedRun *run = (ThreadedRun *) arg;
+  runCoroutines( run, run->code, run->vars, run->pc, runThreadedSlice );
+}
+
+/**
+  This function will run code with threaded dispatch from the given
+  instruction, along with any coroutines it starts, as a TaskRunner.
+  @param program the code to run
+  @param vars the variables for the running program
+  @param pc index of the instruction to start at
+*/
+static void runThreadedFrom( void *program, VarStore *vars, int pc )
+{
+  // The thread has to be freed even if the program stops with an error.
+  ThreadedRun run = { (Code *) program, vars, pc, NULL };
+  bool ok = catchError( vars->out, runThreadedCoroutines, &run );
+  free( run.thread );
+  if ( !ok )
+    raiseError( vars->out );
+}
+
+void runThreaded( Code *code, VarStore *vars )
+{
+  convertLiterals( code );
+  runTasks( code, vars, runThreadedFrom );
+}
+
+#else
+
+void runThreaded( Code *code, VarStore *vars )
+{
+  runCode( code, vars );
+}
+
+#endif
+
+/** Code and variables for a run under catchError(). */
+typedef struct {
+  /** Code to run. */
+  Code *code;
+
+  /** Variables for the run. */
+  VarStore *vars;
+} CaughtRun;
+
+/**
+  This function will run code with direct-threaded dispatch, for
+  catchError().
+  @param arg the CaughtRun to do
+*/
+static void runCaught( void *arg )
+{
+  CaughtRun *run = (CaughtRun *) arg;
+  runThreaded( run->code, run->vars );
+}
+
+bool catchThreaded( Code *code, VarStore *vars )
+{
+  CaughtRun run = { code, vars };
+  return catchError( vars->out, runCaught, &run );
+}
@@ -0,0 +1,66 @@
+/**
+  @file vm.h
+  @author David Lovato, dalovato
+
+  Interpreter for compiled bytecode.
+*/
+
+#ifndef _VM_H_
+#define _VM_H_
+
+#include "bytecode.h"
+#include "var.h"
+
+/** The threaded engine needs GCC's labels-as-values extension, which
+    clang supports too.  Other compilers get the switch loop instead. */
+#if defined( __GNUC__ ) && !defined( NO_COMPUTED_GOTO )
+#define HAVE_COMPUTED_GOTO 1
+#endif
+
+/** Convert every literal to a number ahead of time.  Once code is
+    shared, by tasks or by runs on different threads, the literal pool
+    can only be read, so a conversion can't be cached the first time
+    it's needed.  Running code does this itself; code that's shared
+    between runs needs it done once before any of them start.
+    @param code Code whose literals to convert.
+*/
+void convertLiterals( Code *code );
+
+/** Run compiled code from the first instruction until it falls off the
+    end, then join any tasks it spawned.  Runtime errors are reported
+    with their source line, through the program's Output.
+    @param code Code to run.
+    @param vars Storage for the program's variables.
+*/
+void runCode( Code *code, VarStore *vars );
+
+/** Run a single instruction.  This is how the JIT falls back to the
+    interpreter for anything it doesn't handle natively.
+    @param code Code being run.
+    @param vars Storage for the program's variables.
+    @param pc Index of the instruction to run.
+    @return Index of the next instruction to run.
+*/
+int stepCode( Code *code, VarStore *vars, int pc );
+
+/** Run compiled code with direct-threaded dispatch.  Each instruction
+    is translated to the address of its handler before the program
+    starts, and every handler jumps straight to the next one, so there's
+    no central dispatch branch.  Without HAVE_COMPUTED_GOTO, this just
+    calls runCode().
+    @param code Code to run.
+    @param vars Storage for the program's variables.
+*/
+void runThreaded( Code *code, VarStore *vars );
+
+/** Run compiled code with runThreaded(), catching any runtime error
+    instead of exiting.  This is how code that hosts scripts runs them.
+    @param code Code to run.
+    @param vars Storage for the program's variables, with the Output
+    that gets the error.
+    @return False if there was a runtime error, with its message in the
+    Output's error field.
+*/
+bool catchThreaded( Code *code, VarStore *vars );
+
+#endif